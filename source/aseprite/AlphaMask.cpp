@@ -0,0 +1,158 @@
+
+#include "AlphaMask.h"
+#include "Aseprite.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace aseprite
+{
+
+namespace
+{
+
+inline int floorDiv64(int x)
+{
+    return x >= 0 ? x / 64 : -((-x + 63) / 64);
+}
+
+}
+
+AlphaMask::AlphaMask(int width, int height) :
+    width(width),
+    height(height),
+    wordsPerRow((width + 63) / 64),
+    words(wordsPerRow * height, 0u)
+{}
+
+AlphaMask AlphaMask::fromFrame(const Sprite &sprite, const Frame &frame, int x, int y, int width, int height)
+{
+    AlphaMask mask(width, height);
+
+    for (int maskY = 0; maskY < height; maskY++)
+    {
+        const int spriteY = y + maskY;
+        if (spriteY < 0 || spriteY >= sprite.height)
+            continue;
+
+        uint64 *row = &mask.words[maskY * mask.wordsPerRow];
+
+        for (int maskX = 0; maskX < width; maskX++)
+        {
+            const int spriteX = x + maskX;
+            if (spriteX < 0 || spriteX >= sprite.width)
+                continue;
+
+            const uint8 *p = &frame.pixels[(spriteX + spriteY * sprite.width) * sprite.mode];
+
+            // index 0 is treated as transparent, just like the Loader does when combining cels.
+            const bool bOpaque = sprite.mode == rgba ? p[3] != 0u : p[0] != 0u;
+            if (bOpaque)
+                row[maskX / 64] |= uint64(1u) << uint64(maskX % 64);
+        }
+    }
+    return mask;
+}
+
+AlphaMask AlphaMask::fromFrame(const Sprite &sprite, const Frame &frame)
+{
+    return fromFrame(sprite, frame, 0, 0, sprite.width, sprite.height);
+}
+
+bool AlphaMask::empty() const
+{
+    return words.empty();
+}
+
+bool AlphaMask::get(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= width || y >= height)
+        return false;
+    return words[y * wordsPerRow + x / 64] & (uint64(1u) << uint64(x % 64));
+}
+
+void AlphaMask::set(int x, int y, bool bSet)
+{
+    if (x < 0 || y < 0 || x >= width || y >= height)
+        return;
+    uint64 &word = words[y * wordsPerRow + x / 64];
+    const uint64 bit = uint64(1u) << uint64(x % 64);
+    word = bSet ? word | bit : word & ~bit;
+}
+
+uint64 AlphaMask::getBits(int y, int startX) const
+{
+    const int wordI = floorDiv64(startX);
+    const int shift = startX - wordI * 64;
+
+    const uint64 *row = &words[y * wordsPerRow];
+
+    uint64 bits = wordI >= 0 && wordI < wordsPerRow ? row[wordI] >> uint64(shift) : 0u;
+    if (shift != 0 && wordI + 1 >= 0 && wordI + 1 < wordsPerRow)
+        bits |= row[wordI + 1] << uint64(64 - shift);
+    return bits;
+}
+
+bool AlphaMask::overlaps(const AlphaMask &other, int otherX, int otherY) const
+{
+    const int
+        xBegin = max(0, otherX),
+        xEnd = min(width, otherX + other.width),
+        yBegin = max(0, otherY),
+        yEnd = min(height, otherY + other.height);
+
+    if (xBegin >= xEnd || yBegin >= yEnd)
+        return false;
+
+    const int
+        wordBegin = xBegin / 64,
+        wordEnd = (xEnd + 63) / 64,
+
+        // word 'i' of this mask lines up with bits [64 * (i + wordDelta) + shift, ...) of 'other':
+        shift = (-otherX) & 63,
+        wordDelta = floorDiv64(-otherX);
+
+    for (int y = yBegin; y < yEnd; y++)
+    {
+        const uint64 *row = &words[y * wordsPerRow];
+        const int rowInOther = y - otherY;
+
+        int wordI = wordBegin;
+
+        // scalar until 'other' can be read without going out of bounds:
+        for (; wordI < wordEnd && wordI + wordDelta < 0; wordI++)
+            if (row[wordI] & other.getBits(rowInOther, 64 * wordI - otherX))
+                return true;
+
+        #ifdef __SSE2__
+        {
+            const uint64 *otherRow = &other.words[rowInOther * other.wordsPerRow];
+            const __m128i
+                shiftRight = _mm_cvtsi32_si128(shift),
+                shiftLeft = _mm_cvtsi32_si128(64 - shift), // shifting by 64 results in 0, which is what we want when shift == 0.
+                zero = _mm_setzero_si128();
+
+            // 2 words per iteration:
+            for (; wordI + 1 < wordEnd && wordI + wordDelta + 2 < other.wordsPerRow; wordI += 2)
+            {
+                const __m128i
+                    lo = _mm_loadu_si128((const __m128i *) &otherRow[wordI + wordDelta]),
+                    hi = _mm_loadu_si128((const __m128i *) &otherRow[wordI + wordDelta + 1]),
+                    otherBits = _mm_or_si128(_mm_srl_epi64(lo, shiftRight), _mm_sll_epi64(hi, shiftLeft)),
+                    bits = _mm_and_si128(_mm_loadu_si128((const __m128i *) &row[wordI]), otherBits);
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero)) != 0xFFFF)
+                    return true;
+            }
+        }
+        #endif
+
+        for (; wordI < wordEnd; wordI++)
+            if (row[wordI] & other.getBits(rowInOther, 64 * wordI - otherX))
+                return true;
+    }
+    return false;
+}
+
+}
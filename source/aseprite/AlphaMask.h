@@ -0,0 +1,58 @@
+#ifndef GAME_ALPHAMASK_H
+#define GAME_ALPHAMASK_H
+
+#include "../math/math_utils.h"
+
+#include <vector>
+
+namespace aseprite
+{
+
+class Sprite;
+
+struct Frame;
+
+/**
+ * 1-bit alpha mask that can be used for pixel-perfect collision detection.
+ *
+ * Every row is packed into 64-bit words: pixel x of row y is bit (x % 64) of word (y * wordsPerRow + x / 64).
+ * Bits that lie outside 'width' are always 0, so rows can be AND-ed without masking the last word.
+ */
+struct AlphaMask
+{
+    int width = 0, height = 0, wordsPerRow = 0;
+    std::vector<uint64> words;
+
+    AlphaMask() = default;
+
+    AlphaMask(int width, int height);
+
+    /**
+     * Creates a mask of a region of the frame's pixels.
+     * A pixel is set when it is not fully transparent. Pixels outside the sprite are not set.
+     */
+    static AlphaMask fromFrame(const Sprite &sprite, const Frame &frame, int x, int y, int width, int height);
+
+    static AlphaMask fromFrame(const Sprite &sprite, const Frame &frame);
+
+    bool empty() const;
+
+    bool get(int x, int y) const;
+
+    void set(int x, int y, bool bSet = true);
+
+    /**
+     * Returns whether any set pixel of this mask overlaps with a set pixel of 'other',
+     * when 'other' is placed at (otherX, otherY) relative to this mask.
+     */
+    bool overlaps(const AlphaMask &other, int otherX, int otherY) const;
+
+  private:
+
+    // Returns the 64 bits of row 'y' starting at bit 'startX'. Bits outside the mask are returned as 0.
+    uint64 getBits(int y, int startX) const;
+};
+
+}
+
+#endif
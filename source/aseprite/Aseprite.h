@@ -2,6 +2,8 @@
 #ifndef GAME_ASEPRITE_H
 #define GAME_ASEPRITE_H
 
+#include "AlphaMask.h"
+
 #include "../math/math_utils.h"
 
 #include <vector>
@@ -32,6 +34,9 @@ struct Slice : UserData
     };
 
     std::optional<NineSlice> nineSlice;
+
+    // Only generated when the Loader was asked to generate alpha masks.
+    AlphaMask alphaMask;
 };
 
 struct Cel : UserData
@@ -48,6 +53,9 @@ struct Frame
     float duration;
     std::vector<Cel> cels;
     std::vector<uint8> pixels;
+
+    // Only generated when the Loader was asked to generate alpha masks.
+    AlphaMask alphaMask;
 };
 
 struct Tag
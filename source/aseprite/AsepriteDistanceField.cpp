@@ -0,0 +1,12 @@
+
+#include "AsepriteDistanceField.h"
+
+mu::DistanceField aseprite::frameToDistanceField(const Sprite &sprite, int frameI)
+{
+    const Frame &frame = sprite.frames.at(frameI);
+
+    if (sprite.mode == rgba)
+        return mu::generateDistanceField(&frame.pixels[0], sprite.width, sprite.height, 4, 3);
+
+    return mu::generateDistanceField(&frame.pixels[0], sprite.width, sprite.height, sprite.mode, 0);
+}
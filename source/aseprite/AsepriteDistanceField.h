@@ -0,0 +1,19 @@
+#ifndef GAME_ASEPRITEDISTANCEFIELD_H
+#define GAME_ASEPRITEDISTANCEFIELD_H
+
+#include "Aseprite.h"
+
+#include "../math/distance_field.h"
+
+namespace aseprite
+{
+
+/**
+ * Generates a signed distance field (in pixels) of the frame's opaque pixels.
+ * In indexed mode index 0 is treated as transparent.
+ */
+mu::DistanceField frameToDistanceField(const Sprite &sprite, int frameI);
+
+}
+
+#endif
@@ -8,13 +8,16 @@
 namespace aseprite
 {
 
-Loader::Loader(const char *filePath, Sprite &output) : sprite(output), filePath(filePath), FileReader(filePath)
+Loader::Loader(const char *filePath, Sprite &output, bool bGenerateAlphaMasks) : sprite(output), filePath(filePath), FileReader(filePath)
 {
     output.name = filePath;
 
     loadHeader();
     loadFrames();
 
+    if (bGenerateAlphaMasks)
+        generateAlphaMasks();
+
     for (auto &tag : output.tags)
         for (int frameI = tag.from; frameI <= tag.to; frameI++)
             tag.duration += output.frames[frameI].duration;
@@ -367,4 +370,15 @@ void Loader::celToFrame(Frame &frame, Cel &cel)
     }
 }
 
+void Loader::generateAlphaMasks()
+{
+    for (auto &frame : sprite.frames)
+        frame.alphaMask = AlphaMask::fromFrame(sprite, frame);
+
+    for (auto &slice : sprite.slices)
+        slice.alphaMask = AlphaMask::fromFrame(
+            sprite, sprite.frames.at(slice.frame), slice.originX, slice.originY, slice.width, slice.height
+        );
+}
+
 }
@@ -31,7 +31,11 @@ class Loader : public FileReader
     using LONG = int32;
 
   public:
-    Loader(const char *filePath, Sprite &output);
+    /**
+     * If bGenerateAlphaMasks is true, an AlphaMask will be generated for every Frame and every Slice.
+     * These can be used for pixel-perfect collision detection.
+     */
+    Loader(const char *filePath, Sprite &output, bool bGenerateAlphaMasks = false);
 
   private:
 
@@ -55,6 +59,8 @@ class Loader : public FileReader
 
     void celToFrame(Frame &frame, Cel &cel);
 
+    void generateAlphaMasks();
+
     std::string loadString();
 
     ColorRGBA loadColorRGBA();
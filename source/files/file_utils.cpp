@@ -15,6 +15,13 @@
 #include <sys/stat.h>
 #endif
 
+#if !defined(_WIN32) && !defined(EMSCRIPTEN)
+#define GU_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 std::string fu::readString(const char *path)
 {
@@ -104,3 +111,47 @@ void fu::createDirectory(const char *path)
     mkdir(path, 0777);
     #endif
 }
+
+fu::MappedFile::MappedFile(const char *path)
+{
+    #ifdef GU_MMAP
+    const int fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        throw gu_err("Could not open: " + std::string(path));
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0)
+    {
+        close(fileDescriptor);
+        throw gu_err("Could not stat: " + std::string(path));
+    }
+    mappedSize = fileStat.st_size;
+    if (mappedSize > 0)
+    {
+        void *mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fileDescriptor);
+            throw gu_err("Could not map: " + std::string(path));
+        }
+        mappedData = (const unsigned char *) mapped;
+    }
+    // the mapping stays valid after closing:
+    close(fileDescriptor);
+    #else
+    fallbackData = readBinary(path);
+    mappedData = fallbackData.data();
+    mappedSize = fallbackData.size();
+    #endif
+}
+
+fu::MappedFile::~MappedFile()
+{
+    #ifdef GU_MMAP
+    if (mappedData)
+    {
+        munmap((void *) mappedData, mappedSize);
+    }
+    #endif
+}
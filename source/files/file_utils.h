@@ -24,6 +24,30 @@ void iterateDirectoryRecursively(
     const std::function<void(const std::string &path, bool bDirectory)> &entryCallback
 );
 
+/**
+ * A file that is mapped (read-only) into memory, so it can be read without copying it first.
+ * On platforms without mmap() (Windows and web-builds) the file is read into memory instead.
+ */
+class MappedFile
+{
+  public:
+    explicit MappedFile(const char *path);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *data() const { return mappedData; }
+
+    size_t size() const { return mappedSize; }
+
+    ~MappedFile();
+
+  private:
+    const unsigned char *mappedData = nullptr;
+    size_t mappedSize = 0;
+    std::vector<unsigned char> fallbackData;
+};
+
 };
 
 #endif
@@ -0,0 +1,127 @@
+
+#include "animation_sampler.h"
+
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+namespace
+{
+
+typedef Armature::Animation::Channel Channel;
+
+template<typename Type>
+Type cubicSpline(const Type &value0, const Type &outTangent0, const Type &inTangent1, const Type &value1, float deltaTime, float x)
+{
+    const float x2 = x * x, x3 = x2 * x;
+    return (2.0f * x3 - 3.0f * x2 + 1.0f) * value0
+        + (x3 - 2.0f * x2 + x) * deltaTime * outTangent0
+        + (-2.0f * x3 + 3.0f * x2) * value1
+        + (x3 - x2) * deltaTime * inTangent1;
+}
+
+inline vec3 interpolate(const vec3 &a, const vec3 &b, float x)
+{
+    return mix(a, b, x);
+}
+
+inline quat interpolate(const quat &a, const quat &b, float x)
+{
+    return slerp(a, b, x);
+}
+
+inline void normalizeIfQuat(vec3 &)
+{}
+
+inline void normalizeIfQuat(quat &q)
+{
+    q = normalize(q);
+}
+
+template<typename Type>
+Type sampleChannel(const Channel &channel, const std::vector<Type> &values, float time, int &cachedKeyframe)
+{
+    const std::vector<float> &times = channel.timeline->times;
+    const int k = AnimationSampler::findKeyframe(times, time, cachedKeyframe);
+    const bool bCubic = channel.interpolation == Channel::CUBICSPLINE;
+
+    // cubic splines have an in-tangent, value and out-tangent per keyframe:
+    const auto value = [&] (int keyframe) -> const Type & { return values[bCubic ? keyframe * 3 + 1 : keyframe]; };
+
+    if (k == times.size() - 1 || time <= times[k])
+        return value(k);
+
+    const float deltaTime = times[k + 1] - times[k];
+    const float x = deltaTime > 0.0f ? (time - times[k]) / deltaTime : 0.0f;
+
+    switch (channel.interpolation)
+    {
+        case Channel::STEP:
+            return value(k);
+        case Channel::LINEAR:
+            return interpolate(value(k), value(k + 1), x);
+        case Channel::CUBICSPLINE:
+        {
+            Type result = cubicSpline(value(k), values[k * 3 + 2], values[(k + 1) * 3], value(k + 1), deltaTime, x);
+            normalizeIfQuat(result);
+            return result;
+        }
+    }
+    return value(k);
+}
+
+}
+
+AnimationSampler::AnimationSampler(const Armature &armature, const Armature::Animation &animation) :
+    animation(animation), restPose(armature), lastKeyframes(animation.channels.size(), 0)
+{
+    for (auto &channel : animation.channels)
+    {
+        auto boneIt = std::find(armature.bones.begin(), armature.bones.end(), channel.target);
+        if (boneIt == armature.bones.end())
+            throw gu_err("Animation " + animation.name + " has a channel for a bone that is not part of armature " + armature.name);
+
+        channelBones.push_back(boneIt - armature.bones.begin());
+
+        const int nrOfKeyframes = channel.timeline->times.size();
+        const int nrOfValues = channel.targetProperty == Channel::ROTATION
+            ? channel.propertyValues->quatValues.size()
+            : channel.propertyValues->vec3Values.size();
+
+        if (nrOfKeyframes == 0 || nrOfValues != nrOfKeyframes * (channel.interpolation == Channel::CUBICSPLINE ? 3 : 1))
+            throw gu_err("Animation " + animation.name + " has a channel with " + std::to_string(nrOfValues) + " values for "
+                + std::to_string(nrOfKeyframes) + " keyframes");
+    }
+}
+
+void AnimationSampler::sample(float time, Pose &pose)
+{
+    pose.translations = restPose.translations;
+    pose.rotations = restPose.rotations;
+    pose.scales = restPose.scales;
+
+    for (int i = 0; i < animation.channels.size(); i++)
+    {
+        const Channel &channel = animation.channels[i];
+        const int bone = channelBones[i];
+
+        switch (channel.targetProperty)
+        {
+            case Channel::TRANSLATION:
+                pose.translations[bone] = sampleChannel(channel, channel.propertyValues->vec3Values, time, lastKeyframes[i]);
+                break;
+            case Channel::ROTATION:
+                pose.rotations[bone] = sampleChannel(channel, channel.propertyValues->quatValues, time, lastKeyframes[i]);
+                break;
+            case Channel::SCALE:
+                pose.scales[bone] = sampleChannel(channel, channel.propertyValues->vec3Values, time, lastKeyframes[i]);
+                break;
+        }
+    }
+}
+
+void AnimationSampler::sampleAll(const std::vector<Job> &jobs)
+{
+    gu::parallel::forEach(jobs.size(), 4, [&] (int i) {
+        jobs[i].sampler->sample(jobs[i].time, *jobs[i].pose);
+    });
+}
@@ -0,0 +1,78 @@
+#ifndef GU_ANIMATION_SAMPLER_H
+#define GU_ANIMATION_SAMPLER_H
+
+#include "armature.h"
+#include "pose.h"
+
+#include <algorithm>
+
+/**
+ * Evaluates an Armature::Animation at a given time, into a Pose.
+ * Supports STEP, LINEAR and CUBICSPLINE interpolation of translation, rotation and scale channels.
+ *
+ * Every channel remembers the keyframe it used last time, so (forward) sequential playback finds the next keyframe in constant time.
+ * Because of this, a sampler should not be shared by different threads or different instances that play the same animation.
+ *
+ * Usage:
+ *  AnimationSampler sampler(*armature, armature->animations["Walk"]);
+ *  Pose pose(*armature);
+ *  sampler.sample(fmod(time, sampler.animation.duration), pose);
+ */
+class AnimationSampler
+{
+  public:
+    const Armature::Animation &animation;
+
+    /**
+     * 'animation' must belong to 'armature', and must outlive the sampler.
+     * Throws if a channel targets a bone that is not part of the armature, or has the wrong number of values.
+     */
+    AnimationSampler(const Armature &armature, const Armature::Animation &animation);
+
+    /**
+     * Writes the local transforms of all bones at 'time' (in seconds, clamped to the keyframes) into 'pose'.
+     * Bones that are not animated get their rest transform.
+     */
+    void sample(float time, Pose &pose);
+
+    struct Job
+    {
+        AnimationSampler *sampler;
+        float time;
+        Pose *pose;
+    };
+
+    /**
+     * Runs all jobs on the worker threads. Every job must have its own sampler and pose.
+     */
+    static void sampleAll(const std::vector<Job> &jobs);
+
+    /**
+     * Returns the keyframe k for which times[k] <= time < times[k + 1] (or 0 or times.size() - 1 when outside the timeline).
+     * Tries 'cachedKeyframe' and the keyframes after it first, and falls back to a binary search. 'cachedKeyframe' is updated.
+     */
+    template<typename Time>
+    static int findKeyframe(const std::vector<Time> &times, float time, int &cachedKeyframe)
+    {
+        const int last = times.size() - 1;
+        int k = cachedKeyframe;
+
+        if (k <= last && times[k] <= time)
+        {
+            for (int steps = 0; steps < 4; steps++, k++)
+            {
+                if (k == last || time < times[k + 1])
+                    return cachedKeyframe = k;
+            }
+        }
+        k = std::upper_bound(times.begin(), times.end(), time) - times.begin() - 1;
+        return cachedKeyframe = clamp(k, 0, last);
+    }
+
+  private:
+    Pose restPose;
+    std::vector<int> channelBones;
+    std::vector<int> lastKeyframes;
+};
+
+#endif
@@ -0,0 +1,388 @@
+
+#include "compressed_animation.h"
+#include "animation_sampler.h"
+
+#include <algorithm>
+#include <set>
+
+namespace
+{
+
+typedef Armature::Animation::Channel Channel;
+
+const float MAX_TICKS = 65535.0f;
+
+// Largest possible value of the 3 smallest components of a normalized quaternion:
+const float SMALLEST_THREE_RANGE = 0.70710678f;
+const float SMALLEST_THREE_STEPS = 32767.0f;
+
+/**
+ * Encodes a normalized quaternion in 48 bits: 2 bits for the index of the largest component,
+ * and 15 bits for each of the other three. The largest component is made positive (q and -q are the same rotation),
+ * so it can be reconstructed from the others.
+ */
+void encodeQuat(const quat &q, uint16 *out)
+{
+    const float components[4] = { q.x, q.y, q.z, q.w };
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+        if (abs(components[i]) > abs(components[largest]))
+            largest = i;
+
+    const float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+    uint64 bits = largest;
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == largest)
+            continue;
+        const float normalized = clamp(components[i] * sign / SMALLEST_THREE_RANGE * 0.5f + 0.5f, 0.0f, 1.0f);
+        bits = bits << 15 | uint64(normalized * SMALLEST_THREE_STEPS + 0.5f);
+    }
+    out[0] = bits & 0xffff;
+    out[1] = (bits >> 16) & 0xffff;
+    out[2] = (bits >> 32) & 0xffff;
+}
+
+quat decodeQuat(const uint16 *in)
+{
+    uint64 bits = uint64(in[0]) | uint64(in[1]) << 16 | uint64(in[2]) << 32;
+    const int largest = bits >> 45;
+
+    float components[4];
+    float sumOfSquares = 0.0f;
+    for (int i = 3; i >= 0; i--)
+    {
+        if (i == largest)
+            continue;
+        components[i] = ((bits & 0x7fff) / SMALLEST_THREE_STEPS * 2.0f - 1.0f) * SMALLEST_THREE_RANGE;
+        sumOfSquares += components[i] * components[i];
+        bits >>= 15;
+    }
+    components[largest] = sqrt(max(0.0f, 1.0f - sumOfSquares));
+    return quat(components[3], components[0], components[1], components[2]);
+}
+
+inline uint16 quantize(float value, float min, float extent)
+{
+    return extent > 0.0f ? uint16(clamp((value - min) / extent, 0.0f, 1.0f) * 65535.0f + 0.5f) : 0;
+}
+
+inline float dequantize(uint16 value, float min, float extent)
+{
+    return min + value / 65535.0f * extent;
+}
+
+inline quat nlerp(const quat &a, const quat &b, float x)
+{
+    return normalize(dot(a, b) < 0.0f ? a * (1.0f - x) - b * x : a * (1.0f - x) + b * x);
+}
+
+// Angle of the rotation between a and b (more precise than acos(dot) for small angles):
+inline float rotationError(const quat &a, const quat &b)
+{
+    const quat bSameHemisphere = dot(a, b) < 0.0f ? -b : b;
+    return 4.0f * atan2(length(a - bSameHemisphere), length(a + bSameHemisphere));
+}
+
+inline float vec3Error(const vec3 &a, const vec3 &b)
+{
+    return length(a - b);
+}
+
+inline vec3 lerpKeyframes(const vec3 &a, const vec3 &b, float x)
+{
+    return mix(a, b, x);
+}
+
+inline quat lerpKeyframes(const quat &a, const quat &b, float x)
+{
+    return nlerp(a, b, x);
+}
+
+inline float keyframeError(const vec3 &a, const vec3 &b)
+{
+    return vec3Error(a, b);
+}
+
+inline float keyframeError(const quat &a, const quat &b)
+{
+    return rotationError(a, b);
+}
+
+/**
+ * Returns the indices of the samples that are kept as keyframes.
+ * A sample is removed if all samples since the previous keyframe can be interpolated (from the decoded values) within 'maxError'.
+ */
+template<typename Type>
+std::vector<int> selectKeyframes(
+    const std::vector<float> &ticks, const std::vector<float> &keyframeTicks,
+    const std::vector<Type> &original, const std::vector<Type> &decoded, bool bStep, float maxError
+)
+{
+    const int nrOfSamples = original.size();
+    std::vector<int> keyframes { 0 };
+
+    if (bStep)
+    {
+        for (int i = 1; i < nrOfSamples; i++)
+            if (!(original[i] == original[keyframes.back()]))
+                keyframes.push_back(i);
+        return keyframes;
+    }
+
+    const auto canInterpolate = [&] (int from, int to) {
+        for (int i = from + 1; i < to; i++)
+        {
+            const float deltaTicks = keyframeTicks[to] - keyframeTicks[from];
+            const float x = deltaTicks > 0.0f ? clamp((ticks[i] - keyframeTicks[from]) / deltaTicks, 0.0f, 1.0f) : 0.0f;
+            if (keyframeError(lerpKeyframes(decoded[from], decoded[to], x), original[i]) > maxError)
+                return false;
+        }
+        return true;
+    };
+    for (int i = 2; i < nrOfSamples; i++)
+        if (!canInterpolate(keyframes.back(), i))
+            keyframes.push_back(i - 1);
+
+    if (nrOfSamples > 1)
+        keyframes.push_back(nrOfSamples - 1);
+    return keyframes;
+}
+
+}
+
+vec3 CompressedAnimation::Track::decodeVec3(int keyframe) const
+{
+    const uint16 *v = &values[keyframe * 3];
+    return vec3(dequantize(v[0], min.x, extent.x), dequantize(v[1], min.y, extent.y), dequantize(v[2], min.z, extent.z));
+}
+
+quat CompressedAnimation::Track::decodeQuat(int keyframe) const
+{
+    return ::decodeQuat(&values[keyframe * 3]);
+}
+
+CompressedAnimation::CompressedAnimation(const Armature &armature, const Armature::Animation &animation, const Options &options) :
+    name(animation.name), duration(animation.duration), restPose(armature)
+{
+    ticksPerSecond = duration > 0.0f ? MAX_TICKS / duration : 0.0f;
+
+    // Times at which the original animation is sampled: all keyframes, and a fixed rate (for splines and error measurement).
+    std::vector<float> times;
+    {
+        std::set<const Armature::Animation::Timeline *> timelines;
+        std::set<const Armature::Animation::PropertyValues *> propertyValues;
+
+        for (auto &channel : animation.channels)
+        {
+            if (timelines.insert(channel.timeline.get()).second)
+            {
+                times.insert(times.end(), channel.timeline->times.begin(), channel.timeline->times.end());
+                report.originalSize += channel.timeline->times.size() * sizeof(float);
+            }
+            if (propertyValues.insert(channel.propertyValues.get()).second)
+                report.originalSize += channel.propertyValues->vec3Values.size() * sizeof(vec3)
+                    + channel.propertyValues->quatValues.size() * sizeof(quat);
+
+            report.originalNrOfKeyframes += channel.timeline->times.size();
+        }
+        const int nrOfFixedSamples = duration * options.sampleRate;
+        for (int i = 0; i <= nrOfFixedSamples; i++)
+            times.push_back(i / options.sampleRate);
+
+        std::sort(times.begin(), times.end());
+        times.erase(std::unique(times.begin(), times.end()), times.end());
+        while (!times.empty() && times.back() > duration)
+            times.pop_back();
+        if (times.empty())
+            times.push_back(0.0f);
+    }
+    const int nrOfSamples = times.size();
+
+    // Keyframe times are rounded down, so a STEP keyframe never starts later than in the original:
+    std::vector<float> ticks(nrOfSamples), keyframeTicks(nrOfSamples);
+    for (int i = 0; i < nrOfSamples; i++)
+    {
+        ticks[i] = times[i] * ticksPerSecond;
+        keyframeTicks[i] = floor(ticks[i]);
+    }
+
+    // One track for every animated property of every bone:
+    struct TrackSamples
+    {
+        std::vector<vec3> vec3s;
+        std::vector<quat> quats;
+    };
+    std::vector<TrackSamples> samples;
+    {
+        AnimationSampler sampler(armature, animation);
+        std::set<std::pair<int, int>> added;
+
+        for (auto &channel : animation.channels)
+        {
+            const int bone = std::find(armature.bones.begin(), armature.bones.end(), channel.target) - armature.bones.begin();
+            if (!added.insert({ bone, channel.targetProperty }).second)
+                continue;
+
+            auto &track = tracks.emplace_back();
+            track.bone = bone;
+            track.property = channel.targetProperty;
+            track.bStep = channel.interpolation == Channel::STEP;
+        }
+        samples.resize(tracks.size());
+
+        Pose pose;
+        for (int i = 0; i < nrOfSamples; i++)
+        {
+            sampler.sample(times[i], pose);
+
+            for (int t = 0; t < tracks.size(); t++)
+            {
+                const Track &track = tracks[t];
+                if (track.property == Channel::ROTATION)
+                    samples[t].quats.push_back(pose.rotations[track.bone]);
+                else
+                    samples[t].vec3s.push_back(track.property == Channel::TRANSLATION ? pose.translations[track.bone] : pose.scales[track.bone]);
+            }
+        }
+    }
+
+    std::vector<Track> keptTracks;
+    for (int t = 0; t < tracks.size(); t++)
+    {
+        Track &track = tracks[t];
+        std::vector<int> keyframes;
+        std::vector<uint16> encoded(nrOfSamples * 3);
+
+        if (track.property == Channel::ROTATION)
+        {
+            const std::vector<quat> &original = samples[t].quats;
+            const quat &rest = restPose.rotations[track.bone];
+
+            bool bRest = true;
+            for (int i = 0; i < nrOfSamples && bRest; i++)
+                bRest = rotationError(original[i], rest) <= options.maxRotationError;
+            if (bRest)
+                continue;
+
+            std::vector<quat> decoded(nrOfSamples);
+            for (int i = 0; i < nrOfSamples; i++)
+            {
+                encodeQuat(normalize(original[i]), &encoded[i * 3]);
+                decoded[i] = ::decodeQuat(&encoded[i * 3]);
+            }
+            keyframes = selectKeyframes(ticks, keyframeTicks, original, decoded, track.bStep, options.maxRotationError);
+        }
+        else
+        {
+            const std::vector<vec3> &original = samples[t].vec3s;
+            const bool bTranslation = track.property == Channel::TRANSLATION;
+            const vec3 &rest = bTranslation ? restPose.translations[track.bone] : restPose.scales[track.bone];
+            const float maxError = bTranslation ? options.maxTranslationError : options.maxScaleError;
+
+            bool bRest = true;
+            for (int i = 0; i < nrOfSamples && bRest; i++)
+                bRest = vec3Error(original[i], rest) <= maxError;
+            if (bRest)
+                continue;
+
+            vec3 maxValue = original[0];
+            track.min = original[0];
+            for (const vec3 &v : original)
+            {
+                track.min = glm::min(track.min, v);
+                maxValue = glm::max(maxValue, v);
+            }
+            track.extent = maxValue - track.min;
+
+            std::vector<vec3> decoded(nrOfSamples);
+            for (int i = 0; i < nrOfSamples; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    encoded[i * 3 + c] = quantize(original[i][c], track.min[c], track.extent[c]);
+                    decoded[i][c] = dequantize(encoded[i * 3 + c], track.min[c], track.extent[c]);
+                }
+            }
+            keyframes = selectKeyframes(ticks, keyframeTicks, original, decoded, track.bStep, maxError);
+        }
+
+        for (const int i : keyframes)
+        {
+            track.times.push_back(keyframeTicks[i]);
+            track.values.insert(track.values.end(), &encoded[i * 3], &encoded[i * 3 + 3]);
+        }
+        report.compressedNrOfKeyframes += keyframes.size();
+        keptTracks.push_back(std::move(track));
+    }
+    tracks = std::move(keptTracks);
+
+    report.compressedSize = sizeInBytes();
+    report.compressionRatio = report.compressedSize > 0 ? float(report.originalSize) / report.compressedSize : 1.0f;
+
+    // measure the errors:
+    AnimationSampler sampler(armature, animation);
+    Pose original, compressed;
+    std::vector<int> lastKeyframes;
+
+    for (const float time : times)
+    {
+        sampler.sample(time, original);
+        sample(time, compressed, lastKeyframes);
+
+        for (int bone = 0; bone < original.nrOfBones(); bone++)
+        {
+            report.maxTranslationError = max(report.maxTranslationError, vec3Error(original.translations[bone], compressed.translations[bone]));
+            report.maxRotationError = max(report.maxRotationError, rotationError(original.rotations[bone], compressed.rotations[bone]));
+            report.maxScaleError = max(report.maxScaleError, vec3Error(original.scales[bone], compressed.scales[bone]));
+        }
+    }
+}
+
+CompressedAnimation::CompressedAnimation(const Armature &armature, const Armature::Animation &animation) :
+    CompressedAnimation(armature, animation, Options())
+{}
+
+void CompressedAnimation::sample(float time, Pose &pose, std::vector<int> &lastKeyframes) const
+{
+    pose.translations = restPose.translations;
+    pose.rotations = restPose.rotations;
+    pose.scales = restPose.scales;
+    lastKeyframes.resize(tracks.size(), 0);
+
+    const float ticks = clamp(time, 0.0f, duration) * ticksPerSecond;
+
+    for (int t = 0; t < tracks.size(); t++)
+    {
+        const Track &track = tracks[t];
+        const int k = AnimationSampler::findKeyframe(track.times, ticks, lastKeyframes[t]);
+
+        float x = 0.0f;
+        if (!track.bStep && k + 1 < track.times.size() && ticks > track.times[k])
+            x = (ticks - track.times[k]) / float(track.times[k + 1] - track.times[k]);
+
+        switch (track.property)
+        {
+            case Channel::ROTATION:
+                pose.rotations[track.bone] = x > 0.0f ? nlerp(track.decodeQuat(k), track.decodeQuat(k + 1), x) : track.decodeQuat(k);
+                break;
+            case Channel::TRANSLATION:
+                pose.translations[track.bone] = x > 0.0f ? mix(track.decodeVec3(k), track.decodeVec3(k + 1), x) : track.decodeVec3(k);
+                break;
+            case Channel::SCALE:
+                pose.scales[track.bone] = x > 0.0f ? mix(track.decodeVec3(k), track.decodeVec3(k + 1), x) : track.decodeVec3(k);
+                break;
+        }
+    }
+}
+
+size_t CompressedAnimation::sizeInBytes() const
+{
+    size_t size = sizeof(CompressedAnimation) + name.size()
+        + restPose.nrOfBones() * (sizeof(vec3) * 2 + sizeof(quat));
+
+    for (auto &track : tracks)
+        size += sizeof(Track) + track.times.size() * sizeof(uint16) + track.values.size() * sizeof(uint16);
+    return size;
+}
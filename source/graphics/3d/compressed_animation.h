@@ -0,0 +1,101 @@
+#ifndef GU_COMPRESSED_ANIMATION_H
+#define GU_COMPRESSED_ANIMATION_H
+
+#include "armature.h"
+#include "pose.h"
+
+/**
+ * A compressed version of an Armature::Animation, that uses a fraction of the memory and can still be sampled quickly.
+ *
+ * Compression:
+ *  - keyframes that can be interpolated from their neighbours (within the given error) are removed,
+ *  - channels that never differ from the rest pose are removed,
+ *  - rotations are stored as 48 bit 'smallest three' quaternions,
+ *  - translations and scales are stored as 16 bit per component (relative to the range of the channel),
+ *  - keyframe times are stored as 16 bit.
+ *
+ * Cubic spline channels are resampled at Options::sampleRate and stored as linear keyframes.
+ *
+ * Usage:
+ *  CompressedAnimation compressed(*armature, armature->animations["Walk"]);
+ *  std::cout << compressed.report.compressionRatio << std::endl;
+ *  ...
+ *  compressed.sample(time, pose, lastKeyframes);
+ */
+class CompressedAnimation
+{
+  public:
+
+    struct Options
+    {
+        // Maximum errors, in units (translation & scale) and radians (rotation):
+        float maxTranslationError = 0.0005f;
+        float maxRotationError = 0.001f;
+        float maxScaleError = 0.0005f;
+
+        // Samples per second used to find keyframes that can be removed, and to resample cubic splines.
+        float sampleRate = 30.0f;
+    };
+
+    struct Report
+    {
+        size_t originalSize = 0, compressedSize = 0;
+        // originalSize / compressedSize:
+        float compressionRatio = 1.0f;
+
+        int originalNrOfKeyframes = 0, compressedNrOfKeyframes = 0;
+
+        // The maximum errors measured at the sampled times (keyframes of the original animation and Options::sampleRate):
+        float maxTranslationError = 0.0f;
+        float maxRotationError = 0.0f;
+        float maxScaleError = 0.0f;
+    };
+
+    std::string name;
+    float duration = 0.0f;
+    Report report;
+
+    CompressedAnimation(const Armature &armature, const Armature::Animation &animation, const Options &options);
+
+    CompressedAnimation(const Armature &armature, const Armature::Animation &animation);
+
+    /**
+     * Writes the local transforms of all bones at 'time' (in seconds, clamped to the animation) into 'pose'.
+     * Bones that are not animated get their rest transform.
+     *
+     * 'lastKeyframes' is used to find keyframes in constant time during sequential playback, use one vector per playing instance.
+     * This function does not change the CompressedAnimation, so it can be used by multiple threads at the same time.
+     */
+    void sample(float time, Pose &pose, std::vector<int> &lastKeyframes) const;
+
+    size_t sizeInBytes() const;
+
+  private:
+
+    struct Track
+    {
+        int bone = 0;
+        Armature::Animation::Channel::TargetProperty property = Armature::Animation::Channel::TRANSLATION;
+        bool bStep = false;
+
+        // Time of each keyframe, in ticks of duration / 65535:
+        std::vector<uint16> times;
+
+        /**
+         * 3 values per keyframe.
+         * Translations & scales: the components, as fraction between 'min' and 'min + extent'.
+         * Rotations: the 48 bit smallest three encoding.
+         */
+        std::vector<uint16> values;
+        vec3 min = vec3(0.0f), extent = vec3(0.0f);
+
+        vec3 decodeVec3(int keyframe) const;
+        quat decodeQuat(int keyframe) const;
+    };
+
+    std::vector<Track> tracks;
+    Pose restPose;
+    float ticksPerSecond = 0.0f;
+};
+
+#endif
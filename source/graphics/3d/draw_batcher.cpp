@@ -0,0 +1,137 @@
+
+#include "draw_batcher.h"
+#include "mesh.h"
+#include "vert_buffer.h"
+#include "vert_attributes_conversion.h"
+
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace
+{
+
+// Layout defined by glMultiDrawElementsIndirect():
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Describes the layout of a command, so the commands can be stored in a StreamingBuffer:
+VertAttributes drawCommandAttributes()
+{
+    VertAttributes attributes;
+    for (auto name : { "COUNT", "INSTANCE_COUNT", "FIRST_INDEX", "BASE_VERTEX", "BASE_INSTANCE" })
+        attributes.add({ name, 1, sizeof(GLuint), GL_UNSIGNED_INT });
+    return attributes;
+}
+
+}
+
+DrawBatcher::DrawBatcher() :
+    commands(drawCommandAttributes(), 256)
+{
+}
+
+void DrawBatcher::add(const SharedMesh &mesh, int partI, GLsizei nrOfInstances)
+{
+    if (!mesh->vertBuffer || !mesh->vertBuffer->isUploaded())
+    {
+        throw gu_err(mesh->name + " is not uploaded. Upload it first with a VertBuffer");
+    }
+    if (partI < 0 || partI >= mesh->parts.size())
+    {
+        throw gu_err(mesh->name + " only has " + std::to_string(mesh->parts.size()) + " part(s). Tried to render part #" + std::to_string(partI));
+    }
+    draws.push_back({ mesh.get(), partI, nrOfInstances });
+}
+
+void DrawBatcher::flush()
+{
+    nrOfDrawCalls = 0;
+    if (draws.empty())
+    {
+        return;
+    }
+    const auto batchKey = [] (const Draw &draw) {
+        const Mesh::Part &part = draw.mesh->parts[draw.partI];
+        return std::make_tuple(draw.mesh->vertBuffer, part.mode, part.indexType);
+    };
+    std::sort(draws.begin(), draws.end(), [&] (const Draw &a, const Draw &b) {
+        return batchKey(a) < batchKey(b);
+    });
+
+    #if !defined(EMSCRIPTEN) && defined(GL_DRAW_INDIRECT_BUFFER)
+    if (isIndirectDrawingSupported())
+    {
+        auto *out = (DrawElementsIndirectCommand *) commands.beginWrite(draws.size());
+        for (const Draw &draw : draws)
+        {
+            const Mesh::Part &part = draw.mesh->parts[draw.partI];
+            *out++ = {
+                GLuint(part.getNumIndicesToRender()),
+                GLuint(draw.nrOfInstances),
+                GLuint(part.inBuffer.indicesOffset / VertAttributesConversion::componentSize(part.indexType)),
+                draw.mesh->inBuffer.baseVertex + part.baseVertex,
+                0
+            };
+        }
+        commands.endWrite();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.getId());
+
+        for (int begin = 0, end = 0; begin < draws.size(); begin = end)
+        {
+            const auto key = batchKey(draws[begin]);
+            while (end < draws.size() && batchKey(draws[end]) == key)
+            {
+                end++;
+            }
+            const Mesh::Part &part = draws[begin].mesh->parts[draws[begin].partI];
+            draws[begin].mesh->vertBuffer->bind();
+            glMultiDrawElementsIndirect(
+                part.mode,
+                part.indexType,
+                (void *)(uintptr_t) (commands.getOffset() + begin * sizeof(DrawElementsIndirectCommand)),
+                end - begin,
+                0
+            );
+            nrOfDrawCalls++;
+        }
+        draws.clear();
+        return;
+    }
+    #endif
+
+    for (const Draw &draw : draws)
+    {
+        if (draw.nrOfInstances == 1)
+        {
+            draw.mesh->render(draw.partI);
+        }
+        else
+        {
+            draw.mesh->renderInstances(draw.nrOfInstances, draw.partI);
+        }
+    }
+    nrOfDrawCalls = draws.size();
+    draws.clear();
+}
+
+int DrawBatcher::getNrOfDrawCalls() const
+{
+    return nrOfDrawCalls;
+}
+
+bool DrawBatcher::isIndirectDrawingSupported()
+{
+    #if !defined(EMSCRIPTEN) && defined(GL_DRAW_INDIRECT_BUFFER)
+    return glMultiDrawElementsIndirect != nullptr;
+    #else
+    return false;
+    #endif
+}
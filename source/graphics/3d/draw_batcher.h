@@ -0,0 +1,57 @@
+#ifndef GU_DRAW_BATCHER_H
+#define GU_DRAW_BATCHER_H
+
+#include "streaming_buffer.h"
+#include "shared_3d.h"
+
+#include <vector>
+
+/**
+ * Collects draws of uploaded mesh parts, and draws all parts that share a VertBuffer (and primitive mode and index type)
+ * with one glMultiDrawElementsIndirect() call, instead of one draw call per part.
+ *
+ * The draw commands are written into a StreamingBuffer, so filling them does not stall.
+ * If indirect drawing is not available (WebGL or OpenGL < 4.3), the draws are done one by one.
+ *
+ * Draws are grouped by VertBuffer, so the order in which they were added is not kept.
+ * All draws use the shader and per instance data that are bound when flush() is called.
+ *
+ * Usage:
+ *  shader.use();
+ *  for (auto &prop : props)
+ *      batcher.add(prop.mesh);
+ *  batcher.flush();
+ */
+class DrawBatcher
+{
+  public:
+
+    DrawBatcher();
+
+    // Adds a draw of part 'partI' of a mesh that is uploaded. The mesh must stay alive until flush().
+    void add(const SharedMesh &, int partI = 0, GLsizei nrOfInstances = 1);
+
+    // Executes and removes all added draws.
+    void flush();
+
+    // The number of draw calls the last flush() needed.
+    int getNrOfDrawCalls() const;
+
+    static bool isIndirectDrawingSupported();
+
+  private:
+
+    struct Draw
+    {
+        Mesh *mesh;
+        int partI;
+        GLsizei nrOfInstances;
+    };
+    std::vector<Draw> draws;
+
+    StreamingBuffer commands;
+
+    int nrOfDrawCalls = 0;
+};
+
+#endif
@@ -0,0 +1,328 @@
+
+#include "ik_batch.h"
+#include "armature.h"
+
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// Minimum number of chains solved by one thread:
+constexpr int MIN_CHAINS_PER_THREAD = 32;
+
+/**
+ * Sets (qx, qy, qz, qw) to the shortest rotation from direction 'a' to direction 'b' (which do not have to be normalized).
+ * Results in no rotation if a or b is zero, or if they point in opposite directions.
+ */
+inline void ikRotationBetween(float ax, float ay, float az, float bx, float by, float bz, float &qx, float &qy, float &qz, float &qw)
+{
+    const float lengths = sqrt((ax * ax + ay * ay + az * az) * (bx * bx + by * by + bz * bz));
+    qx = ay * bz - az * by;
+    qy = az * bx - ax * bz;
+    qz = ax * by - ay * bx;
+    qw = lengths + ax * bx + ay * by + az * bz;
+
+    const float length2 = qx * qx + qy * qy + qz * qz + qw * qw;
+    const bool bValid = length2 > 1e-12f * lengths * lengths && lengths > 0.0f;
+    const float scale = bValid ? 1.0f / sqrt(length2) : 0.0f;
+    qx *= scale;
+    qy *= scale;
+    qz *= scale;
+    qw = bValid ? qw * scale : 1.0f;
+}
+
+inline quat ikRotationBetween(const vec3 &a, const vec3 &b)
+{
+    quat q;
+    ikRotationBetween(a.x, a.y, a.z, b.x, b.y, b.z, q.x, q.y, q.z, q.w);
+    return q;
+}
+
+// The rotation of a model matrix, without its scale.
+inline quat ikWorldRotation(const mat4 &m)
+{
+    return normalize(quat_cast(mat3(normalize(vec3(m[0])), normalize(vec3(m[1])), normalize(vec3(m[2])))));
+}
+
+}
+
+IKBatch::Chain::Chain(const Armature &armature, const std::string &endBoneName, int nrOfBones)
+{
+    auto boneIt = std::find_if(armature.bones.begin(), armature.bones.end(), [&] (auto &bone) { return bone->name == endBoneName; });
+    if (boneIt == armature.bones.end())
+        throw gu_err("Armature " + armature.name + " has no bone named " + endBoneName);
+
+    bones.resize(nrOfBones);
+    SharedBone bone = *boneIt;
+    for (int i = nrOfBones - 1; i >= 0; i--)
+    {
+        if (!bone)
+            throw gu_err("Bone " + endBoneName + " of armature " + armature.name + " has less than " + std::to_string(nrOfBones - 1) + " ancestors");
+
+        auto it = std::find(armature.bones.begin(), armature.bones.end(), bone);
+        if (it == armature.bones.end())
+            throw gu_err("Bone " + bone->name + " is not part of armature " + armature.name);
+
+        bones[i] = it - armature.bones.begin();
+        bone = bone->parent;
+    }
+}
+
+int IKBatch::addCharacter(const Skeleton &skeleton, Pose &pose, const mat4 &rootTransform)
+{
+    if (pose.nrOfBones() != skeleton.nrOfBones())
+        throw gu_err("Pose has " + std::to_string(pose.nrOfBones()) + " bones, skeleton has " + std::to_string(skeleton.nrOfBones()));
+
+    characters.push_back({ &skeleton, &pose, rootTransform, std::vector<mat4>(skeleton.nrOfBones()) });
+    return characters.size() - 1;
+}
+
+void IKBatch::setRootTransform(int character, const mat4 &rootTransform)
+{
+    characters.at(character).rootTransform = rootTransform;
+}
+
+int IKBatch::addChain(int character, const Chain &chain, const vec3 &target)
+{
+    const Skeleton &skeleton = *characters.at(character).skeleton;
+    const int nrOfJoints = chain.bones.size();
+
+    if (nrOfJoints < 2)
+        throw gu_err("An IK chain needs at least 2 bones");
+
+    for (int i = 0; i < nrOfJoints; i++)
+    {
+        if (chain.bones[i] < 0 || chain.bones[i] >= skeleton.nrOfBones())
+            throw gu_err("IK chain has bone " + std::to_string(chain.bones[i]) + ", skeleton has " + std::to_string(skeleton.nrOfBones()) + " bones");
+        if (i > 0 && skeleton.parents[chain.bones[i]] != chain.bones[i - 1])
+            throw gu_err("Bones of an IK chain must be children of the previous bone in the chain");
+    }
+
+    auto groupIt = std::find_if(groups.begin(), groups.end(), [&] (auto &group) { return group.nrOfJoints == nrOfJoints; });
+    if (groupIt == groups.end())
+    {
+        groupIt = groups.insert(groups.end(), Group());
+        groupIt->nrOfJoints = nrOfJoints;
+    }
+    const int chainI = chains.size();
+    chains.push_back({ character, chain.bones, target, 0.0f, int(groupIt - groups.begin()), int(groupIt->chains.size()) });
+    groupIt->chains.push_back(chainI);
+    groupIt->resize();
+    return chainI;
+}
+
+void IKBatch::setTarget(int chain, const vec3 &target)
+{
+    chains.at(chain).target = target;
+}
+
+float IKBatch::getError(int chain) const
+{
+    return chains.at(chain).error;
+}
+
+void IKBatch::clear()
+{
+    characters.clear();
+    chains.clear();
+    groups.clear();
+}
+
+void IKBatch::Group::resize()
+{
+    const size_t nrOfValues = size_t(nrOfJoints) * chains.size();
+    for (auto *array : { &x, &y, &z, &startX, &startY, &startZ, &lengths })
+        array->resize(nrOfValues);
+
+    for (auto *array : { &targetX, &targetY, &targetZ, &rotationX, &rotationY, &rotationZ, &rotationW })
+        array->resize(chains.size());
+}
+
+void IKBatch::solve()
+{
+    gu::parallel::forEach(characters.size(), 4, [&] (int i) {
+        Character &character = characters[i];
+        character.skeleton->calculateMatrices(*character.pose, character.modelMatrices.data(), nullptr, character.rootTransform);
+    });
+
+    gu::parallel::forEach(chains.size(), MIN_CHAINS_PER_THREAD, [&] (int i) {
+        gatherJoints(i);
+    });
+
+    for (Group &group : groups)
+    {
+        gu::parallel::forRanges(group.chains.size(), MIN_CHAINS_PER_THREAD, [&] (int begin, int end) {
+            if (method == FABRIK)
+                solveFABRIK(group, begin, end);
+            else
+                solveCCD(group, begin, end);
+        });
+    }
+
+    gu::parallel::forEach(chains.size(), MIN_CHAINS_PER_THREAD, [&] (int i) {
+        scatterRotations(i);
+    });
+}
+
+void IKBatch::gatherJoints(int chainI)
+{
+    const ChainData &chain = chains[chainI];
+    Group &group = groups[chain.group];
+    const std::vector<mat4> &modelMatrices = characters[chain.character].modelMatrices;
+
+    const int n = group.chains.size(), c = chain.indexInGroup;
+
+    for (int j = 0; j < group.nrOfJoints; j++)
+    {
+        const vec3 position(modelMatrices[chain.bones[j]][3]);
+        group.x[j * n + c] = group.startX[j * n + c] = position.x;
+        group.y[j * n + c] = group.startY[j * n + c] = position.y;
+        group.z[j * n + c] = group.startZ[j * n + c] = position.z;
+
+        if (j > 0)
+        {
+            const vec3 parentPosition(modelMatrices[chain.bones[j - 1]][3]);
+            group.lengths[(j - 1) * n + c] = length(position - parentPosition);
+        }
+    }
+    group.targetX[c] = chain.target.x;
+    group.targetY[c] = chain.target.y;
+    group.targetZ[c] = chain.target.z;
+}
+
+void IKBatch::scatterRotations(int chainI)
+{
+    ChainData &chain = chains[chainI];
+    const Group &group = groups[chain.group];
+    const Character &character = characters[chain.character];
+
+    const int n = group.chains.size(), c = chain.indexInGroup;
+    const auto startPosition = [&] (int j) { return vec3(group.startX[j * n + c], group.startY[j * n + c], group.startZ[j * n + c]); };
+    const auto solvedPosition = [&] (int j) { return vec3(group.x[j * n + c], group.y[j * n + c], group.z[j * n + c]); };
+
+    chain.error = length(solvedPosition(group.nrOfJoints - 1) - chain.target);
+
+    /**
+     * 'carry' is the rotation that the bones above bone j added to bone j (in world space).
+     * The new world rotation of bone j is: delta * carry * world, which is turned into a local rotation again.
+     */
+    quat carry = mu::NO_ROTATION;
+    for (int j = 0; j < group.nrOfJoints - 1; j++)
+    {
+        const int bone = chain.bones[j];
+        const quat carried = carry * ikWorldRotation(character.modelMatrices[bone]);
+
+        const vec3 carriedDirection = carry * (startPosition(j + 1) - startPosition(j));
+        const quat delta = ikRotationBetween(carriedDirection, solvedPosition(j + 1) - solvedPosition(j));
+
+        quat &local = character.pose->rotations[bone];
+        local = normalize(local * inverse(carried) * delta * carried);
+        carry = delta * carry;
+    }
+}
+
+void IKBatch::solveFABRIK(Group &group, int begin, int end) const
+{
+    const int n = group.chains.size(), last = group.nrOfJoints - 1;
+    float *x = group.x.data(), *y = group.y.data(), *z = group.z.data();
+    const float *lengths = group.lengths.data();
+    const float *targetX = group.targetX.data(), *targetY = group.targetY.data(), *targetZ = group.targetZ.data();
+
+    // moves joint 'to' towards joint 'from', until it is at 'boneLengths' distance of 'from':
+    const auto reach = [&] (int to, int from, const float *boneLengths) {
+        for (int c = begin; c < end; c++)
+        {
+            const float
+                dx = x[to * n + c] - x[from * n + c],
+                dy = y[to * n + c] - y[from * n + c],
+                dz = z[to * n + c] - z[from * n + c];
+            const float distance2 = dx * dx + dy * dy + dz * dz;
+            const float scale = distance2 > 0.0f ? boneLengths[c] / sqrt(distance2) : 0.0f;
+            x[to * n + c] = x[from * n + c] + dx * scale;
+            y[to * n + c] = y[from * n + c] + dy * scale;
+            z[to * n + c] = z[from * n + c] + dz * scale;
+        }
+    };
+
+    for (int iteration = 0; iteration < maxIterations; iteration++)
+    {
+        float maxError2 = 0.0f;
+        for (int c = begin; c < end; c++)
+        {
+            const float dx = x[last * n + c] - targetX[c], dy = y[last * n + c] - targetY[c], dz = z[last * n + c] - targetZ[c];
+            maxError2 = std::max(maxError2, dx * dx + dy * dy + dz * dz);
+        }
+        if (maxError2 <= tolerance * tolerance)
+            break;
+
+        // backward: put the end effectors on the targets, and pull the other joints after them:
+        std::copy(targetX + begin, targetX + end, x + last * n + begin);
+        std::copy(targetY + begin, targetY + end, y + last * n + begin);
+        std::copy(targetZ + begin, targetZ + end, z + last * n + begin);
+        for (int j = last - 1; j >= 0; j--)
+            reach(j, j + 1, lengths + j * n);
+
+        // forward: put the roots back, and pull the other joints after them:
+        std::copy(group.startX.begin() + begin, group.startX.begin() + end, x + begin);
+        std::copy(group.startY.begin() + begin, group.startY.begin() + end, y + begin);
+        std::copy(group.startZ.begin() + begin, group.startZ.begin() + end, z + begin);
+        for (int j = 1; j <= last; j++)
+            reach(j, j - 1, lengths + (j - 1) * n);
+    }
+}
+
+void IKBatch::solveCCD(Group &group, int begin, int end) const
+{
+    const int n = group.chains.size(), last = group.nrOfJoints - 1;
+    float *x = group.x.data(), *y = group.y.data(), *z = group.z.data();
+    float *qx = group.rotationX.data(), *qy = group.rotationY.data(), *qz = group.rotationZ.data(), *qw = group.rotationW.data();
+    const float *targetX = group.targetX.data(), *targetY = group.targetY.data(), *targetZ = group.targetZ.data();
+
+    for (int iteration = 0; iteration < maxIterations; iteration++)
+    {
+        float maxError2 = 0.0f;
+        for (int c = begin; c < end; c++)
+        {
+            const float dx = x[last * n + c] - targetX[c], dy = y[last * n + c] - targetY[c], dz = z[last * n + c] - targetZ[c];
+            maxError2 = std::max(maxError2, dx * dx + dy * dy + dz * dz);
+        }
+        if (maxError2 <= tolerance * tolerance)
+            break;
+
+        for (int j = last - 1; j >= 0; j--)
+        {
+            // the rotation around joint j that points the end effector at the target:
+            for (int c = begin; c < end; c++)
+            {
+                const float jx = x[j * n + c], jy = y[j * n + c], jz = z[j * n + c];
+                ikRotationBetween(
+                    x[last * n + c] - jx, y[last * n + c] - jy, z[last * n + c] - jz,
+                    targetX[c] - jx, targetY[c] - jy, targetZ[c] - jz,
+                    qx[c], qy[c], qz[c], qw[c]
+                );
+            }
+            // rotate the joints after joint j: v' = v + w * t + cross(q, t), with t = 2 * cross(q, v)
+            for (int k = j + 1; k <= last; k++)
+            {
+                for (int c = begin; c < end; c++)
+                {
+                    const float
+                        vx = x[k * n + c] - x[j * n + c],
+                        vy = y[k * n + c] - y[j * n + c],
+                        vz = z[k * n + c] - z[j * n + c];
+                    const float
+                        tx = 2.0f * (qy[c] * vz - qz[c] * vy),
+                        ty = 2.0f * (qz[c] * vx - qx[c] * vz),
+                        tz = 2.0f * (qx[c] * vy - qy[c] * vx);
+
+                    x[k * n + c] = x[j * n + c] + vx + qw[c] * tx + (qy[c] * tz - qz[c] * ty);
+                    y[k * n + c] = y[j * n + c] + vy + qw[c] * ty + (qz[c] * tx - qx[c] * tz);
+                    z[k * n + c] = z[j * n + c] + vz + qw[c] * tz + (qx[c] * ty - qy[c] * tx);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef GU_IK_BATCH_H
+#define GU_IK_BATCH_H
+
+#include "skeleton.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Inverse kinematics for many bone chains (e.g. the feet and hands of a crowd) at once, using CCD or FABRIK.
+ *
+ * The joint positions of all chains with the same number of bones are stored as a structure of arrays (joint-major),
+ * so every step of the solvers is a loop over many chains that the compiler can vectorize. Groups of chains are divided over the worker threads.
+ * All memory is allocated when characters and chains are added, solve() does not allocate.
+ *
+ * solve() only changes the (local) rotations of the bones in the chains, except the rotation of the last bone (the end effector).
+ * Chains of the same character should not share bones.
+ *
+ * Usage:
+ *  IKBatch batch;
+ *  int character = batch.addCharacter(skeleton, pose, worldTransform);
+ *  int leftFoot = batch.addChain(character, IKBatch::Chain(*armature, "Foot.L", 3));
+ *  ...
+ *  // every frame, after sampling animations into the poses:
+ *  batch.setTarget(leftFoot, groundPointBelowLeftFoot);
+ *  batch.solve();
+ */
+class IKBatch
+{
+  public:
+
+    enum Method
+    {
+        // Cyclic Coordinate Descent: rotates one bone at a time towards the target, from the end of the chain to the root.
+        CCD,
+        // Forward And Backward Reaching Inverse Kinematics: moves the joints along lines, keeping the bone lengths.
+        FABRIK
+    };
+
+    struct Chain
+    {
+        // Bone indices (like Armature::bones), from the root of the chain to the end effector. Every bone is the parent of the next.
+        std::vector<int> bones;
+
+        Chain() = default;
+
+        // The bone named 'endBoneName' and its 'nrOfBones' - 1 closest ancestors. Throws if the bone does not have enough ancestors.
+        Chain(const Armature &, const std::string &endBoneName, int nrOfBones);
+    };
+
+    Method method = FABRIK;
+    int maxIterations = 10;
+
+    // A chain is solved when the distance between its end effector and target is smaller than this.
+    float tolerance = 0.001f;
+
+    /**
+     * Adds a character, of which the chains will write their results into 'pose'.
+     * 'skeleton' and 'pose' must outlive the batch (or until clear() is called).
+     * Targets are in the same space as 'rootTransform' (usually world space).
+     */
+    int addCharacter(const Skeleton &skeleton, Pose &pose, const mat4 &rootTransform = mat4(1.0f));
+
+    void setRootTransform(int character, const mat4 &rootTransform);
+
+    // Throws if the chain has less than 2 bones, or the bones are not each other's children.
+    int addChain(int character, const Chain &chain, const vec3 &target = vec3(0.0f));
+
+    void setTarget(int chain, const vec3 &target);
+
+    /**
+     * Moves the end effectors of all chains towards their targets, starting from the current poses of the characters.
+     */
+    void solve();
+
+    // The distance between the end effector and the target of a chain, after the last solve().
+    float getError(int chain) const;
+
+    void clear();
+
+  private:
+
+    struct Character
+    {
+        const Skeleton *skeleton;
+        Pose *pose;
+        mat4 rootTransform;
+        std::vector<mat4> modelMatrices;
+    };
+
+    struct ChainData
+    {
+        int character;
+        std::vector<int> bones;
+        vec3 target;
+        float error = 0.0f;
+        int group, indexInGroup;
+    };
+
+    // Chains with the same number of joints. Arrays are indexed by [joint * nrOfChains + chain].
+    struct Group
+    {
+        int nrOfJoints = 0;
+        std::vector<int> chains;
+
+        std::vector<float> x, y, z;
+        // Joint positions before solving:
+        std::vector<float> startX, startY, startZ;
+        // Length of each bone, indexed by [bone * nrOfChains + chain]:
+        std::vector<float> lengths;
+        std::vector<float> targetX, targetY, targetZ;
+        // Per chain scratch memory for CCD rotations:
+        std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+
+        void resize();
+    };
+
+    std::vector<Character> characters;
+    std::vector<ChainData> chains;
+    std::vector<Group> groups;
+
+    void gatherJoints(int chainI);
+
+    void scatterRotations(int chainI);
+
+    void solveFABRIK(Group &, int begin, int end) const;
+
+    void solveCCD(Group &, int begin, int end) const;
+};
+
+#endif
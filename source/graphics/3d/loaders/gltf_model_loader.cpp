@@ -5,11 +5,18 @@
 #include "../model.h"
 #include "../armature.h"
 #include "../tangent_calculator.h"
+#include "../mesh_optimizer.h"
+#include "../mesh_lod.h"
+#include "../meshlets.h"
+#include "../vert_attributes_conversion.h"
 
 #include "../../textures/texture.h"
 #include "../../external/stb_image.h"
 
 #include "../../../utils/gu_error.h"
+#include "../../../utils/parallel.h"
+#include "../../../files/file_utils.h"
+#include "../../../json.hpp"
 
 #define TINYGLTF_IMPLEMENTATION
 #define TINYGLTF_NO_INCLUDE_STB_IMAGE
@@ -20,6 +27,31 @@ GltfModelLoader::GltfModelLoader(const VertAttributes &attrs) :
     vertAttributes(attrs)
 {}
 
+/**
+ * The binary data of the glTF buffers (and images) that the loader reads from.
+ * Usually these point into tinygltf's buffers, but for GLB data loaded with fromMemory() or fromBinaryFile()
+ * the BIN chunk is read in place, without tinygltf copying it first.
+ */
+struct BinaryData
+{
+    struct Span
+    {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+    };
+    std::vector<Span> buffers;
+
+    // Encoded images that are read in place (data is nullptr for images that were loaded by tinygltf).
+    std::vector<Span> images;
+
+    explicit BinaryData(const tinygltf::Model &tiny) :
+        images(tiny.images.size())
+    {
+        for (auto &buffer : tiny.buffers)
+            buffers.push_back({ buffer.data.data(), buffer.data.size() });
+    }
+};
+
 int componentTypeSize(int componentType)
 {
     switch (componentType)
@@ -53,21 +85,207 @@ int nrOfVertices(const tinygltf::Model &tiny, const tinygltf::Mesh &tinyMesh)
     return nrOfVerts;
 }
 
-void loadMeshes(GltfModelLoader &loader, const tinygltf::Model &tiny)
+const VertAttr *findAttribute(const VertAttributes &attributes, const VertAttr &attr)
+{
+    for (int i = 0; i < attributes.nrOfAttributes(); i++)
+    {
+        const VertAttr &a = attributes.get(i);
+        if (a.name == attr.name && a.size == attr.size)
+            return &a;
+    }
+    return nullptr;
+}
+
+template<typename Index>
+void readIndices(const unsigned char *src, int count, GLuint offset, std::vector<GLuint> &out)
+{
+    out.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        Index index;
+        memcpy(&index, src + i * sizeof(Index), sizeof(Index));
+        out[i] = index + offset;
+    }
+}
+
+/**
+ * Reads an accessor of 3 components (floats or normalized integers) as vec3s, including the values of a sparse accessor.
+ */
+std::vector<vec3> readVec3Accessor(const tinygltf::Model &tiny, const BinaryData &binary, const tinygltf::Accessor &accessor)
+{
+    if (accessor.type != TINYGLTF_TYPE_VEC3 || !VertAttributesConversion::canConvert(accessor.componentType, accessor.normalized, GL_FLOAT))
+        throw gu_err("Error while loading glTF: expected an accessor of 3 floats or normalized integers");
+
+    // returns the start of 'count' elements in a bufferView, and sets 'stride':
+    const auto bufferViewData = [&] (int bufferViewI, size_t byteOffset, int elementSize, int count, int &stride) {
+        auto &bufferView = tiny.bufferViews.at(bufferViewI);
+        auto &buffer = binary.buffers.at(bufferView.buffer);
+
+        if (buffer.size < bufferView.byteOffset + bufferView.byteLength)
+            throw gu_err("Error while loading glTF: buffer is too small");
+
+        stride = bufferView.byteStride == 0 ? elementSize : bufferView.byteStride;
+        if (count > 0 && byteOffset + size_t(count - 1) * stride + elementSize > bufferView.byteLength)
+            throw gu_err("Error while loading glTF: accessor does not fit in its bufferView");
+
+        return &buffer.data[bufferView.byteOffset + byteOffset];
+    };
+
+    const int elementSize = componentTypeSize(accessor.componentType) * 3;
+    std::vector<vec3> values(accessor.count, vec3(0.0f));
+    int stride = 0;
+
+    if (accessor.bufferView >= 0 && accessor.count > 0)
+    {
+        const unsigned char *src = bufferViewData(accessor.bufferView, accessor.byteOffset, elementSize, accessor.count, stride);
+        VertAttributesConversion::copy(
+            src, accessor.componentType, accessor.normalized, stride,
+            (unsigned char *) values.data(), GL_FLOAT, sizeof(vec3),
+            3, accessor.count
+        );
+    }
+    if (accessor.sparse.isSparse && accessor.sparse.count > 0)
+    {
+        const int count = accessor.sparse.count;
+        const auto &sparseIndices = accessor.sparse.indices;
+        const auto &sparseValues = accessor.sparse.values;
+
+        const int indexType = sparseIndices.componentType;
+        if (indexType != GL_UNSIGNED_BYTE && indexType != GL_UNSIGNED_SHORT && indexType != GL_UNSIGNED_INT)
+            throw gu_err("Error while loading glTF: only unsigned bytes, shorts and ints are supported as sparse indices type.");
+
+        const int indexSize = componentTypeSize(indexType);
+        const unsigned char *indices = bufferViewData(sparseIndices.bufferView, sparseIndices.byteOffset, indexSize, count, stride);
+
+        std::vector<vec3> replacements(count);
+        VertAttributesConversion::copy(
+            bufferViewData(sparseValues.bufferView, sparseValues.byteOffset, elementSize, count, stride),
+            accessor.componentType, accessor.normalized, elementSize,
+            (unsigned char *) replacements.data(), GL_FLOAT, sizeof(vec3),
+            3, count
+        );
+        for (int i = 0; i < count; i++)
+        {
+            GLuint index = 0;
+            switch (indexType)
+            {
+                case GL_UNSIGNED_BYTE:
+                    index = indices[i];
+                    break;
+                case GL_UNSIGNED_SHORT:
+                {
+                    GLushort shortIndex;
+                    memcpy(&shortIndex, indices + i * sizeof(GLushort), sizeof(GLushort));
+                    index = shortIndex;
+                    break;
+                }
+                default:
+                    memcpy(&index, indices + i * sizeof(GLuint), sizeof(GLuint));
+            }
+            if (index >= values.size())
+                throw gu_err("Error while loading glTF: sparse accessor index out of bounds");
+            values[index] = replacements[i];
+        }
+    }
+    return values;
+}
+
+/**
+ * Adds the morph targets of a primitive (of which the vertices start at 'firstVertex') to the mesh.
+ * Only the range of vertices that a target moves is kept, and if less than half of those vertices move, the deltas are stored sparse.
+ */
+void loadMorphTargets(const tinygltf::Model &tiny, const BinaryData &binary, const tinygltf::Primitive &primitive,
+                      int firstVertex, int nrOfVertices, Mesh &mesh)
+{
+    if (mesh.morphTargets.size() < primitive.targets.size())
+        mesh.morphTargets.resize(primitive.targets.size());
+
+    for (int targetI = 0; targetI < primitive.targets.size(); targetI++)
+    {
+        for (auto &[attrName, accessorI] : primitive.targets[targetI])
+        {
+            // glTF TANGENT deltas are added to the xyz of our TANGENT_AND_SIGN:
+            const VertAttr *dstAttr = nullptr;
+            for (int i = 0; i < mesh.attributes.nrOfAttributes(); i++)
+            {
+                const VertAttr &attr = mesh.attributes.get(i);
+                if ((attr.name == attrName || (attrName == "TANGENT" && attr.name == "TANGENT_AND_SIGN")) && attr.type == GL_FLOAT && attr.size >= 3)
+                    dstAttr = &attr;
+            }
+            if (!dstAttr || (attrName != "POSITION" && attrName != "NORMAL" && attrName != "TANGENT"))
+                continue;
+
+            auto &accessor = tiny.accessors.at(accessorI);
+            if (accessor.count != nrOfVertices)
+                throw gu_err("Error while loading glTF: morph target " + std::to_string(targetI) + " of " + mesh.name + " has "
+                    + std::to_string(accessor.count) + " " + attrName + " deltas for " + std::to_string(nrOfVertices) + " vertices");
+
+            const std::vector<vec3> deltas = readVec3Accessor(tiny, binary, accessor);
+
+            int first = -1, last = -1, nrOfMoved = 0;
+            for (int i = 0; i < deltas.size(); i++)
+            {
+                if (deltas[i] == mu::ZERO_3)
+                    continue;
+                if (first == -1)
+                    first = i;
+                last = i;
+                nrOfMoved++;
+            }
+            if (nrOfMoved == 0)
+                continue;
+
+            auto &stream = mesh.morphTargets[targetI].streams.emplace_back();
+            stream.attributeName = dstAttr->name;
+
+            if (nrOfMoved * 2 < last - first + 1)
+            {
+                stream.vertices.reserve(nrOfMoved);
+                stream.deltas.reserve(nrOfMoved);
+                for (int i = first; i <= last; i++)
+                {
+                    if (deltas[i] == mu::ZERO_3)
+                        continue;
+                    stream.vertices.push_back(firstVertex + i);
+                    stream.deltas.push_back(deltas[i]);
+                }
+            }
+            else
+            {
+                stream.firstVertex = firstVertex + first;
+                stream.deltas.assign(deltas.begin() + first, deltas.begin() + last + 1);
+            }
+        }
+    }
+}
+
+/**
+ * Loads the meshes. For every mesh, 'primitivesOfParts' will contain the index of the glTF primitive that each mesh part was loaded from.
+ */
+void loadMeshes(GltfModelLoader &loader, const tinygltf::Model &tiny, const BinaryData &binary, std::vector<std::vector<int>> &primitivesOfParts)
 {
+    // Vertices are loaded and processed as floats, and quantized at the end (if loader.vertAttributes has quantized attributes):
+    const VertAttributes attributes = VertAttributesConversion::unquantized(loader.vertAttributes);
+    bool bQuantize = false;
+    for (int i = 0; i < loader.vertAttributes.nrOfAttributes(); i++)
+        bQuantize |= VertAttributesConversion::isQuantized(loader.vertAttributes.get(i));
+
     for (auto &tinyMesh : tiny.meshes)
     {
         int nrOfVerts = nrOfVertices(tiny, tinyMesh);
-        loader.meshes.push_back(std::make_shared<Mesh>(tinyMesh.name, nrOfVerts, loader.vertAttributes));
+        loader.meshes.push_back(std::make_shared<Mesh>(tinyMesh.name, nrOfVerts, attributes));
         auto &mesh = loader.meshes.back();
 
         int nrOfVertsLoaded = 0;
+        std::vector<int> primitivesOfLoadedParts;
 
-        for (auto &primitive : tinyMesh.primitives)
+        for (int primitiveI = 0; primitiveI < tinyMesh.primitives.size(); primitiveI++)
         {
+            auto &primitive = tinyMesh.primitives[primitiveI];
             if (primitive.indices < 0)
                 continue;
 
+            primitivesOfLoadedParts.push_back(primitiveI);
             auto &part = mesh->parts.emplace_back();
             part.mode = primitive.mode;
 
@@ -75,25 +293,35 @@ void loadMeshes(GltfModelLoader &loader, const tinygltf::Model &tiny)
             {
                 auto &accessor = tiny.accessors.at(primitive.indices);
 
-                if (accessor.componentType != GL_UNSIGNED_SHORT)
-                    throw gu_err("Error while loading glTF: only unsigned shorts are supported as indices type.");
+                if (accessor.componentType != GL_UNSIGNED_BYTE && accessor.componentType != GL_UNSIGNED_SHORT && accessor.componentType != GL_UNSIGNED_INT)
+                    throw gu_err("Error while loading glTF: only unsigned bytes, shorts and ints are supported as indices type.");
 
                 if (accessor.count > 0)
                 {
-                    part.indices.resize(accessor.count);
-
                     auto &bufferView = tiny.bufferViews.at(accessor.bufferView);
-                    auto &buffer = tiny.buffers.at(bufferView.buffer);
+                    auto &buffer = binary.buffers.at(bufferView.buffer);
 
-                    if (buffer.data.size() < bufferView.byteOffset + bufferView.byteLength)
+                    if (buffer.size < bufferView.byteOffset + bufferView.byteLength)
                         throw gu_err("Error while loading glTF: buffer is too small");
 
-                    if (bufferView.byteLength != part.indices.size() * sizeof(unsigned short))
-                        throw gu_err("Error while loading glTF: indices bufferView byteLength is incorrect");
+                    const int indexSize = componentTypeSize(accessor.componentType);
+                    const size_t srcBegin = bufferView.byteOffset + accessor.byteOffset;
+
+                    if (srcBegin + accessor.count * indexSize > bufferView.byteOffset + bufferView.byteLength)
+                        throw gu_err("Error while loading glTF: indices accessor does not fit in its bufferView");
 
-                    memcpy(&part.indices[0], &buffer.data.at(bufferView.byteOffset), bufferView.byteLength);
-                    for (auto &index : part.indices)
-                        index += nrOfVertsLoaded;
+                    switch (accessor.componentType)
+                    {
+                        case GL_UNSIGNED_BYTE:
+                            readIndices<GLubyte>(&buffer.data[srcBegin], accessor.count, nrOfVertsLoaded, part.indices);
+                            break;
+                        case GL_UNSIGNED_SHORT:
+                            readIndices<GLushort>(&buffer.data[srcBegin], accessor.count, nrOfVertsLoaded, part.indices);
+                            break;
+                        case GL_UNSIGNED_INT:
+                            readIndices<GLuint>(&buffer.data[srcBegin], accessor.count, nrOfVertsLoaded, part.indices);
+                            break;
+                    }
                 }
             }
 
@@ -121,46 +349,32 @@ void loadMeshes(GltfModelLoader &loader, const tinygltf::Model &tiny)
                 attr.byteSize = componentTypeSize(attr.type) * attr.size;
                 attr.normalized = accessor.normalized;
 
-                if (!loader.vertAttributes.contains(attr))
+                // find the attribute with the same name & size, the components might still need to be converted:
+                const VertAttr *dstAttr = findAttribute(attributes, attr);
+                if (primitiveVerts == 0 || !dstAttr || !VertAttributesConversion::canConvert(attr.type, attr.normalized, dstAttr->type))
                     continue;
 
                 auto &bufferView = tiny.bufferViews.at(accessor.bufferView);
-                auto &buffer = tiny.buffers.at(bufferView.buffer);
+                auto &buffer = binary.buffers.at(bufferView.buffer);
 
-                if (buffer.data.size() < bufferView.byteOffset + bufferView.byteLength)
+                if (buffer.size < bufferView.byteOffset + bufferView.byteLength)
                     throw gu_err("Error while loading glTF: buffer is too small");
 
-                if (bufferView.byteLength != primitiveVerts * attr.byteSize)
-                    throw gu_err("Error while loading glTF: vertices bufferView byteLength is incorrect");
+                const int srcStride = bufferView.byteStride == 0 ? attr.byteSize : bufferView.byteStride;
+                const size_t srcBegin = bufferView.byteOffset + accessor.byteOffset;
 
-                auto attrOffset = loader.vertAttributes.getOffset(attr);
+                if (primitiveVerts > 0 && srcBegin + size_t(primitiveVerts - 1) * srcStride + attr.byteSize > bufferView.byteOffset + bufferView.byteLength)
+                    throw gu_err("Error while loading glTF: vertices accessor does not fit in its bufferView");
 
-                int tinyVertI = 0;
-                for (int vertI = nrOfVertsLoaded; vertI < nrOfVertsLoaded + primitiveVerts; vertI++)
-                {
-                    for (int component = 0; component < attr.size; component++)
-                    {
-                        switch (attr.type)
-                        {
-                            case GL_FLOAT:
-                                assert(sizeof(int32) == sizeof(float));
-                            case GL_INT:
-                            case GL_UNSIGNED_INT:
-                                mesh->get<float>(vertI, attrOffset + component * sizeof(float)) = *((float *) &buffer.data.at(bufferView.byteOffset + tinyVertI * attr.byteSize + component * sizeof(float)));
-                                break;
-                            case GL_SHORT:
-                            case GL_UNSIGNED_SHORT:
-                                mesh->get<short>(vertI, attrOffset + component * sizeof(short)) = *((short *) &buffer.data.at(bufferView.byteOffset + tinyVertI * attr.byteSize + component * sizeof(short)));
-                                break;
-                            case GL_BYTE:
-                            case GL_UNSIGNED_BYTE:
-                                mesh->get<char>(vertI, attrOffset + component * sizeof(char)) = *((char *) &buffer.data.at(bufferView.byteOffset + tinyVertI * attr.byteSize + component * sizeof(char)));
-                                break;
-                        }
-                    }
-                    tinyVertI++;
-                }
+                const int vertSize = attributes.getVertSize();
+
+                VertAttributesConversion::copy(
+                    &buffer.data[srcBegin], attr.type, attr.normalized, srcStride,
+                    &mesh->vertexData[nrOfVertsLoaded * vertSize + attributes.getOffset(*dstAttr)], dstAttr->type, vertSize,
+                    attr.size, primitiveVerts
+                );
             }
+            loadMorphTargets(tiny, binary, primitive, nrOfVertsLoaded, primitiveVerts, *mesh);
             nrOfVertsLoaded += primitiveVerts;
 
             switch (loader.calculateTangents)
@@ -178,10 +392,71 @@ void loadMeshes(GltfModelLoader &loader, const tinygltf::Model &tiny)
             }
         }
         assert(nrOfVertsLoaded == nrOfVerts);
+
+        if (!mesh->morphTargets.empty())
+        {
+            mesh->morphWeights.assign(tinyMesh.weights.begin(), tinyMesh.weights.end());
+            mesh->morphWeights.resize(mesh->morphTargets.size(), 0.0f);
+
+            // names of the targets, as exported by Blender:
+            if (tinyMesh.extras.Has("targetNames"))
+            {
+                const tinygltf::Value &names = tinyMesh.extras.Get("targetNames");
+                for (int i = 0; i < names.ArrayLen() && i < mesh->morphTargets.size(); i++)
+                    if (names.Get(i).IsString())
+                        mesh->morphTargets[i].name = names.Get(i).Get<std::string>();
+            }
+        }
+        // welding, reordering and simplifying vertices would break the deltas of morph targets:
+        const bool bMorphed = !mesh->morphTargets.empty();
+
+        auto &primitivesOfMeshParts = primitivesOfParts.emplace_back();
+        for (int originalPartI : mesh->splitPartsForIndexType(loader.indexType))
+            primitivesOfMeshParts.push_back(primitivesOfLoadedParts.at(originalPartI));
+
+        if (loader.optimizeMeshes && !bMorphed)
+        {
+            auto report = MeshOptimizer::optimize(*mesh);
+            #ifndef GU_PUT_A_SOCK_IN_IT
+            std::cout << "Mesh optimized: " << mesh->name << ", ACMR: " << report.acmrBefore << " -> " << report.acmrAfter
+                << ", vertices: " << report.nrOfVerticesBefore << " -> " << report.nrOfVerticesAfter << std::endl;
+            #endif
+        }
+
+        if (loader.nrOfLODs > 0 && !bMorphed)
+        {
+            MeshLOD::Options lodOptions;
+            lodOptions.maxNrOfLODs = loader.nrOfLODs;
+
+            const int nrOfParts = mesh->parts.size();
+            for (int partI = 0; partI < nrOfParts; partI++)
+            {
+                const int primitiveI = primitivesOfMeshParts.at(partI);
+                for (int lodI = MeshLOD::generateLODs(*mesh, partI, lodOptions); lodI > 0; lodI--)
+                    primitivesOfMeshParts.push_back(primitiveI);
+            }
+            if (loader.optimizeMeshes)
+                for (int partI = nrOfParts; partI < mesh->parts.size(); partI++)
+                    MeshOptimizer::optimizeVertexCache(mesh->parts[partI]);
+        }
+
+        if (loader.buildMeshlets)
+            for (int partI = 0; partI < mesh->parts.size(); partI++)
+                Meshlets::build(*mesh, partI);
+
+        if (bQuantize)
+        {
+            auto quantizedMesh = std::make_shared<Mesh>(mesh->name, mesh->nrOfVertices(), loader.vertAttributes);
+            VertAttributesConversion::quantize(*mesh, *quantizedMesh);
+            quantizedMesh->parts = std::move(mesh->parts);
+            quantizedMesh->morphTargets = std::move(mesh->morphTargets);
+            quantizedMesh->morphWeights = std::move(mesh->morphWeights);
+            mesh = quantizedMesh;
+        }
     }
 }
 
-void loadModels(GltfModelLoader &loader, const tinygltf::Model &tiny)
+void loadModels(GltfModelLoader &loader, const tinygltf::Model &tiny, const std::vector<std::vector<int>> &primitivesOfParts)
 {
     for (auto &node : tiny.nodes)
     {
@@ -192,20 +467,23 @@ void loadModels(GltfModelLoader &loader, const tinygltf::Model &tiny)
         auto &model = loader.models.back();
         auto &mesh = loader.meshes.at(node.mesh);
         auto &tinyMesh = tiny.meshes.at(node.mesh);
-        int partI = 0;
-        for (auto &meshPart : mesh->parts)
+        for (int partI = 0; partI < mesh->parts.size(); partI++)
         {
+            // LODs are rendered instead of their original part, see MeshLOD::selectLOD()
+            if (mesh->parts[partI].lodOf >= 0)
+                continue;
+
             auto &modelPart = model->parts.emplace_back();
             modelPart.mesh = mesh;
 
-            auto materialI = tinyMesh.primitives.at(partI).material;
+            auto materialI = tinyMesh.primitives.at(primitivesOfParts.at(node.mesh).at(partI)).material;
             if (materialI >= 0)
                 modelPart.material = loader.materials.at(materialI);
 
             if (node.skin >= 0)
                 modelPart.armature = loader.armatures.at(node.skin);
 
-            modelPart.meshPartIndex = partI++;
+            modelPart.meshPartIndex = partI;
         }
     }
 }
@@ -304,32 +582,92 @@ void loadMaterials(GltfModelLoader &loader, const tinygltf::Model &tiny)
     }
 }
 
-void loadTextures(GltfModelLoader &loader, const tinygltf::Model &tiny)
+/**
+ * Used instead of tinygltf's image loader: only stores the encoded image, so that decodeImages() can decode all images in parallel.
+ */
+bool storeEncodedImage(
+    tinygltf::Image *image, const int imageIndex, std::string *err, std::string *warn,
+    int reqWidth, int reqHeight, const unsigned char *bytes, int size, void *userData
+)
+{
+    image->image.assign(bytes, bytes + size);
+    return true;
+}
+
+void decodeImages(GltfModelLoader &loader, tinygltf::Model &tiny, const BinaryData &binary)
 {
+    std::vector<bool> used(tiny.images.size(), false);
     for (auto &tinyTexture : tiny.textures)
-    {
         if (tinyTexture.source >= 0)
+            used.at(tinyTexture.source) = true;
+
+    loader.images.clear();
+    loader.images.resize(tiny.images.size());
+
+    gu::parallel::forEach(tiny.images.size(), 1, [&] (int imageI) {
+        auto &tinyImage = tiny.images[imageI];
+        auto &image = loader.images[imageI];
+        image.name = tinyImage.name.empty() ? tinyImage.uri : tinyImage.name;
+
+        if (used[imageI])
         {
-            auto &tinyImage = tiny.images.at(tinyTexture.source);
+            // images in a mapped GLB are read in place:
+            const BinaryData::Span &mapped = binary.images.at(imageI);
+            const unsigned char *encoded = mapped.data ? mapped.data : tinyImage.image.data();
+            const size_t encodedSize = mapped.data ? mapped.size : tinyImage.image.size();
+
+            int width, height, nrOfChannels;
+            stbi_uc *pixels = stbi_load_from_memory(encoded, encodedSize, &width, &height, &nrOfChannels, 0);
+            if (!pixels)
+                throw gu_err("Could not decode image " + image.name + ": " + stbi_failure_reason());
+
+            image.width = width;
+            image.height = height;
+            image.nrOfChannels = nrOfChannels;
+            image.pixels.assign(pixels, pixels + width * height * nrOfChannels);
+            stbi_image_free(pixels);
+        }
+        tinyImage.image.clear();
+        tinyImage.image.shrink_to_fit();
+    });
+}
+
+void loadTextures(GltfModelLoader &loader, tinygltf::Model &tiny, const BinaryData &binary)
+{
+    decodeImages(loader, tiny, binary);
+
+    // Textures are created on this thread (OpenGL), textures that use the same image share one Texture:
+    std::vector<SharedTexture> textureOfImage(loader.images.size());
 
-            if (tinyImage.component <= 0 || tinyImage.component > 4)
-                throw gu_err(tinyImage.name + " has " + std::to_string(tinyImage.component) + " channels!");
+    for (auto &tinyTexture : tiny.textures)
+    {
+        if (tinyTexture.source >= 0 && loader.uploadTextures)
+        {
+            auto &texture = textureOfImage.at(tinyTexture.source);
+            if (!texture)
+            {
+                auto &image = loader.images[tinyTexture.source];
 
-            if (tinyImage.pixel_type != GL_UNSIGNED_BYTE)
-                throw gu_err("pixel data of " + tinyImage.name + " is not GL_UNSIGNED_BYTE!");
+                if (image.nrOfChannels <= 0 || image.nrOfChannels > 4)
+                    throw gu_err(image.name + " has " + std::to_string(image.nrOfChannels) + " channels!");
 
-            GLenum format = std::vector<GLenum>{GL_R, GL_RG, GL_RGB, GL_RGBA}[tinyImage.component - 1];
+                GLenum format = std::vector<GLenum>{GL_RED, GL_RG, GL_RGB, GL_RGBA}[image.nrOfChannels - 1];
 
-            loader.textures.push_back(SharedTexture(new Texture(Texture::fromByteData(
-                tinyImage.image.data(), format, format, tinyImage.width, tinyImage.height,
-                loader.textureMagFilter, loader.textureMinFilter, loader.generateMipMaps
-            ))));
+                texture = SharedTexture(new Texture(Texture::fromByteData(
+                    image.pixels.data(), format, format, image.width, image.height,
+                    loader.textureMagFilter, loader.textureMinFilter, loader.generateMipMaps
+                )));
+            }
+            loader.textures.push_back(texture);
         }
         else loader.textures.push_back(SharedTexture());
     }
+    if (loader.uploadTextures && !loader.keepDecodedImages)
+        for (auto &image : loader.images)
+            image.pixels = std::vector<unsigned char>();
 }
 
-void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny)
+void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny, const BinaryData &binary)
 {
     std::unordered_map<int, SharedBone> bones;
     std::unordered_map<int, SharedArmature> boneToArmature;
@@ -385,12 +723,12 @@ void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny)
             auto &ibmAccessor = tiny.accessors.at(tinySkin.inverseBindMatrices);
 
             auto &bufferView = tiny.bufferViews.at(ibmAccessor.bufferView);
-            auto &buffer = tiny.buffers.at(bufferView.buffer);
+            auto &buffer = binary.buffers.at(bufferView.buffer);
 
             assert(ibmAccessor.componentType == GL_FLOAT);
             assert(ibmAccessor.type == TINYGLTF_TYPE_MAT4);
             assert(bufferView.byteLength == ibmAccessor.count * sizeof(mat4));
-            assert(buffer.data.size() >= (bufferView.byteOffset + bufferView.byteLength));
+            assert(buffer.size >= (bufferView.byteOffset + bufferView.byteLength));
             for (int i = 0; i < ibmAccessor.count; i++)
             {
                 armature->bones.at(i)->inverseBindMatrix = *((mat4 *) &buffer.data[bufferView.byteOffset + i * sizeof(mat4)]);
@@ -421,9 +759,9 @@ void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny)
                     throw gu_err("Timeline does not contain floats.");
                 }
                 auto &bufferView = tiny.bufferViews.at(accessor.bufferView);
-                auto &buffer = tiny.buffers.at(bufferView.buffer);
+                auto &buffer = binary.buffers.at(bufferView.buffer);
                 assert(bufferView.byteLength == accessor.count * sizeof(float));
-                assert(buffer.data.size() >= (bufferView.byteOffset + bufferView.byteLength));
+                assert(buffer.size >= (bufferView.byteOffset + bufferView.byteLength));
                 for (int i = 0; i < accessor.count; i++)
                 {
                     timeline->times[i] = *((float *) &buffer.data[bufferView.byteOffset + i * sizeof(float)]);
@@ -449,8 +787,8 @@ void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny)
                     throw gu_err("Found an animation (" + tinyAnim.name + ") with componentType " + std::to_string(accessor.componentType));
                 }
                 auto &bufferView = tiny.bufferViews.at(accessor.bufferView);
-                auto &buffer = tiny.buffers.at(bufferView.buffer);
-                assert(buffer.data.size() >= (bufferView.byteOffset + bufferView.byteLength));
+                auto &buffer = binary.buffers.at(bufferView.buffer);
+                assert(buffer.size >= (bufferView.byteOffset + bufferView.byteLength));
                 if (accessor.type == TINYGLTF_TYPE_VEC4)
                 {
                     // quats
@@ -523,45 +861,162 @@ void loadArmatures(GltfModelLoader &loader, const tinygltf::Model &tiny)
     }
 }
 
-void load(GltfModelLoader &loader, tinygltf::Model &tiny)
+void load(GltfModelLoader &loader, tinygltf::Model &tiny, const BinaryData &binary)
 {
-    loadTextures(loader, tiny);
+    std::vector<std::vector<int>> primitivesOfParts;
+
+    loadTextures(loader, tiny, binary);
     loadMaterials(loader, tiny);
-    loadMeshes(loader, tiny);
-    loadArmatures(loader, tiny);
-    loadModels(loader, tiny);
+    loadMeshes(loader, tiny, binary, primitivesOfParts);
+    loadArmatures(loader, tiny, binary);
+    loadModels(loader, tiny, primitivesOfParts);
 }
 
-void GltfModelLoader::fromASCIIFile(const char *path)
+void checkResult(bool success, const std::string &err, const std::string &warn, const char *name)
 {
-    tinygltf::Model model;
-    tinygltf::TinyGLTF ctx;
-    std::string err, warn;
-    bool success = ctx.LoadASCIIFromFile(&model, &err, &warn, path);
-
     if (!err.empty())
         throw gu_err(err);
     if (!warn.empty())
-        std::cerr << "Warning while loading " << path << ":\n" << warn << std::endl;
+        std::cerr << "Warning while loading " << name << ":\n" << warn << std::endl;
     if (!success)
         throw gu_err("Failed to parse glTF");
+}
+
+/**
+ * Loads a GLB without letting tinygltf copy the BIN chunk:
+ * tinygltf only parses the JSON chunk, in which the binary buffer (and images stored in it) are replaced by tiny placeholders.
+ * The loader then reads the BIN chunk in place.
+ */
+void loadGLB(GltfModelLoader &loader, const unsigned char *data, size_t size, const std::string &baseDir, const char *name)
+{
+    const auto readUint32 = [&] (size_t offset) {
+        if (offset + sizeof(uint32) > size)
+            throw gu_err(std::string(name) + " is not a valid GLB: unexpected end of data");
+        uint32 value;
+        memcpy(&value, data + offset, sizeof(uint32));
+        return value;
+    };
+    const uint32 CHUNK_JSON = 0x4E4F534A, CHUNK_BIN = 0x004E4942;
+
+    if (size < 20 || memcmp(data, "glTF", 4) != 0 || readUint32(4) != 2)
+        throw gu_err(std::string(name) + " is not a GLB version 2 file");
+
+    const size_t glbSize = min<size_t>(readUint32(8), size);
+    const size_t jsonSize = readUint32(12);
+    if (readUint32(16) != CHUNK_JSON || 20 + jsonSize > glbSize)
+        throw gu_err(std::string(name) + " is not a valid GLB: first chunk is not JSON");
+
+    const unsigned char *bin = nullptr;
+    size_t binSize = 0;
+
+    const size_t binHeader = 20 + ((jsonSize + 3) & ~size_t(3));
+    if (binHeader + 8 <= glbSize && readUint32(binHeader + 4) == CHUNK_BIN)
+    {
+        binSize = readUint32(binHeader);
+        bin = data + binHeader + 8;
+        if (binHeader + 8 + binSize > glbSize)
+            throw gu_err(std::string(name) + " is not a valid GLB: BIN chunk does not fit");
+    }
+
+    json gltf = json::parse((const char *) data + 20, (const char *) data + 20 + jsonSize);
+
+    // tinygltf needs *some* data for the buffer and images, otherwise it will refuse to load the file:
+    const char *PLACEHOLDER_URI = "data:application/octet-stream;base64,AA==";
+
+    size_t binBufferSize = 0;
+    std::vector<BinaryData::Span> mappedImages;
 
-    load(*this, model);
+    if (bin && gltf.contains("buffers") && !gltf["buffers"].empty() && !gltf["buffers"][0].contains("uri"))
+    {
+        json &binBuffer = gltf["buffers"][0];
+        binBufferSize = binBuffer.value("byteLength", size_t(0));
+        if (binBufferSize > binSize)
+            throw gu_err(std::string(name) + " is not a valid GLB: buffer is larger than the BIN chunk");
+
+        binBuffer["uri"] = PLACEHOLDER_URI;
+        binBuffer["byteLength"] = 1;
+
+        if (gltf.contains("images"))
+        {
+            json &images = gltf["images"];
+            mappedImages.resize(images.size());
+
+            for (int imageI = 0; imageI < images.size(); imageI++)
+            {
+                json &image = images[imageI];
+                if (!image.contains("bufferView"))
+                    continue;
+
+                const json &bufferView = gltf.at("bufferViews").at(image["bufferView"].get<int>());
+                if (bufferView.value("buffer", -1) != 0)
+                    continue;
+
+                const size_t offset = bufferView.value("byteOffset", size_t(0)), length = bufferView.value("byteLength", size_t(0));
+                if (offset + length > binBufferSize)
+                    throw gu_err(std::string(name) + " is not a valid GLB: image does not fit in the buffer");
+
+                mappedImages[imageI] = { bin + offset, length };
+                image.erase("bufferView");
+                image["uri"] = PLACEHOLDER_URI;
+            }
+        }
+    }
+    const std::string jsonString = gltf.dump();
+
+    tinygltf::Model model;
+    tinygltf::TinyGLTF ctx;
+    ctx.SetImageLoader(storeEncodedImage, nullptr);
+    std::string err, warn;
+    bool success = ctx.LoadASCIIFromString(&model, &err, &warn, jsonString.c_str(), jsonString.size(), baseDir);
+    checkResult(success, err, warn, name);
+
+    BinaryData binary(model);
+    if (binBufferSize > 0)
+        binary.buffers.at(0) = { bin, binBufferSize };
+    for (int imageI = 0; imageI < mappedImages.size(); imageI++)
+        binary.images.at(imageI) = mappedImages[imageI];
+
+    load(loader, model, binary);
 }
 
-void GltfModelLoader::fromBinaryFile(const char *path)
+std::string directoryOf(const char *path)
+{
+    const std::string pathString = path;
+    const size_t slash = pathString.find_last_of("/\\");
+    return slash == std::string::npos ? "" : pathString.substr(0, slash + 1);
+}
+
+void GltfModelLoader::fromASCIIFile(const char *path)
 {
     tinygltf::Model model;
     tinygltf::TinyGLTF ctx;
+    ctx.SetImageLoader(storeEncodedImage, nullptr);
     std::string err, warn;
-    bool success = ctx.LoadBinaryFromFile(&model, &err, &warn, path);
+    bool success = ctx.LoadASCIIFromFile(&model, &err, &warn, path);
+    checkResult(success, err, warn, path);
 
-    if (!err.empty())
-        throw gu_err(err);
-    if (!warn.empty())
-        std::cerr << "Warning while loading " << path << ":\n" << warn << std::endl;
-    if (!success)
-        throw gu_err("Failed to parse glTF");
+    load(*this, model, BinaryData(model));
+}
+
+void GltfModelLoader::fromBinaryFile(const char *path)
+{
+    const fu::MappedFile file(path);
+    loadGLB(*this, file.data(), file.size(), directoryOf(path), path);
+}
+
+void GltfModelLoader::fromMemory(const unsigned char *data, size_t size, const char *baseDir)
+{
+    if (size >= 4 && memcmp(data, "glTF", 4) == 0)
+    {
+        loadGLB(*this, data, size, baseDir, "glTF from memory");
+        return;
+    }
+    tinygltf::Model model;
+    tinygltf::TinyGLTF ctx;
+    ctx.SetImageLoader(storeEncodedImage, nullptr);
+    std::string err, warn;
+    bool success = ctx.LoadASCIIFromString(&model, &err, &warn, (const char *) data, size, baseDir);
+    checkResult(success, err, warn, "glTF from memory");
 
-    load(*this, model);
+    load(*this, model, BinaryData(model));
 }
@@ -17,6 +17,11 @@ class GltfModelLoader
         ALWAYS
     };
 
+    /**
+     * The attributes of the loaded meshes.
+     * May contain quantized attributes (like VertAttributes::NORMAL_OCT), the vertices are encoded after all other processing.
+     * Morph targets (Mesh::morphTargets) are loaded for POSITION, NORMAL and TANGENT, but can only be applied to float attributes.
+     */
     VertAttributes vertAttributes;
     CalculateTangents calculateTangents = ALWAYS;
     bool
@@ -27,21 +32,80 @@ class GltfModelLoader
         loadMetallicRoughnessTextures = true,
         generateMipMaps = true;
 
+    /**
+     * Index type of the loaded mesh parts: GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+     * Parts that use more vertices than this type can index are split into multiple parts (and multiple ModelParts).
+     */
+    GLenum indexType = GL_UNSIGNED_SHORT;
+
+    /**
+     * Welds duplicate vertices and reorders triangles and vertices for the GPU's vertex cache, less overdraw and vertex fetching.
+     * See MeshOptimizer. Slows down loading, so preferably only used when converting/baking models.
+     * Meshes with morph targets are not optimized.
+     */
+    bool optimizeMeshes = false;
+
+    /**
+     * Number of simplified LOD parts generated for every mesh part (see MeshLOD). 0 = none.
+     * ModelParts are only created for the original parts, use MeshLOD::selectLOD() to render a LOD instead.
+     * No LODs are generated for meshes with morph targets.
+     */
+    int nrOfLODs = 0;
+
+    // Split mesh parts (and their LODs) into meshlets that can be culled on the CPU, see Meshlets.
+    bool buildMeshlets = false;
+
     GLuint textureMagFilter = GL_LINEAR;
     GLuint textureMinFilter = GL_LINEAR_MIPMAP_LINEAR;
 
+    /**
+     * If false, images are only decoded (into 'images') and no Textures are created, so no OpenGL context is needed.
+     * 'textures' will contain nullptrs and Materials will have no textures.
+     */
+    bool uploadTextures = true;
+
+    // Keep the pixels in 'images' after the Textures are created.
+    bool keepDecodedImages = false;
+
+    /**
+     * An image decoded by the loader, before it is uploaded to a Texture.
+     */
+    struct DecodedImage
+    {
+        std::string name;
+        int width = 0, height = 0, nrOfChannels = 0;
+        std::vector<unsigned char> pixels;
+    };
+
     explicit GltfModelLoader(const VertAttributes &);
 
     std::vector<SharedArmature> armatures;
     std::vector<SharedTexture> textures;
+
+    /**
+     * The images of the glTF file (same indices), decoded in parallel on the worker threads.
+     * Pixels are freed after uploading, unless keepDecodedImages is true or uploadTextures is false.
+     * Images that are not used by a texture are not decoded.
+     */
+    std::vector<DecodedImage> images;
     std::vector<SharedMaterial> materials;
     std::vector<SharedModel> models;
     std::vector<SharedMesh> meshes;
 
     void fromASCIIFile(const char *path);
 
+    /**
+     * Maps the GLB file into memory, the binary chunk is read in place (not copied into tinygltf buffers).
+     */
     void fromBinaryFile(const char *path);
 
+    /**
+     * Loads a glTF (JSON) or GLB (binary) file from memory, for example from an asset pack.
+     * 'data' is only used during this call, the binary chunk of a GLB is read in place.
+     * External files (buffers or images) are loaded relative to 'baseDir'.
+     */
+    void fromMemory(const unsigned char *data, size_t size, const char *baseDir = "");
+
 };
 
 
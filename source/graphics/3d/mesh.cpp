@@ -1,9 +1,14 @@
 #include "mesh.h"
 #include "vert_buffer.h"
+#include "vert_attributes_conversion.h"
 
 #include "../../math/math_utils.h"
 #include "../../utils/gu_error.h"
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
 VertData::VertData(VertAttributes attrs, std::vector<unsigned char> vertices) :
     attributes(std::move(attrs)),
     vertexData(std::move(vertices))
@@ -70,16 +75,16 @@ void Mesh::render(const int partI)
     glDrawElements(
         part.mode,
         part.getNumIndicesToRender(),
-        GL_UNSIGNED_SHORT,
+        part.indexType,
         (void *)(uintptr_t) part.inBuffer.indicesOffset
     );
     #else
     glDrawElementsBaseVertex(
         part.mode,
         part.getNumIndicesToRender(),
-        GL_UNSIGNED_SHORT,
+        part.indexType,
         (void *)(uintptr_t) part.inBuffer.indicesOffset,
-        inBuffer.baseVertex
+        inBuffer.baseVertex + part.baseVertex
     );
     #endif
 }
@@ -97,7 +102,7 @@ void Mesh::renderInstances(const GLsizei count, const int partI)
     // glDrawElementsInstanced(
         part.mode,
         part.getNumIndicesToRender(),
-        GL_UNSIGNED_SHORT,
+        part.indexType,
         (void *)(uintptr_t) part.inBuffer.indicesOffset,
         count
     // );
@@ -106,10 +111,53 @@ void Mesh::renderInstances(const GLsizei count, const int partI)
     glDrawElementsInstancedBaseVertex(
         part.mode,
         part.getNumIndicesToRender(),
-        GL_UNSIGNED_SHORT,
+        part.indexType,
         (void *)(uintptr_t) part.inBuffer.indicesOffset,
         count,
-        inBuffer.baseVertex
+        inBuffer.baseVertex + part.baseVertex
+    );
+    #endif
+}
+
+void Mesh::renderRanges(const std::vector<IndexRange> &ranges, const int partI)
+{
+    ensureBufferAndPart(*this, partI);
+    if (ranges.empty())
+        return;
+
+    vertBuffer->bind();
+    const Part &part = parts.at(partI);
+    const int indexSize = VertAttributesConversion::componentSize(part.indexType);
+
+    #ifdef EMSCRIPTEN
+    for (auto &range : ranges)
+        glDrawElements(
+            part.mode,
+            range.count,
+            part.indexType,
+            (void *)(uintptr_t) (part.inBuffer.indicesOffset + range.first * indexSize)
+        );
+    #else
+    static std::vector<GLsizei> counts;
+    static std::vector<const void *> offsets;
+    static std::vector<GLint> baseVertices;
+
+    counts.resize(ranges.size());
+    offsets.resize(ranges.size());
+    baseVertices.assign(ranges.size(), inBuffer.baseVertex + part.baseVertex);
+
+    for (int i = 0; i < ranges.size(); i++)
+    {
+        counts[i] = ranges[i].count;
+        offsets[i] = (void *)(uintptr_t) (part.inBuffer.indicesOffset + ranges[i].first * indexSize);
+    }
+    glMultiDrawElementsBaseVertex(
+        part.mode,
+        counts.data(),
+        part.indexType,
+        offsets.data(),
+        ranges.size(),
+        baseVertices.data()
     );
     #endif
 }
@@ -125,6 +173,267 @@ void Mesh::renderArrays(GLenum mode, const int numVerts) const
     );
 }
 
+namespace
+{
+
+int64 nrOfIndexableVertices(GLenum indexType)
+{
+    switch (indexType)
+    {
+        case GL_UNSIGNED_BYTE:
+            return int64(1) << 8;
+        case GL_UNSIGNED_SHORT:
+            return int64(1) << 16;
+        case GL_UNSIGNED_INT:
+            return int64(1) << 32;
+    }
+    throw gu_err("Invalid index type: " + std::to_string(indexType));
+}
+
+int verticesPerPrimitive(GLenum mode)
+{
+    switch (mode)
+    {
+        case GL_TRIANGLES:
+            return 3;
+        case GL_LINES:
+            return 2;
+        case GL_POINTS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+}
+
+std::vector<int> Mesh::splitPartsForIndexType(GLenum indexType)
+{
+    if (vertBuffer)
+    {
+        throw gu_err("Cannot split parts of " + name + " because it was already added to a VertBuffer");
+    }
+    for (auto &part : parts)
+    {
+        if (!part.lods.empty() || part.lodOf >= 0)
+        {
+            throw gu_err("Cannot split parts of " + name + " because LODs were already generated. Split the parts first");
+        }
+    }
+    const int64 maxVertices = nrOfIndexableVertices(indexType);
+    const int vertSize = attributes.getVertSize();
+
+    std::vector<Part> newParts;
+    std::vector<int> originalParts;
+    std::vector<std::pair<int, int>> copiedVertices;
+
+    for (int partI = 0; partI < parts.size(); partI++)
+    {
+        Part &part = parts[partI];
+        part.indexType = indexType;
+
+        if (part.indices.empty())
+        {
+            newParts.push_back(std::move(part));
+            originalParts.push_back(partI);
+            continue;
+        }
+
+        const auto [minIt, maxIt] = std::minmax_element(part.indices.begin(), part.indices.end());
+        const GLuint minIndex = *minIt, maxIndex = *maxIt;
+
+        if (int64(maxIndex - minIndex) < maxVertices)
+        {
+            // rebasing is enough:
+            part.baseVertex += minIndex;
+            for (GLuint &index : part.indices)
+            {
+                index -= minIndex;
+            }
+            newParts.push_back(std::move(part));
+            originalParts.push_back(partI);
+            continue;
+        }
+
+        const int primitiveSize = verticesPerPrimitive(part.mode);
+        if (primitiveSize == 0)
+        {
+            throw gu_err("Cannot split part '" + part.name + "' of " + name + ", only GL_TRIANGLES, GL_LINES and GL_POINTS parts can be split");
+        }
+
+        if (part.indices.size() % primitiveSize != 0)
+        {
+            throw gu_err("Cannot split part '" + part.name + "' of " + name + ", its number of indices (" + std::to_string(part.indices.size()) + ") is not a multiple of " + std::to_string(primitiveSize));
+        }
+
+        std::unordered_map<GLuint, GLuint> localIndices;
+        int chunkI = -1, nrOfChunks = 0;
+
+        for (int i = 0; i + primitiveSize <= part.indices.size(); i += primitiveSize)
+        {
+            if (chunkI == -1 || int64(localIndices.size() + primitiveSize) > maxVertices)
+            {
+                chunkI = newParts.size();
+                Part &chunk = newParts.emplace_back();
+                chunk.name = part.name + "_" + std::to_string(nrOfChunks++);
+                chunk.mode = part.mode;
+                chunk.indexType = indexType;
+                chunk.baseVertex = nrOfVertices();
+                originalParts.push_back(partI);
+                localIndices.clear();
+            }
+            Part &chunk = newParts[chunkI];
+
+            for (int j = 0; j < primitiveSize; j++)
+            {
+                const GLuint vertI = part.baseVertex + part.indices[i + j];
+                const auto [it, bInserted] = localIndices.insert({ vertI, GLuint(localIndices.size()) });
+                if (bInserted)
+                {
+                    // copy the vertex to the chunk:
+                    addVertices(1);
+                    memcpy(&vertexData[vertexData.size() - vertSize], &vertexData[vertI * vertSize], vertSize);
+                    if (!morphTargets.empty())
+                        copiedVertices.push_back({ int(vertI), nrOfVertices() - 1 });
+                }
+                chunk.indices.push_back(it->second);
+            }
+        }
+    }
+    parts = std::move(newParts);
+    if (!copiedVertices.empty())
+        copyMorphTargetDeltas(copiedVertices);
+    removeUnusedVertices();
+    return originalParts;
+}
+
+void Mesh::removeUnusedVertices()
+{
+    if (vertBuffer)
+    {
+        throw gu_err("Cannot remove vertices of " + name + " because it was already added to a VertBuffer");
+    }
+    const int vertSize = attributes.getVertSize();
+    const int nrOfVerts = nrOfVertices();
+
+    std::vector<int> newVertI(nrOfVerts, -1);
+    for (const Part &part : parts)
+    {
+        for (const GLuint index : part.indices)
+        {
+            newVertI.at(part.baseVertex + index) = 0;
+        }
+    }
+    int nrOfUsedVerts = 0;
+    for (int vertI = 0; vertI < nrOfVerts; vertI++)
+    {
+        if (newVertI[vertI] == -1)
+        {
+            continue;
+        }
+        if (vertI != nrOfUsedVerts)
+        {
+            memcpy(&vertexData[nrOfUsedVerts * vertSize], &vertexData[vertI * vertSize], vertSize);
+        }
+        newVertI[vertI] = nrOfUsedVerts++;
+    }
+    removeVertices(nrOfVerts - nrOfUsedVerts);
+
+    for (Part &part : parts)
+    {
+        if (part.indices.empty())
+        {
+            part.baseVertex = 0;
+            continue;
+        }
+        // The order of vertices is kept, so the smallest index stays the smallest:
+        const GLuint minIndex = *std::min_element(part.indices.begin(), part.indices.end());
+        const int newBaseVertex = newVertI[part.baseVertex + minIndex];
+
+        for (GLuint &index : part.indices)
+        {
+            index = newVertI[part.baseVertex + index] - newBaseVertex;
+        }
+        part.baseVertex = newBaseVertex;
+    }
+    if (!morphTargets.empty())
+        remapMorphTargets(newVertI);
+}
+
+namespace
+{
+
+void makeMorphStreamSparse(Mesh::MorphTarget::Stream &stream)
+{
+    if (stream.isSparse())
+        return;
+    stream.vertices.resize(stream.deltas.size());
+    for (int i = 0; i < stream.deltas.size(); i++)
+        stream.vertices[i] = stream.firstVertex + i;
+}
+
+void makeMorphStreamDenseIfContiguous(Mesh::MorphTarget::Stream &stream)
+{
+    if (!stream.isSparse() || stream.vertices.back() - stream.vertices.front() + 1 != stream.vertices.size())
+        return;
+    stream.firstVertex = stream.vertices.front();
+    stream.vertices.clear();
+}
+
+}
+
+void Mesh::remapMorphTargets(const std::vector<int> &newVertI)
+{
+    for (MorphTarget &target : morphTargets)
+    {
+        for (MorphTarget::Stream &stream : target.streams)
+        {
+            makeMorphStreamSparse(stream);
+
+            int nrOfDeltas = 0;
+            for (int i = 0; i < stream.vertices.size(); i++)
+            {
+                const int newVertex = newVertI.at(stream.vertices[i]);
+                if (newVertex == -1)
+                    continue;
+                stream.vertices[nrOfDeltas] = newVertex;
+                stream.deltas[nrOfDeltas++] = stream.deltas[i];
+            }
+            stream.vertices.resize(nrOfDeltas);
+            stream.deltas.resize(nrOfDeltas);
+
+            makeMorphStreamDenseIfContiguous(stream);
+        }
+    }
+}
+
+void Mesh::copyMorphTargetDeltas(const std::vector<std::pair<int, int>> &copies)
+{
+    for (MorphTarget &target : morphTargets)
+    {
+        for (MorphTarget::Stream &stream : target.streams)
+        {
+            if (stream.deltas.empty())
+                continue;
+
+            makeMorphStreamSparse(stream);
+            const int nrOfOriginalDeltas = stream.vertices.size();
+
+            for (auto [from, to] : copies)
+            {
+                auto it = std::lower_bound(stream.vertices.begin(), stream.vertices.begin() + nrOfOriginalDeltas, from);
+                if (it == stream.vertices.begin() + nrOfOriginalDeltas || *it != from)
+                    continue;
+
+                const vec3 delta = stream.deltas[it - stream.vertices.begin()];
+                stream.vertices.push_back(to);
+                stream.deltas.push_back(delta);
+            }
+            makeMorphStreamDenseIfContiguous(stream);
+        }
+    }
+}
+
 void Mesh::disposeOfflineData()
 {
     vertexData.resize(0);
@@ -145,7 +454,7 @@ Mesh::~Mesh()
 
     if (vertBuffer)
     {
-        vertBuffer->onMeshDestroyed();
+        vertBuffer->onMeshDestroyed(this);
     }
 }
 
@@ -5,6 +5,8 @@
 #include "vert_attributes.h"
 #include "shared_3d.h"
 
+#include "../../math/math_utils.h"
+
 #include <vector>
 
 class VertData
@@ -47,8 +49,60 @@ class Mesh : public VertData
     struct Part
     {
         std::string name;
-        std::vector<unsigned short> indices;
+        std::vector<GLuint> indices;
         GLenum mode = GL_TRIANGLES;
+
+        /**
+         * The type the indices are converted to when uploaded by a VertBuffer: GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+         * A smaller type uses less memory, but limits the number of vertices a part can use. See Mesh::splitPartsForIndexType().
+         *
+         * On WebGL the base vertex is added to the indices, so VertBuffer::add() promotes the type if the position of the vertices in the VertBuffer does not fit.
+         * (Parts of meshes with more vertices than fit in an unsigned short always use GL_UNSIGNED_INT there.)
+         */
+        GLenum indexType = GL_UNSIGNED_SHORT;
+
+        /**
+         * Added to every index when rendering (using glDrawElementsBaseVertex).
+         * This allows a part to use a small index type, while its vertices are not at the start of the Mesh.
+         */
+        int baseVertex = 0;
+
+        /**
+         * Simplified versions of this part, ordered from detailed to coarse. Each LOD is another part of the same Mesh.
+         * Generated by MeshLOD::generateLODs(), MeshLOD::selectLOD() picks one at runtime.
+         */
+        struct LOD
+        {
+            int partIndex = 0;
+            float error = 0.0f; // maximum distance to the surface of this part, in object space.
+        };
+        std::vector<LOD> lods;
+
+        // Index of the part this part is a LOD of, or -1.
+        int lodOf = -1;
+
+        // Bounding sphere of the part in object space, used for LOD selection.
+        vec3 boundsCenter = vec3(0.0f);
+        float boundsRadius = 0.0f;
+
+        /**
+         * A small cluster of triangles, stored as a range of 'indices', with bounds for culling.
+         * Built by Meshlets::build(), culled by Meshlets::cull().
+         */
+        struct Meshlet
+        {
+            int firstIndex = 0, nrOfIndices = 0;
+
+            // Bounding sphere in object space:
+            vec3 center = vec3(0.0f);
+            float radius = 0.0f;
+
+            // Cone containing the normals of all triangles. See Meshlets::isBackFacing().
+            vec3 coneAxis = vec3(0.0f);
+            float coneCutoff = 1.0f;
+        };
+        std::vector<Meshlet> meshlets;
+
         int nrOfIndicesToRender = -1; // -1 => all
 
         int getNumIndicesToRender() const;
@@ -57,6 +111,7 @@ class Mesh : public VertData
         // also used for glDrawElementsBaseVertex
         friend VertBuffer;
         friend Mesh;
+        friend class DrawBatcher;
 
         // The position and size of this Part when it was added to a VertBuffer:
         struct
@@ -67,6 +122,51 @@ class Mesh : public VertData
         inBuffer;
     };
 
+    // A range of indices of a part, in number of indices.
+    struct IndexRange
+    {
+        int first = 0, count = 0;
+    };
+
+    /**
+     * The differences that a morph target (blend shape) makes to the vertices of the Mesh, loaded from glTF primitive targets.
+     * Applied using MorphTargetBlender.
+     */
+    struct MorphTarget
+    {
+        std::string name;
+
+        // The deltas of one attribute for a range of vertices (usually those of one glTF primitive).
+        struct Stream
+        {
+            // Name of the attribute the deltas are added to, as 3 floats (POSITION, NORMAL, TANGENT or TANGENT_AND_SIGN).
+            std::string attributeName;
+
+            /**
+             * Dense (vertices is empty): deltas[i] belongs to vertex firstVertex + i.
+             * Sparse: deltas[i] belongs to vertex vertices[i]. Vertices are sorted.
+             */
+            int firstVertex = 0;
+            std::vector<int> vertices;
+            std::vector<vec3> deltas;
+
+            bool isSparse() const
+            {
+                return !vertices.empty();
+            }
+
+            int vertexOf(int deltaI) const
+            {
+                return vertices.empty() ? firstVertex + deltaI : vertices[deltaI];
+            }
+        };
+        std::vector<Stream> streams;
+    };
+    std::vector<MorphTarget> morphTargets;
+
+    // Default weight of every morph target.
+    std::vector<float> morphWeights;
+
     Mesh(
         const std::string &name,
         unsigned int nrOfVertices,
@@ -77,8 +177,32 @@ class Mesh : public VertData
 
     void renderInstances(GLsizei count, int part = 0);
 
+    /**
+     * Renders only the given ranges of indices of a part, for example the visible meshlets returned by Meshlets::cull().
+     * Uses one glMultiDrawElementsBaseVertex() call (one draw call per range on WebGL).
+     */
+    void renderRanges(const std::vector<IndexRange> &ranges, int part = 0);
+
     void renderArrays(GLenum mode = GL_TRIANGLES, int numVerts = -1 /* -1 => all */) const;
 
+    /**
+     * Makes sure the indices of every part fit in 'indexType', and sets Part::indexType for every part.
+     *
+     * Parts are rebased first (using Part::baseVertex). Parts that still use too many vertices are split into multiple parts,
+     * which get their own copies of the vertices they use. Only GL_TRIANGLES, GL_LINES and GL_POINTS parts can be split.
+     * Vertices that are no longer used are removed afterwards.
+     *
+     * Returns for every (new) part the index of the original part it was created from.
+     * Must be called before the Mesh is added to a VertBuffer.
+     */
+    std::vector<int> splitPartsForIndexType(GLenum indexType);
+
+    /**
+     * Removes vertices that are not used by any part, while keeping the order of the remaining vertices.
+     * Indices, Part::baseVertex and the vertices of morph targets are updated accordingly.
+     */
+    void removeUnusedVertices();
+
     /* Removes the vertices + indices that are stored in memory,
      * but the mesh can still be drawn if it was uploaded to VRAM/OpenGL using a VertBuffer.
      * WARNING: vertices & indices are resized to 0!
@@ -102,9 +226,16 @@ class Mesh : public VertData
     std::vector<Part> parts;
 
   private:
+    // Moves the deltas of morph targets to newVertI[vertex], deltas of vertices that were removed (-1) are removed too.
+    void remapMorphTargets(const std::vector<int> &newVertI);
+
+    // Gives copied vertices the same deltas as the vertices they were copied from. 'copies' are (from, to) pairs, sorted by 'to'.
+    void copyMorphTargetDeltas(const std::vector<std::pair<int, int>> &copies);
+
     // variables used for glDrawElementsBaseVertex: (https://www.khronos.org/opengl/wiki/GLAPI/glDrawElementsBaseVertex)
 
     friend VertBuffer;
+    friend class DrawBatcher;
     // Position and size of the mesh in the vert buffer:
     struct
     {
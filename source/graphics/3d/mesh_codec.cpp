@@ -0,0 +1,436 @@
+
+#include "mesh_codec.h"
+
+#include "../../files/file_utils.h"
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MeshCodec
+{
+
+namespace
+{
+
+const int BLOCK_SIZE = 256;
+const int GROUP_SIZE = 16;
+const int NR_OF_GROUPS = BLOCK_SIZE / GROUP_SIZE;
+
+const char MAGIC[4] = { 'G', 'U', 'M', 'C' };
+const uint32 VERSION = 1;
+
+// Bytes used by a group of 16 values, for each of the 4 group modes (0, 2, 4 or 8 bits per value):
+const int GROUP_BYTES[4] = { 0, 4, 8, 16 };
+
+inline unsigned char zigzag(unsigned char delta)
+{
+    return (unsigned char) ((delta << 1) ^ -(delta >> 7));
+}
+
+inline unsigned char unzigzag(unsigned char value)
+{
+    return (unsigned char) ((value >> 1) ^ -(value & 1));
+}
+
+void encodeGroup(const unsigned char *values, int mode, std::vector<unsigned char> &out)
+{
+    switch (mode)
+    {
+        case 1:
+            // byte i contains values i, i + 4, i + 8 and i + 12
+            for (int i = 0; i < 4; i++)
+                out.push_back(values[i] | values[i + 4] << 2 | values[i + 8] << 4 | values[i + 12] << 6);
+            break;
+        case 2:
+            // byte i contains values i and i + 8
+            for (int i = 0; i < 8; i++)
+                out.push_back(values[i] | values[i + 8] << 4);
+            break;
+        case 3:
+            out.insert(out.end(), values, values + GROUP_SIZE);
+            break;
+    }
+}
+
+void encodeBlock(const unsigned char *vertices, int nrOfVertices, int vertSize, std::vector<unsigned char> &out)
+{
+    const int nrOfGroups = (nrOfVertices + GROUP_SIZE - 1) / GROUP_SIZE;
+    unsigned char values[BLOCK_SIZE];
+
+    for (int byteI = 0; byteI < vertSize; byteI++)
+    {
+        unsigned char previous = 0;
+        for (int v = 0; v < nrOfGroups * GROUP_SIZE; v++)
+        {
+            const unsigned char byte = v < nrOfVertices ? vertices[v * vertSize + byteI] : previous;
+            values[v] = zigzag(byte - previous);
+            previous = byte;
+        }
+        const size_t headerBegin = out.size();
+        out.resize(out.size() + (nrOfGroups + 3) / 4, 0);
+
+        for (int groupI = 0; groupI < nrOfGroups; groupI++)
+        {
+            const unsigned char *group = &values[groupI * GROUP_SIZE];
+            unsigned char max = 0;
+            for (int i = 0; i < GROUP_SIZE; i++)
+                max |= group[i];
+
+            const int mode = max == 0 ? 0 : max < 4 ? 1 : max < 16 ? 2 : 3;
+            out[headerBegin + groupI / 4] |= mode << (groupI % 4 * 2);
+            encodeGroup(group, mode, out);
+        }
+    }
+}
+
+#ifdef __SSE2__
+
+inline __m128i unpackGroup(const unsigned char *src, int mode)
+{
+    switch (mode)
+    {
+        case 1:
+        {
+            int packed;
+            memcpy(&packed, src, sizeof(int));
+            const __m128i v = _mm_cvtsi32_si128(packed), mask = _mm_set1_epi8(3);
+            const __m128i
+                a = _mm_and_si128(v, mask),
+                b = _mm_and_si128(_mm_srli_epi16(v, 2), mask),
+                c = _mm_and_si128(_mm_srli_epi16(v, 4), mask),
+                d = _mm_and_si128(_mm_srli_epi16(v, 6), mask);
+            return _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+        }
+        case 2:
+        {
+            const __m128i v = _mm_loadl_epi64((const __m128i *) src), mask = _mm_set1_epi8(15);
+            return _mm_unpacklo_epi64(_mm_and_si128(v, mask), _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        }
+        case 3:
+            return _mm_loadu_si128((const __m128i *) src);
+        default:
+            return _mm_setzero_si128();
+    }
+}
+
+// Unzigzags the deltas, and adds them up (starting at 'previous'):
+inline __m128i decodeDeltas(__m128i zigzagged, unsigned char previous)
+{
+    const __m128i
+        half = _mm_and_si128(_mm_srli_epi16(zigzagged, 1), _mm_set1_epi8(0x7f)),
+        sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(zigzagged, _mm_set1_epi8(1)));
+
+    __m128i x = _mm_xor_si128(half, sign);
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    return _mm_add_epi8(x, _mm_set1_epi8(char(previous)));
+}
+
+#endif
+
+void decodeGroup(const unsigned char *src, int mode, unsigned char &previous, unsigned char *out)
+{
+    #ifdef __SSE2__
+    const __m128i values = decodeDeltas(unpackGroup(src, mode), previous);
+    _mm_storeu_si128((__m128i *) out, values);
+    previous = out[GROUP_SIZE - 1];
+    #else
+    unsigned char values[GROUP_SIZE];
+    for (int i = 0; i < GROUP_SIZE; i++)
+    {
+        switch (mode)
+        {
+            case 1: values[i] = (src[i % 4] >> (i / 4 * 2)) & 3; break;
+            case 2: values[i] = (src[i % 8] >> (i / 8 * 4)) & 15; break;
+            case 3: values[i] = src[i]; break;
+            default: values[i] = 0;
+        }
+        previous += unzigzag(values[i]);
+        out[i] = previous;
+    }
+    #endif
+}
+
+void decodeBlock(const unsigned char *src, const unsigned char *end, unsigned char *vertices, int nrOfVertices, int vertSize)
+{
+    const int nrOfGroups = (nrOfVertices + GROUP_SIZE - 1) / GROUP_SIZE;
+    const int nrOfHeaderBytes = (nrOfGroups + 3) / 4;
+    unsigned char column[BLOCK_SIZE];
+
+    for (int byteI = 0; byteI < vertSize; byteI++)
+    {
+        if (end - src < nrOfHeaderBytes)
+            throw gu_err("Encoded vertices are corrupt");
+
+        const unsigned char *header = src;
+        src += nrOfHeaderBytes;
+
+        unsigned char previous = 0;
+        for (int groupI = 0; groupI < nrOfGroups; groupI++)
+        {
+            const int mode = (header[groupI / 4] >> (groupI % 4 * 2)) & 3;
+            if (end - src < GROUP_BYTES[mode])
+                throw gu_err("Encoded vertices are corrupt");
+
+            decodeGroup(src, mode, previous, &column[groupI * GROUP_SIZE]);
+            src += GROUP_BYTES[mode];
+        }
+        for (int v = 0; v < nrOfVertices; v++)
+            vertices[v * vertSize + byteI] = column[v];
+    }
+    if (src != end)
+        throw gu_err("Encoded vertices are corrupt");
+}
+
+void writeVarInt(uint32 value, std::vector<unsigned char> &out)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+struct Writer
+{
+    std::vector<unsigned char> data;
+
+    template<typename Type>
+    void write(const Type &value)
+    {
+        const auto *bytes = (const unsigned char *) &value;
+        data.insert(data.end(), bytes, bytes + sizeof(Type));
+    }
+
+    void writeBytes(const std::vector<unsigned char> &bytes)
+    {
+        write<uint64>(bytes.size());
+        data.insert(data.end(), bytes.begin(), bytes.end());
+    }
+
+    void writeString(const std::string &string)
+    {
+        write<uint32>(string.size());
+        data.insert(data.end(), string.begin(), string.end());
+    }
+};
+
+struct Reader
+{
+    const unsigned char *data, *end;
+
+    const unsigned char *skip(size_t size)
+    {
+        if (size_t(end - data) < size)
+            throw gu_err("Encoded mesh is corrupt or truncated");
+        const unsigned char *begin = data;
+        data += size;
+        return begin;
+    }
+
+    template<typename Type>
+    Type read()
+    {
+        Type value;
+        memcpy(&value, skip(sizeof(Type)), sizeof(Type));
+        return value;
+    }
+
+    std::string readString()
+    {
+        const uint32 size = read<uint32>();
+        return std::string((const char *) skip(size), size);
+    }
+};
+
+}
+
+std::vector<unsigned char> encodeVertices(const unsigned char *vertices, int nrOfVertices, int vertSize)
+{
+    const int nrOfBlocks = (nrOfVertices + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // the size of every block comes first, so blocks can be decoded in parallel:
+    std::vector<unsigned char> out(nrOfBlocks * sizeof(uint32));
+
+    for (int blockI = 0; blockI < nrOfBlocks; blockI++)
+    {
+        const size_t blockBegin = out.size();
+        const int first = blockI * BLOCK_SIZE;
+        encodeBlock(vertices + first * vertSize, min(BLOCK_SIZE, nrOfVertices - first), vertSize, out);
+
+        const uint32 blockSize = out.size() - blockBegin;
+        memcpy(&out[blockI * sizeof(uint32)], &blockSize, sizeof(uint32));
+    }
+    return out;
+}
+
+void decodeVertices(const unsigned char *src, size_t srcSize, unsigned char *vertices, int nrOfVertices, int vertSize)
+{
+    const int nrOfBlocks = (nrOfVertices + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (srcSize < nrOfBlocks * sizeof(uint32))
+        throw gu_err("Encoded vertices are corrupt");
+
+    std::vector<size_t> blockOffsets(nrOfBlocks + 1);
+    blockOffsets[0] = nrOfBlocks * sizeof(uint32);
+    for (int blockI = 0; blockI < nrOfBlocks; blockI++)
+    {
+        uint32 blockSize;
+        memcpy(&blockSize, src + blockI * sizeof(uint32), sizeof(uint32));
+        blockOffsets[blockI + 1] = blockOffsets[blockI] + blockSize;
+    }
+    if (blockOffsets[nrOfBlocks] != srcSize)
+        throw gu_err("Encoded vertices are corrupt");
+
+    gu::parallel::forEach(nrOfBlocks, 4, [&] (int blockI) {
+        const int first = blockI * BLOCK_SIZE;
+        decodeBlock(
+            src + blockOffsets[blockI], src + blockOffsets[blockI + 1],
+            vertices + first * vertSize, min(BLOCK_SIZE, nrOfVertices - first), vertSize
+        );
+    });
+}
+
+std::vector<unsigned char> encodeIndices(const std::vector<GLuint> &indices)
+{
+    std::vector<unsigned char> out;
+    out.reserve(indices.size() * 2);
+
+    GLuint previous = 0;
+    for (const GLuint index : indices)
+    {
+        const int32 delta = int32(index - previous);
+        writeVarInt(uint32(delta << 1) ^ uint32(delta >> 31), out);
+        previous = index;
+    }
+    return out;
+}
+
+void decodeIndices(const unsigned char *src, size_t srcSize, std::vector<GLuint> &indices, int nrOfIndices)
+{
+    indices.resize(nrOfIndices);
+    const unsigned char *end = src + srcSize;
+
+    GLuint previous = 0;
+    for (int i = 0; i < nrOfIndices; i++)
+    {
+        uint32 value = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            if (src == end || shift > 28)
+                throw gu_err("Encoded indices are corrupt");
+
+            const unsigned char byte = *src++;
+            value |= uint32(byte & 0x7f) << shift;
+            if (byte < 0x80)
+                break;
+        }
+        previous += (value >> 1) ^ -(value & 1);
+        indices[i] = previous;
+    }
+    if (src != end)
+        throw gu_err("Encoded indices are corrupt");
+}
+
+std::vector<unsigned char> encode(const Mesh &mesh)
+{
+    Writer writer;
+    writer.data.insert(writer.data.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    writer.write(VERSION);
+    writer.writeString(mesh.name);
+
+    writer.write<uint32>(mesh.attributes.nrOfAttributes());
+    for (int i = 0; i < mesh.attributes.nrOfAttributes(); i++)
+    {
+        const VertAttr &attr = mesh.attributes.get(i);
+        writer.writeString(attr.name);
+        writer.write<uint32>(attr.size);
+        writer.write<uint32>(attr.byteSize);
+        writer.write<uint32>(attr.type);
+        writer.write<uint8>(attr.normalized);
+    }
+    writer.write<uint32>(mesh.nrOfVertices());
+    writer.writeBytes(encodeVertices(mesh.vertexData.data(), mesh.nrOfVertices(), mesh.attributes.getVertSize()));
+
+    writer.write<uint32>(mesh.parts.size());
+    for (auto &part : mesh.parts)
+    {
+        writer.writeString(part.name);
+        writer.write<uint32>(part.mode);
+        writer.write<uint32>(part.indexType);
+        writer.write<int32>(part.baseVertex);
+        writer.write<uint32>(part.indices.size());
+        writer.writeBytes(encodeIndices(part.indices));
+    }
+    return writer.data;
+}
+
+SharedMesh decode(const unsigned char *data, size_t size)
+{
+    Reader reader { data, data + size };
+
+    if (memcmp(reader.skip(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0)
+        throw gu_err("Data is not an encoded mesh");
+
+    const uint32 version = reader.read<uint32>();
+    if (version != VERSION)
+        throw gu_err("Encoded mesh has unsupported version " + std::to_string(version));
+
+    const std::string name = reader.readString();
+
+    VertAttributes attributes;
+    const uint32 nrOfAttributes = reader.read<uint32>();
+    for (uint32 i = 0; i < nrOfAttributes; i++)
+    {
+        VertAttr attr { reader.readString() };
+        attr.size = reader.read<uint32>();
+        attr.byteSize = reader.read<uint32>();
+        attr.type = reader.read<uint32>();
+        attr.normalized = reader.read<uint8>();
+        attributes.add(attr);
+    }
+    const uint32 nrOfVertices = reader.read<uint32>();
+    if (attributes.getVertSize() == 0 && nrOfVertices > 0)
+        throw gu_err("Encoded mesh is corrupt");
+
+    auto mesh = std::make_shared<Mesh>(name, nrOfVertices, attributes);
+    {
+        const uint64 encodedSize = reader.read<uint64>();
+        decodeVertices(reader.skip(encodedSize), encodedSize, mesh->vertexData.data(), nrOfVertices, attributes.getVertSize());
+    }
+    const uint32 nrOfParts = reader.read<uint32>();
+    for (uint32 i = 0; i < nrOfParts; i++)
+    {
+        auto &part = mesh->parts.emplace_back();
+        part.name = reader.readString();
+        part.mode = reader.read<uint32>();
+        part.indexType = reader.read<uint32>();
+        part.baseVertex = reader.read<int32>();
+
+        const uint32 nrOfIndices = reader.read<uint32>();
+        const uint64 encodedSize = reader.read<uint64>();
+        decodeIndices(reader.skip(encodedSize), encodedSize, part.indices, nrOfIndices);
+    }
+    return mesh;
+}
+
+void toFile(const Mesh &mesh, const char *path)
+{
+    const auto data = encode(mesh);
+    fu::writeBinary(path, (const char *) data.data(), data.size());
+}
+
+SharedMesh fromFile(const char *path)
+{
+    const auto data = fu::readBinary(path);
+    return decode(data.data(), data.size());
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+#include "mesh.h"
+
+/**
+ * A lossless codec for storing Meshes on disk or in packs, that is fast to decode.
+ *
+ * Vertices are encoded in independent blocks of 256 vertices (decoded in parallel).
+ * Within a block, every byte of the vertex is stored as a separate stream: the difference with the same byte of the previous vertex,
+ * zigzag encoded, and packed in groups of 16 using 0, 2, 4 or 8 bits per byte. Decoding uses SSE2 when available.
+ *
+ * Indices are stored as the zigzag encoded difference with the previous index, as variable length integers.
+ * Vertex cache optimized indices (see MeshOptimizer) compress best.
+ *
+ * Only the name, vertices and the name, mode, index type, base vertex and indices of the parts are stored.
+ */
+namespace MeshCodec
+{
+
+std::vector<unsigned char> encodeVertices(const unsigned char *vertices, int nrOfVertices, int vertSize);
+
+/**
+ * Decodes 'nrOfVertices' vertices of 'vertSize' bytes into 'vertices'. Throws if 'src' is corrupt or too small.
+ */
+void decodeVertices(const unsigned char *src, size_t srcSize, unsigned char *vertices, int nrOfVertices, int vertSize);
+
+std::vector<unsigned char> encodeIndices(const std::vector<GLuint> &indices);
+
+/**
+ * Decodes 'nrOfIndices' indices into 'indices'. Throws if 'src' is corrupt or too small.
+ */
+void decodeIndices(const unsigned char *src, size_t srcSize, std::vector<GLuint> &indices, int nrOfIndices);
+
+std::vector<unsigned char> encode(const Mesh &mesh);
+
+/**
+ * Creates a Mesh from data created by encode(). The vertices are decoded directly into VertData::vertexData.
+ */
+SharedMesh decode(const unsigned char *data, size_t size);
+
+void toFile(const Mesh &mesh, const char *path);
+
+SharedMesh fromFile(const char *path);
+
+}
+
+#endif
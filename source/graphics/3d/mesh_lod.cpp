@@ -0,0 +1,555 @@
+
+#include "mesh_lod.h"
+
+#include "../camera/camera.h"
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+namespace MeshLOD
+{
+
+namespace
+{
+
+enum VertexKind : unsigned char
+{
+    MANIFOLD,   // can collapse onto any neighbour
+    BORDER,     // on an open edge, can only collapse along the border
+    SEAM,       // 2 vertices with the same position, can only collapse along the seam, together with its twin
+    LOCKED      // never collapses
+};
+
+const int NONE = -1, MULTIPLE = -2;
+
+// Weight of the planes that keep borders and seams in place, relative to the planes of triangles.
+const double EDGE_WEIGHT = 10.0;
+
+struct Quadric
+{
+    double a00 = 0, a11 = 0, a22 = 0, a10 = 0, a20 = 0, a21 = 0, b0 = 0, b1 = 0, b2 = 0, c = 0, w = 0;
+
+    void addPlane(const dvec3 &n, double d, double weight)
+    {
+        a00 += n.x * n.x * weight;
+        a11 += n.y * n.y * weight;
+        a22 += n.z * n.z * weight;
+        a10 += n.y * n.x * weight;
+        a20 += n.z * n.x * weight;
+        a21 += n.z * n.y * weight;
+        b0 += n.x * d * weight;
+        b1 += n.y * d * weight;
+        b2 += n.z * d * weight;
+        c += d * d * weight;
+        w += weight;
+    }
+
+    void operator+=(const Quadric &o)
+    {
+        a00 += o.a00; a11 += o.a11; a22 += o.a22;
+        a10 += o.a10; a20 += o.a20; a21 += o.a21;
+        b0 += o.b0; b1 += o.b1; b2 += o.b2;
+        c += o.c;
+        w += o.w;
+    }
+
+    // Weighted average of the squared distances from 'p' to the planes.
+    double error(const vec3 &p) const
+    {
+        const double
+            rx = a00 * p.x + a10 * p.y + a20 * p.z + b0,
+            ry = a10 * p.x + a11 * p.y + a21 * p.z + b1,
+            rz = a20 * p.x + a21 * p.y + a22 * p.z + b2;
+
+        const double e = rx * p.x + ry * p.y + rz * p.z + b0 * p.x + b1 * p.y + b2 * p.z + c;
+        return w == 0 ? 0 : std::abs(e) / w;
+    }
+};
+
+struct Collapse
+{
+    GLuint from, to;
+    float error;
+};
+
+struct Simplifier
+{
+    int nrOfVerts;
+    std::vector<vec3> positions;
+
+    // first vertex with the same position:
+    std::vector<GLuint> remap;
+    // circular lists of vertices with the same position:
+    std::vector<GLuint> wedges;
+
+    std::unordered_set<uint64> halfEdges;
+    std::vector<int> openOut, openIn;
+    std::vector<VertexKind> kinds;
+    std::vector<Quadric> quadrics;
+
+    Simplifier(const Mesh &mesh, int baseVertex, const std::vector<GLuint> &indices)
+    {
+        nrOfVerts = indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end()) + 1;
+
+        const int vertSize = mesh.attributes.getVertSize();
+        const int posOffset = mesh.attributes.getOffset(VertAttributes::POSITION);
+
+        positions.resize(nrOfVerts);
+        for (int v = 0; v < nrOfVerts; v++)
+            memcpy(&positions[v], &mesh.vertexData.at((baseVertex + v) * vertSize + posOffset), sizeof(vec3));
+
+        buildWedges(indices);
+        classifyVertices(indices);
+        buildQuadrics(indices);
+    }
+
+    void buildWedges(const std::vector<GLuint> &indices)
+    {
+        remap.resize(nrOfVerts);
+        wedges.resize(nrOfVerts);
+
+        std::vector<bool> used(nrOfVerts, false);
+        for (const GLuint v : indices)
+            used[v] = true;
+
+        size_t tableSize = 1;
+        while (tableSize < nrOfVerts * 2)
+            tableSize *= 2;
+        std::vector<int> table(tableSize, -1);
+
+        for (int v = 0; v < nrOfVerts; v++)
+        {
+            if (!used[v])
+            {
+                remap[v] = wedges[v] = v;
+                continue;
+            }
+            // FNV-1a
+            uint32 hash = 0x811c9dc5;
+            const auto *bytes = (const unsigned char *) &positions[v];
+            for (int i = 0; i < sizeof(vec3); i++)
+            {
+                hash ^= bytes[i];
+                hash *= 0x1000193;
+            }
+            size_t slot = hash & (tableSize - 1);
+            while (table[slot] != -1 && memcmp(&positions[table[slot]], &positions[v], sizeof(vec3)) != 0)
+                slot = (slot + 1) & (tableSize - 1);
+
+            if (table[slot] == -1)
+                table[slot] = v;
+
+            const GLuint first = table[slot];
+            remap[v] = first;
+            if (first == v)
+            {
+                wedges[v] = v;
+            }
+            else
+            {
+                wedges[v] = wedges[first];
+                wedges[first] = v;
+            }
+        }
+    }
+
+    void classifyVertices(const std::vector<GLuint> &indices)
+    {
+        halfEdges.reserve(indices.size());
+        for (int i = 0; i < indices.size(); i++)
+            halfEdges.insert(edgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]));
+
+        openOut.assign(nrOfVerts, NONE);
+        openIn.assign(nrOfVerts, NONE);
+
+        for (int i = 0; i < indices.size(); i++)
+        {
+            const GLuint a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+            if (halfEdges.count(edgeKey(b, a)))
+                continue;
+
+            openOut[a] = openOut[a] == NONE ? int(b) : MULTIPLE;
+            openIn[b] = openIn[b] == NONE ? int(a) : MULTIPLE;
+        }
+
+        kinds.assign(nrOfVerts, LOCKED);
+        for (int v = 0; v < nrOfVerts; v++)
+        {
+            if (remap[v] != v)
+                continue;
+
+            const GLuint twin = wedges[v];
+
+            if (twin == v)
+            {
+                if (openOut[v] == NONE && openIn[v] == NONE)
+                    kinds[v] = MANIFOLD;
+                else if (openOut[v] >= 0 && openIn[v] >= 0)
+                    kinds[v] = BORDER;
+            }
+            else if (wedges[twin] == v)
+            {
+                // The open edges of both vertices must follow the same seam:
+                if (openOut[v] >= 0 && openIn[v] >= 0 && openOut[twin] >= 0 && openIn[twin] >= 0
+                    && remap[openOut[v]] == remap[openIn[twin]] && remap[openIn[v]] == remap[openOut[twin]])
+                {
+                    kinds[v] = kinds[twin] = SEAM;
+                }
+            }
+        }
+    }
+
+    void buildQuadrics(const std::vector<GLuint> &indices)
+    {
+        quadrics.assign(nrOfVerts, Quadric());
+
+        for (int i = 0; i < indices.size(); i += 3)
+        {
+            const dvec3
+                p0 = positions[indices[i]],
+                p1 = positions[indices[i + 1]],
+                p2 = positions[indices[i + 2]];
+
+            dvec3 normal = cross(p1 - p0, p2 - p0);
+            const double area = length(normal);
+            if (area == 0)
+                continue;
+            normal /= area;
+
+            for (int k = 0; k < 3; k++)
+                quadrics[remap[indices[i + k]]].addPlane(normal, -dot(normal, p0), area);
+
+            // planes perpendicular to the triangle, through its border and seam edges:
+            for (int k = 0; k < 3; k++)
+            {
+                const GLuint a = indices[i + k], b = indices[i + (k + 1) % 3];
+                if (halfEdges.count(edgeKey(b, a)))
+                    continue;
+
+                const dvec3 pa = positions[a], edge = dvec3(positions[b]) - pa;
+                const double edgeLength = length(edge);
+                if (edgeLength == 0)
+                    continue;
+
+                const dvec3 edgeNormal = normalize(cross(edge, normal));
+                const double weight = edgeLength * edgeLength * EDGE_WEIGHT;
+
+                quadrics[remap[a]].addPlane(edgeNormal, -dot(edgeNormal, pa), weight);
+                quadrics[remap[b]].addPlane(edgeNormal, -dot(edgeNormal, pa), weight);
+            }
+        }
+    }
+
+    static uint64 edgeKey(GLuint a, GLuint b)
+    {
+        return (uint64(a) << 32) | b;
+    }
+
+    bool canCollapse(GLuint from, GLuint to) const
+    {
+        if (remap[from] == remap[to])
+            return false;
+
+        switch (kinds[remap[from]])
+        {
+            case MANIFOLD:
+                return true;
+            case BORDER:
+                return kinds[remap[to]] == BORDER && (openOut[from] == to || openIn[from] == to);
+            case SEAM:
+            {
+                if (kinds[remap[to]] != SEAM || (openOut[from] != to && openIn[from] != to))
+                    return false;
+                const int twinTo = twinTarget(from, to);
+                return twinTo >= 0 && remap[twinTo] == remap[to];
+            }
+            default:
+                return false;
+        }
+    }
+
+    // Returns the vertex that the twin of 'from' should collapse to, when 'from' collapses to 'to' along a seam.
+    int twinTarget(GLuint from, GLuint to) const
+    {
+        const GLuint twin = wedges[from];
+        return openOut[from] == to ? openIn[twin] : openOut[twin];
+    }
+
+    /**
+     * Returns true if moving the vertices at the position of 'from' to the position of 'to' would flip a triangle.
+     */
+    bool hasTriangleFlips(
+        GLuint from, GLuint to, const std::vector<GLuint> &indices,
+        const std::vector<int> &adjacencyOffsets, const std::vector<int> &adjacency
+    ) const
+    {
+        const vec3 &p0 = positions[from], &p1 = positions[to];
+
+        GLuint v = from;
+        do
+        {
+            for (int a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++)
+            {
+                const int triI = adjacency[a];
+                const GLuint *tri = &indices[triI * 3];
+                const int corner = tri[0] == v ? 0 : tri[1] == v ? 1 : 2;
+                const GLuint b = tri[(corner + 1) % 3], c = tri[(corner + 2) % 3];
+
+                // this triangle will be removed by the collapse:
+                if (remap[b] == remap[to] || remap[c] == remap[to])
+                    continue;
+
+                const vec3
+                    before = cross(positions[b] - p0, positions[c] - p0),
+                    after = cross(positions[b] - p1, positions[c] - p1);
+
+                if (dot(before, after) <= 0.0f)
+                    return true;
+            }
+            v = wedges[v];
+        }
+        while (v != from);
+
+        return false;
+    }
+
+    std::vector<GLuint> simplify(std::vector<GLuint> indices, int targetNrOfIndices, float maxError, float &resultError)
+    {
+        const double maxErrorSq = double(maxError) * maxError;
+        double resultErrorSq = 0;
+
+        std::vector<Collapse> collapses;
+        std::vector<GLuint> collapseRemap(nrOfVerts);
+        std::vector<bool> collapseLocked(nrOfVerts);
+        std::vector<int> adjacencyOffsets, adjacency;
+
+        while (indices.size() > targetNrOfIndices)
+        {
+            collapses.clear();
+            for (int i = 0; i < indices.size(); i++)
+            {
+                const GLuint a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+
+                if (canCollapse(a, b))
+                    collapses.push_back({ a, b, float(quadrics[remap[a]].error(positions[b])) });
+                if (canCollapse(b, a))
+                    collapses.push_back({ b, a, float(quadrics[remap[b]].error(positions[a])) });
+            }
+            if (collapses.empty())
+                break;
+
+            std::sort(collapses.begin(), collapses.end(), [] (const Collapse &a, const Collapse &b) {
+                if (a.error != b.error)
+                    return a.error < b.error;
+                return a.from != b.from ? a.from < b.from : a.to < b.to;
+            });
+
+            // triangles around each vertex, for hasTriangleFlips():
+            adjacencyOffsets.assign(nrOfVerts + 1, 0);
+            adjacency.resize(indices.size());
+            for (const GLuint v : indices)
+                adjacencyOffsets[v + 1]++;
+            for (int v = 0; v < nrOfVerts; v++)
+                adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            {
+                std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+                for (int i = 0; i < indices.size(); i++)
+                    adjacency[fill[indices[i]]++] = i / 3;
+            }
+
+            for (int v = 0; v < nrOfVerts; v++)
+                collapseRemap[v] = v;
+            collapseLocked.assign(nrOfVerts, false);
+
+            const int trianglesToRemove = (int(indices.size()) - targetNrOfIndices) / 3;
+            int trianglesRemoved = 0, nrOfCollapses = 0;
+
+            for (const Collapse &collapse : collapses)
+            {
+                if (collapse.error > maxErrorSq)
+                    break;
+
+                const GLuint from = remap[collapse.from], to = remap[collapse.to];
+                if (collapseLocked[from] || collapseLocked[to])
+                    continue;
+
+                if (hasTriangleFlips(collapse.from, collapse.to, indices, adjacencyOffsets, adjacency))
+                    continue;
+
+                const VertexKind kind = kinds[from];
+                if (kind == SEAM)
+                    collapseRemap[wedges[collapse.from]] = twinTarget(collapse.from, collapse.to);
+                collapseRemap[collapse.from] = collapse.to;
+
+                quadrics[to] += quadrics[from];
+                collapseLocked[from] = collapseLocked[to] = true;
+
+                resultErrorSq = std::max<double>(resultErrorSq, collapse.error);
+                trianglesRemoved += kind == BORDER ? 1 : 2;
+                nrOfCollapses++;
+
+                if (trianglesRemoved >= trianglesToRemove)
+                    break;
+            }
+            if (nrOfCollapses == 0)
+                break;
+
+            // remove triangles that became degenerate:
+            int nrOfIndices = 0;
+            for (int i = 0; i < indices.size(); i += 3)
+            {
+                const GLuint
+                    a = collapseRemap[indices[i]],
+                    b = collapseRemap[indices[i + 1]],
+                    c = collapseRemap[indices[i + 2]];
+
+                if (a == b || b == c || a == c)
+                    continue;
+
+                indices[nrOfIndices++] = a;
+                indices[nrOfIndices++] = b;
+                indices[nrOfIndices++] = c;
+            }
+            indices.resize(nrOfIndices);
+
+            // keep following the borders and seams:
+            for (int v = 0; v < nrOfVerts; v++)
+            {
+                if (openOut[v] >= 0)
+                    openOut[v] = collapseRemap[openOut[v]];
+                if (openIn[v] >= 0)
+                    openIn[v] = collapseRemap[openIn[v]];
+            }
+        }
+        resultError = float(std::sqrt(resultErrorSq));
+        return indices;
+    }
+};
+
+void calculateBounds(const Mesh &mesh, Mesh::Part &part)
+{
+    if (part.indices.empty() || !mesh.attributes.contains(VertAttributes::POSITION))
+        return;
+
+    const int vertSize = mesh.attributes.getVertSize();
+    const int posOffset = mesh.attributes.getOffset(VertAttributes::POSITION);
+
+    auto position = [&] (GLuint index) {
+        vec3 p;
+        memcpy(&p, &mesh.vertexData.at((part.baseVertex + index) * vertSize + posOffset), sizeof(vec3));
+        return p;
+    };
+
+    vec3 min = position(part.indices[0]), max = min;
+    for (const GLuint index : part.indices)
+    {
+        const vec3 p = position(index);
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    part.boundsCenter = (min + max) * 0.5f;
+    part.boundsRadius = 0.0f;
+    for (const GLuint index : part.indices)
+        part.boundsRadius = glm::max(part.boundsRadius, length(position(index) - part.boundsCenter));
+}
+
+}
+
+std::vector<GLuint> simplify(const Mesh &mesh, const Mesh::Part &part, int targetNrOfIndices, float maxError, float *resultError)
+{
+    float error = 0.0f;
+    std::vector<GLuint> indices;
+
+    if (part.mode != GL_TRIANGLES || !mesh.attributes.contains(VertAttributes::POSITION))
+    {
+        indices = part.indices;
+    }
+    else
+    {
+        indices.assign(part.indices.begin(), part.indices.begin() + part.indices.size() / 3 * 3);
+        Simplifier simplifier(mesh, part.baseVertex, indices);
+        indices = simplifier.simplify(std::move(indices), targetNrOfIndices, maxError, error);
+    }
+    if (resultError)
+        *resultError = error;
+    return indices;
+}
+
+int generateLODs(Mesh &mesh, int partI, const Options &options)
+{
+    if (mesh.vertBuffer)
+    {
+        throw gu_err("Cannot generate LODs for " + mesh.name + " because it was already added to a VertBuffer");
+    }
+    calculateBounds(mesh, mesh.parts.at(partI));
+
+    if (mesh.parts[partI].mode != GL_TRIANGLES || !mesh.attributes.contains(VertAttributes::POSITION))
+        return 0;
+
+    const float maxError = options.maxRelativeError * mesh.parts[partI].boundsRadius;
+    float previousError = 0.0f;
+    int nrOfLODs = 0;
+
+    Mesh::Part lod = mesh.parts[partI];
+    lod.lods.clear();
+    lod.lodOf = partI;
+
+    while (nrOfLODs < options.maxNrOfLODs)
+    {
+        const int targetNrOfTriangles = int(lod.indices.size() / 3 * options.reduction);
+        if (targetNrOfTriangles < options.minNrOfTriangles)
+            break;
+
+        // Each LOD is simplified from the previous one, so errors add up:
+        float error;
+        auto indices = simplify(mesh, lod, targetNrOfTriangles * 3, maxError - previousError, &error);
+
+        if (indices.empty() || indices.size() > lod.indices.size() * 9 / 10)
+            break;
+
+        previousError += error;
+        lod.indices = std::move(indices);
+        lod.name = mesh.parts[partI].name + "_LOD" + std::to_string(++nrOfLODs);
+
+        mesh.parts[partI].lods.push_back({ int(mesh.parts.size()), previousError });
+        mesh.parts.push_back(lod);
+    }
+    return nrOfLODs;
+}
+
+int selectLOD(const Mesh &mesh, int partI, const mat4 &transform, const Camera &camera, float maxPixelError)
+{
+    const Mesh::Part &part = mesh.parts.at(partI);
+    if (part.lods.empty())
+        return partI;
+
+    const float scale = max(
+        length(vec3(transform[0])),
+        max(length(vec3(transform[1])), length(vec3(transform[2])))
+    );
+    const vec3 center = transform * vec4(part.boundsCenter, 1.0f);
+
+    // how many pixels 1 unit (in object space) covers on the screen, at the nearest point of the bounding sphere:
+    float pixelsPerUnit = camera.projection[1][1] * 0.5f * camera.viewportHeight * scale;
+
+    const bool bPerspective = camera.projection[3][3] == 0.0f;
+    if (bPerspective)
+    {
+        const float distance = max(length(center - camera.position) - part.boundsRadius * scale, camera.near_);
+        pixelsPerUnit /= distance;
+    }
+
+    int selected = partI;
+    for (auto &lod : part.lods)
+    {
+        if (lod.error * pixelsPerUnit > maxPixelError)
+            break;
+        selected = lod.partIndex;
+    }
+    return selected;
+}
+
+}
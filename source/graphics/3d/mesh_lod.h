@@ -0,0 +1,60 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include "mesh.h"
+
+class Camera;
+
+/**
+ * Level Of Detail generation and selection.
+ *
+ * LODs are generated with quadric error mesh simplification ("Surface Simplification Using Quadric Error Metrics", Garland & Heckbert, 1997).
+ * Only indices are generated: a LOD uses a subset of the vertices of the original part, so no vertices are added to the Mesh.
+ *
+ * Vertices on UV/normal seams (multiple vertices with the same position) and on borders only move along their seam or border,
+ * so seams stay closed and textures don't get distorted.
+ */
+namespace MeshLOD
+{
+
+struct Options
+{
+    // Maximum number of LODs generated per part.
+    int maxNrOfLODs = 4;
+
+    // Each LOD aims for this fraction of the triangles of the previous LOD.
+    float reduction = 0.5f;
+
+    // Maximum error of the coarsest LOD, relative to the radius of the part.
+    float maxRelativeError = 0.05f;
+
+    // No LODs with less triangles than this are generated.
+    int minNrOfTriangles = 16;
+};
+
+/**
+ * Returns simplified indices for a GL_TRIANGLES part, aiming for 'targetNrOfIndices' indices, without exceeding 'maxError' (object space).
+ * The returned indices use the same Part::baseVertex as 'part'.
+ * The error of the result is written to 'resultError' if it is not null.
+ */
+std::vector<GLuint> simplify(const Mesh &mesh, const Mesh::Part &part, int targetNrOfIndices, float maxError, float *resultError = nullptr);
+
+/**
+ * Adds a chain of simplified parts to 'mesh', and registers them in Part::lods of part 'partI'.
+ * Also sets the bounding sphere of the part.
+ *
+ * Must be called before the Mesh is added to a VertBuffer, and after Mesh::splitPartsForIndexType().
+ * Returns the number of generated LODs.
+ */
+int generateLODs(Mesh &mesh, int partI, const Options &options = Options());
+
+/**
+ * Returns the index of the part that should be rendered instead of part 'partI', when rendered with 'transform' by 'camera':
+ * the coarsest LOD of which the error, projected on the screen, is at most 'maxPixelError' pixels.
+ * Returns 'partI' if no LOD is good enough, or if the part has no LODs.
+ */
+int selectLOD(const Mesh &mesh, int partI, const mat4 &transform, const Camera &camera, float maxPixelError = 1.0f);
+
+}
+
+#endif
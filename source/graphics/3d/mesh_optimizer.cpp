@@ -0,0 +1,452 @@
+
+#include "mesh_optimizer.h"
+
+#include "../../math/math_utils.h"
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace MeshOptimizer
+{
+
+namespace
+{
+
+void ensureNotInVertBuffer(const Mesh &mesh)
+{
+    if (mesh.vertBuffer)
+    {
+        throw gu_err("Cannot optimize " + mesh.name + " because it was already added to a VertBuffer");
+    }
+}
+
+int nrOfPartVertices(const Mesh::Part &part)
+{
+    return part.indices.empty() ? 0 : *std::max_element(part.indices.begin(), part.indices.end()) + 1;
+}
+
+int64 nrOfIndexableVertices(GLenum indexType)
+{
+    switch (indexType)
+    {
+        case GL_UNSIGNED_BYTE:
+            return int64(1) << 8;
+        case GL_UNSIGNED_SHORT:
+            return int64(1) << 16;
+        default:
+            return int64(1) << 32;
+    }
+}
+
+/**
+ * Simulates a FIFO post-transform vertex cache using timestamps:
+ * a vertex is in the cache if less than 'cacheSize' misses happened since it was added.
+ */
+class FifoCache
+{
+  public:
+    FifoCache(int nrOfVertices, int cacheSize) :
+        timestamps(nrOfVertices, 0),
+        cacheSize(cacheSize),
+        time(cacheSize + 1)
+    {}
+
+    // Returns true if the vertex was not in the cache.
+    bool use(GLuint vertI)
+    {
+        if (time - timestamps[vertI] > cacheSize)
+        {
+            timestamps[vertI] = time++;
+            return true;
+        }
+        return false;
+    }
+
+    int useTriangle(const GLuint *triangle)
+    {
+        return int(use(triangle[0])) + int(use(triangle[1])) + int(use(triangle[2]));
+    }
+
+    void flush()
+    {
+        time += cacheSize + 1;
+    }
+
+  private:
+    std::vector<int> timestamps;
+    int cacheSize, time;
+};
+
+void countCacheMisses(const Mesh::Part &part, int cacheSize, int &misses, int &triangles)
+{
+    if (part.mode != GL_TRIANGLES || part.indices.size() < 3)
+        return;
+
+    const int nrOfTriangles = part.indices.size() / 3;
+    FifoCache cache(nrOfPartVertices(part), cacheSize);
+
+    for (int triI = 0; triI < nrOfTriangles; triI++)
+        misses += cache.useTriangle(&part.indices[triI * 3]);
+
+    triangles += nrOfTriangles;
+}
+
+float calculateMeshACMR(const Mesh &mesh, int cacheSize)
+{
+    int misses = 0, triangles = 0;
+    for (auto &part : mesh.parts)
+        countCacheMisses(part, cacheSize, misses, triangles);
+
+    return triangles == 0 ? 0.0f : float(misses) / float(triangles);
+}
+
+// FNV-1a
+size_t hashVertex(const unsigned char *bytes, int size)
+{
+    uint32 hash = 0x811c9dc5;
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x1000193;
+    }
+    return hash;
+}
+
+}
+
+float calculateACMR(const Mesh::Part &part, int cacheSize)
+{
+    int misses = 0, triangles = 0;
+    countCacheMisses(part, cacheSize, misses, triangles);
+    return triangles == 0 ? 0.0f : float(misses) / float(triangles);
+}
+
+int weldVertices(Mesh &mesh)
+{
+    ensureNotInVertBuffer(mesh);
+
+    const int vertSize = mesh.attributes.getVertSize();
+    const int nrOfVerticesBefore = mesh.nrOfVertices();
+
+    // open addressing hash table, containing vertex indices:
+    std::vector<int> table;
+
+    for (auto &part : mesh.parts)
+    {
+        if (part.indices.empty())
+            continue;
+
+        size_t tableSize = 1;
+        while (tableSize < part.indices.size() * 2)
+            tableSize *= 2;
+        table.assign(tableSize, -1);
+
+        for (GLuint &index : part.indices)
+        {
+            const int vertI = part.baseVertex + index;
+            const unsigned char *vertex = &mesh.vertexData[vertI * vertSize];
+
+            size_t slot = hashVertex(vertex, vertSize) & (tableSize - 1);
+            while (true)
+            {
+                const int other = table[slot];
+                if (other == -1)
+                {
+                    table[slot] = vertI;
+                    break;
+                }
+                if (other == vertI || memcmp(&mesh.vertexData[other * vertSize], vertex, vertSize) == 0)
+                    break;
+
+                slot = (slot + 1) & (tableSize - 1);
+            }
+            index = table[slot] - part.baseVertex;
+        }
+    }
+    mesh.removeUnusedVertices();
+    return nrOfVerticesBefore - mesh.nrOfVertices();
+}
+
+void optimizeVertexCache(Mesh::Part &part, int cacheSize)
+{
+    if (part.mode != GL_TRIANGLES || part.indices.size() < 3)
+        return;
+
+    const int nrOfTriangles = part.indices.size() / 3;
+    const int nrOfVerts = nrOfPartVertices(part);
+    const std::vector<GLuint> &indices = part.indices;
+
+    // triangles adjacent to each vertex:
+    std::vector<int> adjacencyOffsets(nrOfVerts + 1, 0), adjacency(nrOfTriangles * 3);
+    for (int i = 0; i < nrOfTriangles * 3; i++)
+        adjacencyOffsets[indices[i] + 1]++;
+    for (int v = 0; v < nrOfVerts; v++)
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    {
+        std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (int i = 0; i < nrOfTriangles * 3; i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> liveTriangles(nrOfVerts), cacheTime(nrOfVerts, 0);
+    for (int v = 0; v < nrOfVerts; v++)
+        liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+
+    std::vector<bool> emitted(nrOfTriangles, false);
+    std::vector<GLuint> deadEnds, candidates, output;
+    output.reserve(indices.size());
+
+    int fanningVertex = 0, time = cacheSize + 1, cursor = 0;
+
+    while (fanningVertex >= 0)
+    {
+        candidates.clear();
+
+        for (int a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; a++)
+        {
+            const int triI = adjacency[a];
+            if (emitted[triI])
+                continue;
+
+            for (int i = 0; i < 3; i++)
+            {
+                const GLuint v = indices[triI * 3 + i];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[triI] = true;
+        }
+
+        // pick the candidate that will (probably) still be in the cache after fanning it:
+        int next = -1, bestPriority = -1;
+        for (const GLuint v : candidates)
+        {
+            if (liveTriangles[v] <= 0)
+                continue;
+
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = time - cacheTime[v];
+
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        // dead end, try recently used vertices first:
+        while (next == -1 && !deadEnds.empty())
+        {
+            const GLuint v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                next = v;
+        }
+        for (; next == -1 && cursor < nrOfVerts; cursor++)
+            if (liveTriangles[cursor] > 0)
+                next = cursor;
+
+        fanningVertex = next;
+    }
+    // incomplete triangle at the end (if any):
+    output.insert(output.end(), indices.begin() + nrOfTriangles * 3, indices.end());
+
+    part.indices = std::move(output);
+}
+
+void optimizeOverdraw(const Mesh &mesh, Mesh::Part &part, float threshold, int cacheSize)
+{
+    if (part.mode != GL_TRIANGLES || part.indices.size() < 3 || !mesh.attributes.contains(VertAttributes::POSITION))
+        return;
+
+    const int posOffset = mesh.attributes.getOffset(VertAttributes::POSITION);
+    const int vertSize = mesh.attributes.getVertSize();
+    const int nrOfTriangles = part.indices.size() / 3;
+    const GLuint *indices = part.indices.data();
+
+    FifoCache cache(nrOfPartVertices(part), cacheSize);
+
+    // Hard boundaries: triangles where the cache is cold (all 3 vertices miss), usually where Tipsify hit a dead end.
+    // The first cluster always starts at 0, also when the first triangle is degenerate and has less than 3 misses.
+    std::vector<int> hardClusters = { 0 };
+    for (int triI = 0; triI < nrOfTriangles; triI++)
+        if (cache.useTriangle(&indices[triI * 3]) == 3 && triI != 0)
+            hardClusters.push_back(triI);
+    hardClusters.push_back(nrOfTriangles);
+
+    // Soft boundaries: split a hard cluster as soon as the ACMR of the new cluster would be within the threshold.
+    std::vector<int> clusters;
+    for (int hardI = 0; hardI + 1 < hardClusters.size(); hardI++)
+    {
+        const int begin = hardClusters[hardI], end = hardClusters[hardI + 1];
+
+        cache.flush();
+        int clusterMisses = 0;
+        for (int triI = begin; triI < end; triI++)
+            clusterMisses += cache.useTriangle(&indices[triI * 3]);
+
+        const float maxACMR = float(clusterMisses) / float(end - begin) * threshold;
+
+        cache.flush();
+        int softBegin = begin, softMisses = 0;
+        clusters.push_back(begin);
+
+        for (int triI = begin; triI < end; triI++)
+        {
+            softMisses += cache.useTriangle(&indices[triI * 3]);
+
+            if (triI + 1 < end && float(softMisses) / float(triI + 1 - softBegin) <= maxACMR)
+            {
+                softBegin = triI + 1;
+                softMisses = 0;
+                clusters.push_back(softBegin);
+                cache.flush();
+            }
+        }
+    }
+    const int nrOfClusters = clusters.size();
+    clusters.push_back(nrOfTriangles);
+
+    // Area weighted centroid and normal of each cluster:
+    std::vector<vec3> centroids(nrOfClusters, vec3(0.0f)), normals(nrOfClusters, vec3(0.0f));
+    std::vector<float> areas(nrOfClusters, 0.0f);
+
+    vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+
+    for (int clusterI = 0; clusterI < nrOfClusters; clusterI++)
+    {
+        for (int triI = clusters[clusterI]; triI < clusters[clusterI + 1]; triI++)
+        {
+            const vec3
+                &p0 = *((const vec3 *) &mesh.vertexData[(part.baseVertex + indices[triI * 3]) * vertSize + posOffset]),
+                &p1 = *((const vec3 *) &mesh.vertexData[(part.baseVertex + indices[triI * 3 + 1]) * vertSize + posOffset]),
+                &p2 = *((const vec3 *) &mesh.vertexData[(part.baseVertex + indices[triI * 3 + 2]) * vertSize + posOffset]);
+
+            const vec3 normal = cross(p1 - p0, p2 - p0);
+            const float area = length(normal);
+
+            centroids[clusterI] += (p0 + p1 + p2) * (area / 3.0f);
+            normals[clusterI] += normal;
+            areas[clusterI] += area;
+        }
+        meshCentroid += centroids[clusterI];
+        meshArea += areas[clusterI];
+
+        if (areas[clusterI] > 0.0f)
+            centroids[clusterI] /= areas[clusterI];
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Clusters that face away from the center of the mesh are drawn first, they are more likely to occlude other clusters.
+    std::vector<float> sortKeys(nrOfClusters, 0.0f);
+    for (int clusterI = 0; clusterI < nrOfClusters; clusterI++)
+    {
+        const float normalLength = length(normals[clusterI]);
+        if (normalLength > 0.0f)
+            sortKeys[clusterI] = dot(centroids[clusterI] - meshCentroid, normals[clusterI] / normalLength);
+    }
+    std::vector<int> order(nrOfClusters);
+    for (int clusterI = 0; clusterI < nrOfClusters; clusterI++)
+        order[clusterI] = clusterI;
+
+    std::stable_sort(order.begin(), order.end(), [&] (int a, int b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    std::vector<GLuint> output;
+    output.reserve(part.indices.size());
+    for (const int clusterI : order)
+        output.insert(output.end(), indices + clusters[clusterI] * 3, indices + clusters[clusterI + 1] * 3);
+
+    // incomplete triangle at the end (if any):
+    output.insert(output.end(), part.indices.begin() + nrOfTriangles * 3, part.indices.end());
+
+    if (output.size() != part.indices.size())
+        throw gu_err("Overdraw optimization changed the number of indices of part '" + part.name + "' of " + mesh.name);
+
+    part.indices = std::move(output);
+}
+
+void optimizeVertexFetch(Mesh &mesh)
+{
+    ensureNotInVertBuffer(mesh);
+
+    const int vertSize = mesh.attributes.getVertSize();
+    const int nrOfVerts = mesh.nrOfVertices();
+
+    std::vector<int> newVertI(nrOfVerts, -1);
+    int nrOfUsedVerts = 0;
+
+    for (const auto &part : mesh.parts)
+        for (const GLuint index : part.indices)
+            if (newVertI.at(part.baseVertex + index) == -1)
+                newVertI[part.baseVertex + index] = nrOfUsedVerts++;
+
+    std::vector<unsigned char> newVertexData(nrOfUsedVerts * vertSize);
+    for (int vertI = 0; vertI < nrOfVerts; vertI++)
+        if (newVertI[vertI] != -1)
+            memcpy(&newVertexData[newVertI[vertI] * vertSize], &mesh.vertexData[vertI * vertSize], vertSize);
+
+    mesh.vertexData = std::move(newVertexData);
+
+    for (auto &part : mesh.parts)
+    {
+        if (part.indices.empty())
+        {
+            part.baseVertex = 0;
+            continue;
+        }
+        GLuint minIndex = -1, maxIndex = 0;
+        for (GLuint &index : part.indices)
+        {
+            index = newVertI[part.baseVertex + index];
+            minIndex = min(minIndex, index);
+            maxIndex = max(maxIndex, index);
+        }
+        if (int64(maxIndex - minIndex) >= nrOfIndexableVertices(part.indexType))
+        {
+            throw gu_err("After reordering vertices, part '" + part.name + "' of " + mesh.name + " uses too many vertices for its index type. Parts share too many vertices.");
+        }
+        for (GLuint &index : part.indices)
+            index -= minIndex;
+
+        part.baseVertex = minIndex;
+    }
+}
+
+Report optimize(Mesh &mesh, const Options &options)
+{
+    ensureNotInVertBuffer(mesh);
+
+    Report report;
+    report.nrOfVerticesBefore = mesh.nrOfVertices();
+    report.acmrBefore = calculateMeshACMR(mesh, options.cacheSize);
+
+    if (options.weldVertices)
+        weldVertices(mesh);
+
+    for (auto &part : mesh.parts)
+    {
+        if (options.optimizeVertexCache)
+            optimizeVertexCache(part, options.cacheSize);
+        if (options.optimizeOverdraw)
+            optimizeOverdraw(mesh, part, options.overdrawThreshold, options.cacheSize);
+    }
+
+    if (options.optimizeVertexFetch)
+        optimizeVertexFetch(mesh);
+
+    report.nrOfVerticesAfter = mesh.nrOfVertices();
+    report.acmrAfter = calculateMeshACMR(mesh, options.cacheSize);
+    return report;
+}
+
+}
@@ -0,0 +1,73 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "mesh.h"
+
+/**
+ * CPU-only, deterministic optimizations for Meshes that are not yet added to a VertBuffer.
+ *
+ * Only GL_TRIANGLES parts are reordered, other parts are left as they are.
+ */
+namespace MeshOptimizer
+{
+
+struct Options
+{
+    bool
+        weldVertices = true,
+        optimizeVertexCache = true,
+        optimizeOverdraw = true,
+        optimizeVertexFetch = true;
+
+    // Size of the simulated post-transform vertex cache (FIFO).
+    int cacheSize = 16;
+
+    // How much worse (ACMR) the vertex cache may get in favour of less overdraw. 1.05 = 5% worse.
+    float overdrawThreshold = 1.05f;
+};
+
+struct Report
+{
+    // Average Cache Miss Ratio: vertex shader invocations per triangle. Lower is better, the minimum is ~0.5.
+    float acmrBefore = 0.0f, acmrAfter = 0.0f;
+    int nrOfVerticesBefore = 0, nrOfVerticesAfter = 0;
+};
+
+/**
+ * Runs the steps enabled in 'options' in this order: weld, vertex cache, overdraw, vertex fetch.
+ */
+Report optimize(Mesh &mesh, const Options &options = Options());
+
+/**
+ * Returns the Average Cache Miss Ratio of a GL_TRIANGLES part, simulated with a FIFO cache of 'cacheSize' vertices.
+ */
+float calculateACMR(const Mesh::Part &part, int cacheSize = 16);
+
+/**
+ * Merges vertices that have exactly the same bytes and are used by the same part.
+ * Returns the number of removed vertices.
+ */
+int weldVertices(Mesh &mesh);
+
+/**
+ * Reorders the triangles of the part for post-transform vertex cache locality.
+ * Implements Tipsify: "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab & Barczak, 2007).
+ */
+void optimizeVertexCache(Mesh::Part &part, int cacheSize = 16);
+
+/**
+ * Splits the (vertex cache optimized) triangles of the part into clusters and sorts the clusters so that outward facing
+ * clusters are drawn first, which reduces overdraw. Uses the POSITION attribute of 'mesh'.
+ * The ACMR of the part gets at most 'threshold' times worse.
+ */
+void optimizeOverdraw(const Mesh &mesh, Mesh::Part &part, float threshold = 1.05f, int cacheSize = 16);
+
+/**
+ * Reorders the vertices of the mesh in the order they are first used by the parts, and removes unused vertices.
+ * Each part is rebased to the first vertex it uses. Throws if parts share so many vertices that a part no longer fits its Part::indexType.
+ */
+void optimizeVertexFetch(Mesh &mesh);
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+
+#include "meshlets.h"
+
+#include "../camera/camera.h"
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace Meshlets
+{
+
+namespace
+{
+
+void calculateBounds(
+    Mesh::Part::Meshlet &meshlet, const std::vector<vec3> &positions, const std::vector<GLuint> &vertices,
+    const GLuint *indices, int nrOfIndices
+)
+{
+    vec3 min = positions[vertices[0]], max = min;
+    for (const GLuint v : vertices)
+    {
+        min = glm::min(min, positions[v]);
+        max = glm::max(max, positions[v]);
+    }
+    meshlet.center = (min + max) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (const GLuint v : vertices)
+        meshlet.radius = glm::max(meshlet.radius, length(positions[v] - meshlet.center));
+
+    // normal cone:
+    std::vector<vec3> normals;
+    normals.reserve(nrOfIndices / 3);
+    vec3 axis(0.0f);
+    for (int i = 0; i + 2 < nrOfIndices; i += 3)
+    {
+        const vec3 &p0 = positions[indices[i]], &p1 = positions[indices[i + 1]], &p2 = positions[indices[i + 2]];
+        const vec3 normal = cross(p1 - p0, p2 - p0);
+        const float area = length(normal);
+        if (area == 0.0f)
+            continue;
+        normals.push_back(normal / area);
+        axis += normals.back();
+    }
+    meshlet.coneAxis = vec3(0.0f);
+    meshlet.coneCutoff = 1.0f;
+
+    const float axisLength = length(axis);
+    if (axisLength == 0.0f)
+        return;
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (const vec3 &normal : normals)
+        minDot = glm::min(minDot, dot(normal, axis));
+
+    // the cone is wider than a half sphere, it can never be culled:
+    if (minDot <= 0.0f)
+        return;
+
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = sqrt(1.0f - minDot * minDot);
+}
+
+}
+
+void build(Mesh &mesh, int partI, int maxVertices, int maxTriangles)
+{
+    if (mesh.vertBuffer)
+    {
+        throw gu_err("Cannot build meshlets for " + mesh.name + " because it was already added to a VertBuffer");
+    }
+    if (maxVertices < 3 || maxTriangles < 1)
+    {
+        throw gu_err("A meshlet needs room for at least 3 vertices and 1 triangle");
+    }
+    Mesh::Part &part = mesh.parts.at(partI);
+    part.meshlets.clear();
+
+    if (part.mode != GL_TRIANGLES || part.indices.size() < 3 || !mesh.attributes.contains(VertAttributes::POSITION))
+        return;
+
+    const int nrOfTriangles = part.indices.size() / 3;
+    const int nrOfVerts = *std::max_element(part.indices.begin(), part.indices.end()) + 1;
+    const GLuint *indices = part.indices.data();
+
+    const int vertSize = mesh.attributes.getVertSize();
+    const int posOffset = mesh.attributes.getOffset(VertAttributes::POSITION);
+
+    std::vector<vec3> positions(nrOfVerts);
+    for (int v = 0; v < nrOfVerts; v++)
+        memcpy(&positions[v], &mesh.vertexData.at((part.baseVertex + v) * vertSize + posOffset), sizeof(vec3));
+
+    std::vector<vec3> centroids(nrOfTriangles);
+    for (int triI = 0; triI < nrOfTriangles; triI++)
+        centroids[triI] = (positions[indices[triI * 3]] + positions[indices[triI * 3 + 1]] + positions[indices[triI * 3 + 2]]) / 3.0f;
+
+    // triangles around each vertex:
+    std::vector<int> adjacencyOffsets(nrOfVerts + 1, 0), adjacency(nrOfTriangles * 3);
+    for (int i = 0; i < nrOfTriangles * 3; i++)
+        adjacencyOffsets[indices[i] + 1]++;
+    for (int v = 0; v < nrOfVerts; v++)
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    {
+        std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (int i = 0; i < nrOfTriangles * 3; i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<bool> emitted(nrOfTriangles, false);
+    std::vector<int> meshletOfVertex(nrOfVerts, -1), candidates;
+    std::vector<GLuint> output, meshletVertices;
+    output.reserve(part.indices.size());
+
+    int nrOfEmitted = 0, cursor = 0, nextSeed = -1;
+
+    while (nrOfEmitted < nrOfTriangles)
+    {
+        const int meshletI = part.meshlets.size();
+        auto &meshlet = part.meshlets.emplace_back();
+        meshlet.firstIndex = output.size();
+
+        meshletVertices.clear();
+        candidates.clear();
+        int nrOfMeshletTriangles = 0;
+        vec3 centroidSum(0.0f);
+
+        int triI = nextSeed;
+        if (triI < 0 || emitted[triI])
+        {
+            while (emitted[cursor])
+                cursor++;
+            triI = cursor;
+        }
+        nextSeed = -1;
+
+        while (true)
+        {
+            emitted[triI] = true;
+            nrOfEmitted++;
+            nrOfMeshletTriangles++;
+            centroidSum += centroids[triI];
+
+            for (int i = 0; i < 3; i++)
+            {
+                const GLuint v = indices[triI * 3 + i];
+                output.push_back(v);
+
+                if (meshletOfVertex[v] == meshletI)
+                    continue;
+
+                meshletOfVertex[v] = meshletI;
+                meshletVertices.push_back(v);
+                for (int a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++)
+                    if (!emitted[adjacency[a]])
+                        candidates.push_back(adjacency[a]);
+            }
+
+            // Next: the neighbouring triangle that adds the least vertices, and is closest to the center of the meshlet.
+            const vec3 center = centroidSum / float(nrOfMeshletTriangles);
+            int best = -1, bestNewVertices = 4;
+            float bestDistance = std::numeric_limits<float>::max();
+            int nrOfCandidates = 0;
+
+            for (const int candidate : candidates)
+            {
+                if (emitted[candidate])
+                    continue;
+                candidates[nrOfCandidates++] = candidate;
+
+                int newVertices = 0;
+                for (int i = 0; i < 3; i++)
+                    newVertices += meshletOfVertex[indices[candidate * 3 + i]] != meshletI;
+
+                const vec3 diff = centroids[candidate] - center;
+                const float distance = dot(diff, diff);
+
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance))
+                {
+                    best = candidate;
+                    bestNewVertices = newVertices;
+                    bestDistance = distance;
+                }
+            }
+            candidates.resize(nrOfCandidates);
+
+            if (best < 0)
+                break;
+
+            if (nrOfMeshletTriangles == maxTriangles || meshletVertices.size() + bestNewVertices > maxVertices)
+            {
+                nextSeed = best;
+                break;
+            }
+            triI = best;
+        }
+        meshlet.nrOfIndices = output.size() - meshlet.firstIndex;
+        calculateBounds(meshlet, positions, meshletVertices, &output[meshlet.firstIndex], meshlet.nrOfIndices);
+    }
+    // incomplete triangle at the end (if any), not part of a meshlet:
+    output.insert(output.end(), part.indices.begin() + nrOfTriangles * 3, part.indices.end());
+
+    part.indices = std::move(output);
+}
+
+bool isBackFacing(const Mesh::Part::Meshlet &meshlet, const vec3 &viewer)
+{
+    if (meshlet.coneCutoff >= 1.0f)
+        return false;
+
+    const vec3 toCenter = meshlet.center - viewer;
+    return dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * length(toCenter) + meshlet.radius;
+}
+
+void cull(const Mesh &mesh, int partI, const mat4 &transform, const Camera &camera, std::vector<Mesh::IndexRange> &visibleRanges)
+{
+    visibleRanges.clear();
+    const Mesh::Part &part = mesh.parts.at(partI);
+
+    if (part.meshlets.empty())
+    {
+        visibleRanges.push_back({ 0, part.getNumIndicesToRender() });
+        return;
+    }
+
+    // Frustum planes in object space (Gribb & Hartmann), so the meshlet bounds don't have to be transformed:
+    const mat4 objectToClip = camera.combined * transform;
+    const vec4 row3(objectToClip[0][3], objectToClip[1][3], objectToClip[2][3], objectToClip[3][3]);
+    vec4 planes[6];
+    for (int i = 0; i < 3; i++)
+    {
+        const vec4 row(objectToClip[0][i], objectToClip[1][i], objectToClip[2][i], objectToClip[3][i]);
+        planes[i * 2] = row3 + row;
+        planes[i * 2 + 1] = row3 - row;
+    }
+    for (vec4 &plane : planes)
+        plane /= length(vec3(plane));
+
+    const vec3 viewer = inverse(transform) * vec4(camera.position, 1.0f);
+
+    for (const auto &meshlet : part.meshlets)
+    {
+        bool bVisible = !isBackFacing(meshlet, viewer);
+        for (int i = 0; i < 6 && bVisible; i++)
+            bVisible = dot(vec3(planes[i]), meshlet.center) + planes[i].w >= -meshlet.radius;
+
+        if (!bVisible)
+            continue;
+
+        if (!visibleRanges.empty() && visibleRanges.back().first + visibleRanges.back().count == meshlet.firstIndex)
+            visibleRanges.back().count += meshlet.nrOfIndices;
+        else
+            visibleRanges.push_back({ meshlet.firstIndex, meshlet.nrOfIndices });
+    }
+}
+
+}
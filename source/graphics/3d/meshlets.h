@@ -0,0 +1,44 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include "mesh.h"
+
+class Camera;
+
+/**
+ * Splits parts into meshlets: small clusters of neighbouring triangles, that can be culled on the CPU before rendering.
+ * Culling invisible and back facing meshlets reduces vertex work for dense meshes, without mesh shaders.
+ *
+ * Usage:
+ *  Meshlets::build(*mesh, partI);          // once, after other optimizations (they would change the order of the indices)
+ *  ...
+ *  Meshlets::cull(*mesh, partI, transform, camera, visibleRanges);
+ *  mesh->renderRanges(visibleRanges, partI);
+ */
+namespace Meshlets
+{
+
+/**
+ * Reorders the triangles of a GL_TRIANGLES part into meshlets of at most 'maxVertices' vertices and 'maxTriangles' triangles,
+ * and stores them in Part::meshlets.
+ * Must be called before the Mesh is added to a VertBuffer.
+ */
+void build(Mesh &mesh, int partI, int maxVertices = 64, int maxTriangles = 124);
+
+/**
+ * Returns whether all triangles of the meshlet face away from 'viewer' (all in object space).
+ */
+bool isBackFacing(const Mesh::Part::Meshlet &meshlet, const vec3 &viewer);
+
+/**
+ * Fills 'visibleRanges' with the index ranges of the meshlets of part 'partI' that are inside the view frustum of 'camera'
+ * (using Camera::combined) and that are not back facing, when the mesh is rendered with 'transform'.
+ * Ranges of neighbouring visible meshlets are merged.
+ *
+ * If the part has no meshlets, 'visibleRanges' will contain the whole part.
+ */
+void cull(const Mesh &mesh, int partI, const mat4 &transform, const Camera &camera, std::vector<Mesh::IndexRange> &visibleRanges);
+
+}
+
+#endif
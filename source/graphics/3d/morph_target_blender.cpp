@@ -0,0 +1,186 @@
+
+#include "morph_target_blender.h"
+#include "vert_buffer.h"
+
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// Number of vertices that are accumulated at once:
+constexpr int MORPH_BLOCK_SIZE = 256;
+
+// accumulator[i] += deltas[i] * weight
+void addScaledDeltas(float *accumulator, const float *deltas, float weight, int nrOfFloats)
+{
+    int i = 0;
+
+    #ifdef __SSE2__
+    const __m128 weights = _mm_set1_ps(weight);
+    for (; i + 4 <= nrOfFloats; i += 4)
+        _mm_storeu_ps(accumulator + i, _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_mul_ps(_mm_loadu_ps(deltas + i), weights)));
+    #endif
+
+    for (; i < nrOfFloats; i++)
+        accumulator[i] += deltas[i] * weight;
+}
+
+}
+
+MorphTargetBlender::MorphTargetBlender(SharedMesh mesh) :
+    weights(mesh->morphWeights),
+    mesh(mesh),
+    unmorphedVertexData(mesh->vertexData),
+    targetRanges(mesh->morphTargets.size()),
+    appliedWeights(mesh->morphTargets.size(), 0.0f)
+{
+    weights.resize(mesh->morphTargets.size(), 0.0f);
+
+    const VertAttributes &attrs = mesh->attributes;
+    const int nrOfVertices = mesh->nrOfVertices();
+
+    for (int targetI = 0; targetI < mesh->morphTargets.size(); targetI++)
+    {
+        VertexRange &range = targetRanges[targetI];
+        int end = 0;
+        range.first = INT_MAX;
+
+        for (auto &stream : mesh->morphTargets[targetI].streams)
+        {
+            if (stream.deltas.empty())
+                continue;
+
+            const VertAttr *attr = nullptr;
+            for (int i = 0; i < attrs.nrOfAttributes(); i++)
+                if (attrs.get(i).name == stream.attributeName)
+                    attr = &attrs.get(i);
+
+            if (!attr || attr->type != GL_FLOAT || attr->size < 3)
+                throw gu_err("Cannot morph attribute " + stream.attributeName + " of " + mesh->name + ", it must be 3 or 4 floats");
+
+            const int lastVertex = stream.vertexOf(stream.deltas.size() - 1);
+            if (stream.vertexOf(0) < 0 || lastVertex >= nrOfVertices)
+                throw gu_err("Morph target " + mesh->morphTargets[targetI].name + " of " + mesh->name + " has deltas for vertices that do not exist");
+
+            const int offset = attrs.getOffset(*attr);
+            auto attributeIt = std::find_if(attributes.begin(), attributes.end(), [&] (auto &a) { return a.offset == offset; });
+            if (attributeIt == attributes.end())
+            {
+                attributeIt = attributes.insert(attributes.end(), Attribute());
+                attributeIt->offset = offset;
+                attributeIt->bNormalize = attr->name != "POSITION";
+            }
+            attributeIt->streams.push_back({ targetI, &stream });
+
+            range.first = std::min(range.first, stream.vertexOf(0));
+            end = std::max(end, lastVertex + 1);
+        }
+        if (range.first == INT_MAX)
+            range.first = 0;
+        range.count = std::max(0, end - range.first);
+    }
+}
+
+MorphTargetBlender::VertexRange MorphTargetBlender::apply(bool reupload)
+{
+    if (weights.size() != appliedWeights.size())
+        throw gu_err(mesh->name + " has " + std::to_string(appliedWeights.size()) + " morph targets, got " + std::to_string(weights.size()) + " weights");
+
+    if (mesh->vertexData.size() != unmorphedVertexData.size())
+        throw gu_err("Cannot apply morph targets, the vertices of " + mesh->name + " were resized or disposed");
+
+    // only the vertices of targets whose weight changed have to be recalculated:
+    int begin = INT_MAX, end = 0;
+    for (int targetI = 0; targetI < weights.size(); targetI++)
+    {
+        const VertexRange &range = targetRanges[targetI];
+        if (weights[targetI] == appliedWeights[targetI] || range.count == 0)
+            continue;
+        begin = std::min(begin, range.first);
+        end = std::max(end, range.first + range.count);
+    }
+    appliedWeights = weights;
+
+    if (begin >= end)
+        return {};
+
+    const int vertSize = mesh->attributes.getVertSize();
+    const int nrOfBlocks = (end - begin + MORPH_BLOCK_SIZE - 1) / MORPH_BLOCK_SIZE;
+
+    gu::parallel::forEach(nrOfBlocks, 4, [&] (int blockI) {
+
+        const int blockBegin = begin + blockI * MORPH_BLOCK_SIZE;
+        const int blockEnd = std::min(end, blockBegin + MORPH_BLOCK_SIZE);
+        float accumulator[MORPH_BLOCK_SIZE * 3];
+
+        for (const Attribute &attribute : attributes)
+        {
+            for (int v = blockBegin; v < blockEnd; v++)
+                memcpy(&accumulator[(v - blockBegin) * 3], &unmorphedVertexData[size_t(v) * vertSize + attribute.offset], sizeof(float) * 3);
+
+            for (auto &[targetI, stream] : attribute.streams)
+            {
+                const float weight = weights[targetI];
+                if (weight == 0.0f)
+                    continue;
+
+                if (!stream->isSparse())
+                {
+                    const int from = std::max(blockBegin, stream->firstVertex);
+                    const int to = std::min(blockEnd, stream->firstVertex + int(stream->deltas.size()));
+                    if (from < to)
+                        addScaledDeltas(
+                            &accumulator[(from - blockBegin) * 3], (const float *) &stream->deltas[from - stream->firstVertex], weight, (to - from) * 3
+                        );
+                    continue;
+                }
+                auto it = std::lower_bound(stream->vertices.begin(), stream->vertices.end(), blockBegin);
+                for (; it != stream->vertices.end() && *it < blockEnd; ++it)
+                {
+                    const vec3 &delta = stream->deltas[it - stream->vertices.begin()];
+                    float *value = &accumulator[(*it - blockBegin) * 3];
+                    value[0] += delta.x * weight;
+                    value[1] += delta.y * weight;
+                    value[2] += delta.z * weight;
+                }
+            }
+
+            for (int v = blockBegin; v < blockEnd; v++)
+            {
+                float *value = &accumulator[(v - blockBegin) * 3];
+                if (attribute.bNormalize)
+                {
+                    const float length2 = value[0] * value[0] + value[1] * value[1] + value[2] * value[2];
+                    if (length2 > 0.0f)
+                    {
+                        const float scale = 1.0f / sqrt(length2);
+                        value[0] *= scale;
+                        value[1] *= scale;
+                        value[2] *= scale;
+                    }
+                }
+                memcpy(&mesh->vertexData[size_t(v) * vertSize + attribute.offset], value, sizeof(float) * 3);
+            }
+        }
+    });
+
+    const VertexRange changed { begin, end - begin };
+    if (reupload && mesh->vertBuffer && mesh->vertBuffer->isUploaded())
+        mesh->vertBuffer->reuploadVertices(mesh, changed.first, changed.count);
+
+    return changed;
+}
+
+const SharedMesh &MorphTargetBlender::getMesh() const
+{
+    return mesh;
+}
@@ -0,0 +1,66 @@
+#ifndef GU_MORPH_TARGET_BLENDER_H
+#define GU_MORPH_TARGET_BLENDER_H
+
+#include "mesh.h"
+
+/**
+ * Applies the weighted morph targets (Mesh::morphTargets) of a Mesh to its vertex data, on the CPU.
+ *
+ * A copy of the unmorphed vertices is kept, so weights can be changed at any time.
+ * Only the vertices affected by targets whose weight changed are recalculated, and only those are reuploaded to the VertBuffer.
+ * All targets are added in one pass over the vertices: blocks of vertices are accumulated in a small buffer (with SSE2 when available),
+ * and blocks are divided over the worker threads.
+ *
+ * The Mesh must keep its vertex data (do not use disposeOfflineData()), and the morphed attributes must be 3 or 4 floats.
+ *
+ * Usage:
+ *  MorphTargetBlender face(mesh);
+ *  face.weights[smileTarget] = 0.7f;
+ *  face.apply();
+ */
+class MorphTargetBlender
+{
+  public:
+
+    struct VertexRange
+    {
+        int first = 0, count = 0;
+    };
+
+    // Weight of every morph target, initialized with Mesh::morphWeights.
+    std::vector<float> weights;
+
+    explicit MorphTargetBlender(SharedMesh mesh);
+
+    /**
+     * Sets the vertices of the mesh to the unmorphed vertices + the weighted deltas of all targets.
+     * Normals and tangents are normalized again.
+     *
+     * If the mesh is in an uploaded VertBuffer and 'reupload' is true, the vertices that changed are reuploaded.
+     * Returns the range of vertices that changed (count is 0 if no weight changed since the last call).
+     */
+    VertexRange apply(bool reupload = true);
+
+    const SharedMesh &getMesh() const;
+
+  private:
+
+    struct Attribute
+    {
+        int offset = 0;
+        bool bNormalize = false;
+        // (target, stream) pairs:
+        std::vector<std::pair<int, const Mesh::MorphTarget::Stream *>> streams;
+    };
+
+    SharedMesh mesh;
+    std::vector<unsigned char> unmorphedVertexData;
+    std::vector<Attribute> attributes;
+
+    // The vertices that each target affects:
+    std::vector<VertexRange> targetRanges;
+
+    std::vector<float> appliedWeights;
+};
+
+#endif
@@ -0,0 +1,29 @@
+
+#include "pose.h"
+#include "armature.h"
+
+Pose::Pose(const Armature &armature)
+{
+    setToRestPose(armature);
+}
+
+int Pose::nrOfBones() const
+{
+    return translations.size();
+}
+
+void Pose::setToRestPose(const Armature &armature)
+{
+    const int nrOfBones = armature.bones.size();
+    translations.resize(nrOfBones);
+    rotations.resize(nrOfBones);
+    scales.resize(nrOfBones);
+
+    for (int i = 0; i < nrOfBones; i++)
+    {
+        const Bone &bone = *armature.bones[i];
+        translations[i] = bone.translation;
+        rotations[i] = bone.rotation;
+        scales[i] = bone.scale;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef GU_POSE_H
+#define GU_POSE_H
+
+#include "../../math/math_utils.h"
+
+#include <vector>
+
+struct Armature;
+
+/**
+ * The local transforms (relative to the parent bone) of all bones of an Armature, stored as a structure of arrays.
+ * Indices are the same as in Armature::bones.
+ */
+struct Pose
+{
+    std::vector<vec3> translations;
+    std::vector<quat> rotations;
+    std::vector<vec3> scales;
+
+    Pose() = default;
+
+    // Creates the rest pose of the armature.
+    explicit Pose(const Armature &);
+
+    int nrOfBones() const;
+
+    void setToRestPose(const Armature &);
+};
+
+#endif
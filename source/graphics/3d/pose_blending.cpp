@@ -0,0 +1,380 @@
+
+#include "pose_blending.h"
+#include "armature.h"
+
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace PoseBlending
+{
+
+namespace
+{
+
+inline float boneWeight(float weight, const float *mask, int bone)
+{
+    return mask ? weight * mask[bone] : weight;
+}
+
+inline quat blendRotation(const quat &a, const quat &b, float weight, RotationBlend rotationBlend)
+{
+    if (rotationBlend == SLERP)
+        return slerp(a, b, weight);
+
+    // shortest path:
+    const float weightB = dot(a, b) < 0.0f ? -weight : weight;
+    return normalize(a * (1.0f - weight) + b * weightB);
+}
+
+void mixVec3s(const vec3 *a, const vec3 *b, float weight, const float *mask, vec3 *out, int count)
+{
+    if (!mask)
+    {
+        // one flat loop, so that the compiler can vectorize it:
+        const float *af = &a[0].x, *bf = &b[0].x;
+        float *outf = &out[0].x;
+        for (int i = 0; i < count * 3; i++)
+            outf[i] = af[i] + (bf[i] - af[i]) * weight;
+        return;
+    }
+    for (int i = 0; i < count; i++)
+        out[i] = mix(a[i], b[i], weight * mask[i]);
+}
+
+/**
+ * Normalized lerp of 4 rotations at a time: the quaternions are transposed so that every register holds one component of 4 rotations.
+ */
+void nlerpRotations(const quat *a, const quat *b, float weight, const float *mask, quat *out, int count)
+{
+    int i = 0;
+
+    #ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps(), signBit = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128
+            a0 = _mm_loadu_ps((const float *) &a[i]),
+            a1 = _mm_loadu_ps((const float *) &a[i + 1]),
+            a2 = _mm_loadu_ps((const float *) &a[i + 2]),
+            a3 = _mm_loadu_ps((const float *) &a[i + 3]);
+        __m128
+            b0 = _mm_loadu_ps((const float *) &b[i]),
+            b1 = _mm_loadu_ps((const float *) &b[i + 1]),
+            b2 = _mm_loadu_ps((const float *) &b[i + 2]),
+            b3 = _mm_loadu_ps((const float *) &b[i + 3]);
+        _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+        _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+        const __m128 weights = mask ? _mm_mul_ps(_mm_set1_ps(weight), _mm_loadu_ps(mask + i)) : _mm_set1_ps(weight);
+
+        const __m128 dots = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a0, b0), _mm_mul_ps(a1, b1)),
+            _mm_add_ps(_mm_mul_ps(a2, b2), _mm_mul_ps(a3, b3))
+        );
+        // negate the weight of b where the dot product is negative (shortest path):
+        const __m128 weightsB = _mm_xor_ps(weights, _mm_and_ps(_mm_cmplt_ps(dots, zero), signBit));
+        const __m128 weightsA = _mm_sub_ps(one, weights);
+
+        __m128 q0 = _mm_add_ps(_mm_mul_ps(a0, weightsA), _mm_mul_ps(b0, weightsB));
+        __m128 q1 = _mm_add_ps(_mm_mul_ps(a1, weightsA), _mm_mul_ps(b1, weightsB));
+        __m128 q2 = _mm_add_ps(_mm_mul_ps(a2, weightsA), _mm_mul_ps(b2, weightsB));
+        __m128 q3 = _mm_add_ps(_mm_mul_ps(a3, weightsA), _mm_mul_ps(b3, weightsB));
+
+        const __m128 lengths = _mm_sqrt_ps(_mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(q0, q0), _mm_mul_ps(q1, q1)),
+            _mm_add_ps(_mm_mul_ps(q2, q2), _mm_mul_ps(q3, q3))
+        ));
+        q0 = _mm_div_ps(q0, lengths);
+        q1 = _mm_div_ps(q1, lengths);
+        q2 = _mm_div_ps(q2, lengths);
+        q3 = _mm_div_ps(q3, lengths);
+
+        _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+        _mm_storeu_ps((float *) &out[i], q0);
+        _mm_storeu_ps((float *) &out[i + 1], q1);
+        _mm_storeu_ps((float *) &out[i + 2], q2);
+        _mm_storeu_ps((float *) &out[i + 3], q3);
+    }
+    #endif
+
+    for (; i < count; i++)
+        out[i] = blendRotation(a[i], b[i], boneWeight(weight, mask, i), NLERP);
+}
+
+void checkSizes(const Pose &pose, const Pose &out, const BoneMask *mask)
+{
+    if (out.nrOfBones() != pose.nrOfBones() || out.rotations.size() != pose.rotations.size() || out.scales.size() != pose.scales.size())
+        throw gu_err("Cannot blend poses with a different number of bones");
+    if (mask && mask->weights.size() != pose.nrOfBones())
+        throw gu_err("BoneMask has " + std::to_string(mask->weights.size()) + " weights, pose has " + std::to_string(pose.nrOfBones()) + " bones");
+}
+
+}
+
+BoneMask::BoneMask(const Armature &armature, float weight) : weights(armature.bones.size(), weight)
+{
+}
+
+BoneMask &BoneMask::setBranch(const Armature &armature, const std::string &boneName, float weight)
+{
+    std::unordered_map<const Bone *, int> boneIndices;
+    const Bone *branch = nullptr;
+    for (int i = 0; i < armature.bones.size(); i++)
+    {
+        boneIndices[armature.bones[i].get()] = i;
+        if (armature.bones[i]->name == boneName)
+            branch = armature.bones[i].get();
+    }
+    if (!branch)
+        throw gu_err("Armature " + armature.name + " has no bone named " + boneName);
+
+    weights.resize(armature.bones.size(), 0.0f);
+
+    std::vector<const Bone *> toVisit { branch };
+    while (!toVisit.empty())
+    {
+        const Bone *bone = toVisit.back();
+        toVisit.pop_back();
+
+        auto it = boneIndices.find(bone);
+        if (it != boneIndices.end())
+            weights[it->second] = weight;
+
+        for (auto &child : bone->children)
+            toVisit.push_back(child.get());
+    }
+    return *this;
+}
+
+void lerp(const Pose &a, const Pose &b, float weight, Pose &out, const BoneMask *mask, RotationBlend rotationBlend)
+{
+    checkSizes(a, b, mask);
+    checkSizes(a, out, mask);
+
+    const int nrOfBones = a.nrOfBones();
+    const float *maskWeights = mask ? mask->weights.data() : nullptr;
+
+    mixVec3s(a.translations.data(), b.translations.data(), weight, maskWeights, out.translations.data(), nrOfBones);
+    mixVec3s(a.scales.data(), b.scales.data(), weight, maskWeights, out.scales.data(), nrOfBones);
+
+    if (rotationBlend == NLERP)
+        nlerpRotations(a.rotations.data(), b.rotations.data(), weight, maskWeights, out.rotations.data(), nrOfBones);
+    else
+        for (int i = 0; i < nrOfBones; i++)
+            out.rotations[i] = blendRotation(a.rotations[i], b.rotations[i], boneWeight(weight, maskWeights, i), SLERP);
+}
+
+void add(const Pose &base, const Pose &additive, const Pose &reference, float weight, Pose &out,
+         const BoneMask *mask, RotationBlend rotationBlend)
+{
+    checkSizes(base, additive, mask);
+    checkSizes(base, reference, mask);
+    checkSizes(base, out, mask);
+
+    const float *maskWeights = mask ? mask->weights.data() : nullptr;
+
+    for (int i = 0; i < base.nrOfBones(); i++)
+    {
+        const float w = boneWeight(weight, maskWeights, i);
+
+        out.translations[i] = base.translations[i] + (additive.translations[i] - reference.translations[i]) * w;
+
+        const quat delta = inverse(reference.rotations[i]) * additive.rotations[i];
+        out.rotations[i] = normalize(base.rotations[i] * blendRotation(mu::NO_ROTATION, delta, w, rotationBlend));
+
+        const vec3 &referenceScale = reference.scales[i];
+        const vec3 scaleRatio(
+            referenceScale.x == 0.0f ? 1.0f : additive.scales[i].x / referenceScale.x,
+            referenceScale.y == 0.0f ? 1.0f : additive.scales[i].y / referenceScale.y,
+            referenceScale.z == 0.0f ? 1.0f : additive.scales[i].z / referenceScale.z
+        );
+        out.scales[i] = base.scales[i] * mix(mu::ONE_3, scaleRatio, w);
+    }
+}
+
+Graph::Graph(const Armature &armature) : armature(armature)
+{
+}
+
+int Graph::addInput()
+{
+    Node node;
+    node.type = INPUT;
+    const int index = addNode(std::move(node));
+    poseBuffers[nodes[index].buffer].setToRestPose(armature);
+    return index;
+}
+
+int Graph::addLerp(int a, int b, float weight, const BoneMask *mask, RotationBlend rotationBlend)
+{
+    Node node;
+    node.type = LERP;
+    node.operands[0] = a;
+    node.operands[1] = b;
+    node.weight = weight;
+    if (mask)
+        node.mask = *mask;
+    node.rotationBlend = rotationBlend;
+    return addNode(std::move(node));
+}
+
+int Graph::addAdditive(int base, int additive, int reference, float weight, const BoneMask *mask, RotationBlend rotationBlend)
+{
+    Node node;
+    node.type = ADDITIVE;
+    node.operands[0] = base;
+    node.operands[1] = additive;
+    node.operands[2] = reference;
+    node.weight = weight;
+    if (mask)
+        node.mask = *mask;
+    node.rotationBlend = rotationBlend;
+    return addNode(std::move(node));
+}
+
+Pose &Graph::input(int inputNode)
+{
+    if (inputNode < 0 || inputNode >= nodes.size() || nodes[inputNode].type != INPUT)
+        throw gu_err("Node " + std::to_string(inputNode) + " is not an input of the blend graph");
+    return poseBuffers[nodes[inputNode].buffer];
+}
+
+float &Graph::weight(int node)
+{
+    return nodes.at(node).weight;
+}
+
+void Graph::evaluate(int node, Pose &out)
+{
+    if (node < 0 || node >= nodes.size())
+        throw gu_err("Node " + std::to_string(node) + " is not part of the blend graph");
+
+    // find the nodes that contribute to the result:
+    std::fill(needed.begin(), needed.end(), false);
+    needed[node] = true;
+    for (int i = node; i >= 0; i--)
+    {
+        const Node &n = nodes[i];
+        if (!needed[i] || n.type == INPUT)
+            continue;
+
+        const bool bMasked = !n.mask.weights.empty();
+        if (!bMasked && n.weight == 0.0f)
+            needed[n.operands[0]] = true;
+        else if (!bMasked && n.weight == 1.0f && n.type == LERP)
+            needed[n.operands[1]] = true;
+        else
+            for (int operand : n.operands)
+                if (operand >= 0)
+                    needed[operand] = true;
+    }
+
+    for (int i = 0; i <= node; i++)
+    {
+        const Node &n = nodes[i];
+        if (!needed[i] || n.type == INPUT)
+            continue;
+
+        Pose &result = i == node ? out : poseBuffers[n.buffer];
+        const auto operand = [&] (int o) -> const Pose & { return poseBuffers[nodes[n.operands[o]].buffer]; };
+        const BoneMask *mask = n.mask.weights.empty() ? nullptr : &n.mask;
+
+        if (n.weight == 0.0f && !mask)
+            result = operand(0);
+        else if (n.type == LERP && n.weight == 1.0f && !mask)
+            result = operand(1);
+        else if (n.type == LERP)
+            lerp(operand(0), operand(1), n.weight, result, mask, n.rotationBlend);
+        else
+            add(operand(0), operand(1), operand(2), n.weight, result, mask, n.rotationBlend);
+    }
+    if (nodes[node].type == INPUT)
+        out = poseBuffers[nodes[node].buffer];
+}
+
+int Graph::nrOfPoseBuffers() const
+{
+    return poseBuffers.size();
+}
+
+int Graph::addNode(Node &&node)
+{
+    const int index = nodes.size();
+    for (int operand : node.operands)
+        if (operand >= index)
+            throw gu_err("Blend graph nodes can only use nodes that were added before them");
+
+    if (!node.mask.weights.empty() && node.mask.weights.size() != armature.bones.size())
+        throw gu_err("BoneMask has " + std::to_string(node.mask.weights.size()) + " weights, armature " + armature.name + " has "
+            + std::to_string(armature.bones.size()) + " bones");
+
+    nodes.push_back(std::move(node));
+    needed.resize(nodes.size());
+    assignBuffers();
+    return index;
+}
+
+void Graph::assignBuffers()
+{
+    // the last node that uses the result of each node:
+    std::vector<int> lastUse(nodes.size());
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        lastUse[i] = i;
+        for (int operand : nodes[i].operands)
+            if (operand >= 0)
+                lastUse[operand] = i;
+    }
+
+    // inputs keep their buffer, so they can be filled at any time:
+    int nrOfBuffers = 0;
+    for (Node &node : nodes)
+    {
+        if (node.type == INPUT)
+            nrOfBuffers = std::max(nrOfBuffers, node.buffer + 1);
+        else
+            node.buffer = -1;
+    }
+    if (nodes.back().type == INPUT && nodes.back().buffer < 0)
+        nodes.back().buffer = nrOfBuffers++;
+
+    std::vector<int> freeBuffers;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        Node &node = nodes[i];
+        if (node.type == INPUT)
+            continue;
+
+        // operands that are not used after this node give their buffer back first, blending is allowed in place:
+        for (int operand : node.operands)
+            if (operand >= 0 && lastUse[operand] == i && nodes[operand].type != INPUT && nodes[operand].buffer >= 0)
+            {
+                if (std::find(freeBuffers.begin(), freeBuffers.end(), nodes[operand].buffer) == freeBuffers.end())
+                    freeBuffers.push_back(nodes[operand].buffer);
+            }
+
+        if (freeBuffers.empty())
+            node.buffer = nrOfBuffers++;
+        else
+        {
+            node.buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+        // a result that is not used by other nodes is only evaluated directly into the output of evaluate():
+        if (lastUse[i] == i)
+            freeBuffers.push_back(node.buffer);
+    }
+
+    // buffers are only added, so references to input poses stay valid as long as no nodes are added:
+    while (poseBuffers.size() < nrOfBuffers)
+        poseBuffers.emplace_back(armature);
+}
+
+} // namespace PoseBlending
@@ -0,0 +1,141 @@
+#ifndef GU_POSE_BLENDING_H
+#define GU_POSE_BLENDING_H
+
+#include "pose.h"
+
+#include <string>
+#include <vector>
+
+struct Armature;
+
+/**
+ * Blending of whole Poses (crossfades, additive layers, masked upper-body animations, etc.).
+ *
+ * All functions work on the arrays of the poses at once, and never allocate memory.
+ * All poses must have the same number of bones, 'out' may be the same Pose as one of the inputs.
+ */
+namespace PoseBlending
+{
+
+enum RotationBlend
+{
+    // Normalized linear interpolation: fast (vectorized with SSE2) and accurate enough for blend weights that change every frame.
+    NLERP,
+    // Spherical linear interpolation: constant angular velocity, more expensive.
+    SLERP
+};
+
+/**
+ * A weight per bone (indexed like Armature::bones), that is multiplied with the weight of a blend.
+ * Bones that are not included in the mask get weight 0.
+ */
+struct BoneMask
+{
+    std::vector<float> weights;
+
+    BoneMask() = default;
+
+    BoneMask(const Armature &, float weight);
+
+    /**
+     * Sets the weight of the bone named 'boneName' and all its descendants. Throws if the armature has no such bone.
+     * Example: BoneMask upperBody(armature, 0.0f); upperBody.setBranch(armature, "Spine", 1.0f);
+     */
+    BoneMask &setBranch(const Armature &, const std::string &boneName, float weight);
+};
+
+/**
+ * out = a * (1 - weight) + b * weight, per bone. The weight is multiplied by the mask (if given).
+ */
+void lerp(const Pose &a, const Pose &b, float weight, Pose &out, const BoneMask *mask = nullptr, RotationBlend rotationBlend = NLERP);
+
+/**
+ * Adds the difference between 'additive' and 'reference' (usually the first frame of the additive animation) on top of 'base':
+ *  translation = base + (additive - reference) * weight
+ *  rotation = base * blend(identity, inverse(reference) * additive, weight)
+ *  scale = base * mix(1, additive / reference, weight)
+ *
+ * The weight is multiplied by the mask (if given).
+ */
+void add(const Pose &base, const Pose &additive, const Pose &reference, float weight, Pose &out,
+         const BoneMask *mask = nullptr, RotationBlend rotationBlend = NLERP);
+
+/**
+ * A small blend graph. Nodes can only use nodes that were added before them, so the graph is evaluated in the order it was built.
+ *
+ * Poses of inputs and intermediate results come from a pool that is allocated when the graph is built.
+ * Results share a pose buffer when their lifetimes do not overlap, so evaluate() does not allocate memory.
+ *
+ * Usage:
+ *  PoseBlending::Graph graph(*armature);
+ *  int walk = graph.addInput(), run = graph.addInput(), wave = graph.addInput();
+ *  int locomotion = graph.addLerp(walk, run, 0.0f);
+ *  int root = graph.addLerp(locomotion, wave, 1.0f, &upperBodyMask);
+ *
+ *  // every frame:
+ *  walkSampler.sample(time, graph.input(walk));
+ *  ...
+ *  graph.weight(locomotion) = speed / runSpeed;
+ *  graph.evaluate(root, pose);
+ */
+class Graph
+{
+  public:
+    explicit Graph(const Armature &);
+
+    /**
+     * Adds a node with a pose that is filled by the user (e.g. using an AnimationSampler) before evaluate() is called.
+     * The input pose is the rest pose until it is changed.
+     */
+    int addInput();
+
+    int addLerp(int a, int b, float weight, const BoneMask *mask = nullptr, RotationBlend rotationBlend = NLERP);
+
+    int addAdditive(int base, int additive, int reference, float weight = 1.0f, const BoneMask *mask = nullptr,
+                    RotationBlend rotationBlend = NLERP);
+
+    Pose &input(int inputNode);
+
+    // The weight of a lerp or additive node, can be changed at any time.
+    float &weight(int node);
+
+    /**
+     * Evaluates 'node' (and the nodes it depends on) into 'out'. Nodes that do not contribute to 'node' are skipped,
+     * as are the inputs of blends with a weight of 0 or 1 that do not need them.
+     */
+    void evaluate(int node, Pose &out);
+
+    // Number of pose buffers in the pool (inputs included).
+    int nrOfPoseBuffers() const;
+
+  private:
+    enum NodeType
+    {
+        INPUT, LERP, ADDITIVE
+    };
+
+    struct Node
+    {
+        NodeType type;
+        int operands[3] = {-1, -1, -1};
+        float weight = 1.0f;
+        BoneMask mask;
+        RotationBlend rotationBlend = NLERP;
+        // Index in poseBuffers where the result of this node is stored:
+        int buffer = -1;
+    };
+
+    const Armature &armature;
+    std::vector<Node> nodes;
+    std::vector<Pose> poseBuffers;
+
+    std::vector<bool> needed;
+
+    int addNode(Node &&node);
+
+    void assignBuffers();
+};
+
+} // namespace PoseBlending
+
+#endif
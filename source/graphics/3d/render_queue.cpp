@@ -0,0 +1,298 @@
+
+#include "render_queue.h"
+#include "mesh.h"
+#include "vert_buffer.h"
+
+#include "../shader_program.h"
+#include "../../gu/profiler.h"
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+namespace
+{
+
+// The 16 highest bits of a positive float sort the same as the float itself: the exponent and the 7 highest bits of the mantissa.
+uint16 depthSortBits(float depth)
+{
+    depth = depth > 0.0f ? depth : 0.0f; // also for NaN
+    uint32 bits;
+    memcpy(&bits, &depth, sizeof(float));
+    return bits >> 16;
+}
+
+VertAttributes instanceTransformAttributes()
+{
+    VertAttributes attributes;
+    attributes.add(VertAttributes::TRANSFORM_COL_A);
+    attributes.add(VertAttributes::TRANSFORM_COL_B);
+    attributes.add(VertAttributes::TRANSFORM_COL_C);
+    attributes.add(VertAttributes::TRANSFORM_COL_D);
+    return attributes;
+}
+
+}
+
+RenderQueue::RenderQueue() :
+    instanceTransforms(instanceTransformAttributes(), 256)
+{
+}
+
+void RenderQueue::submit(ShaderProgram &shader, const SharedMesh &mesh, int partI, const SharedMaterial &material, const mat4 &transform, uint8 layer, float depth)
+{
+    if (!mesh->vertBuffer || !mesh->vertBuffer->isUploaded())
+    {
+        throw gu_err(mesh->name + " is not uploaded. Upload it first with a VertBuffer");
+    }
+    draws.push_back({ &shader, mesh.get(), partI, material.get(), transform, layer, depth, -1 });
+}
+
+void RenderQueue::submit(ShaderProgram &shader, const ModelPart &modelPart, const mat4 &transform, uint8 layer, float depth)
+{
+    submit(shader, modelPart.mesh, modelPart.meshPartIndex, modelPart.material, transform, layer, depth);
+}
+
+void RenderQueue::setBackToFront(uint8 layer, bool backToFront)
+{
+    backToFrontLayers[layer] = backToFront;
+}
+
+void RenderQueue::setInstancedShader(ShaderProgram &shader, ShaderProgram &instancedShader)
+{
+    instancedShaders[&shader] = &instancedShader;
+}
+
+uint64 RenderQueue::makeKey(const ShaderProgram &shader, const Mesh &mesh, const Material *material, uint8 layer, float depth)
+{
+    const uint64 shaderBits = shader.id() & 0xFFF;
+    const uint64 vertBufferBits = mesh.vertBuffer->getVaoId() & 0xFFF;
+    const uint64 materialBits = getMaterialId(material);
+    const uint64 depthBits = depthSortBits(depth);
+
+    const uint64 key = uint64(layer) << 56u;
+    if (backToFrontLayers[layer])
+    {
+        return key | (0xFFFFu - depthBits) << 40u | shaderBits << 28u | vertBufferBits << 16u | materialBits;
+    }
+    return key | shaderBits << 44u | vertBufferBits << 32u | materialBits << 16u | depthBits;
+}
+
+uint16 RenderQueue::getMaterialId(const Material *material)
+{
+    return materialIds.emplace(material, materialIds.size()).first->second;
+}
+
+void RenderQueue::radixSort()
+{
+    sortBuffer.resize(items.size());
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        int offsets[256] = {};
+        for (const SortItem &item : items)
+        {
+            offsets[(item.key >> shift) & 0xFF]++;
+        }
+        // skip bytes that are the same for every key (for example when only one layer is used):
+        if (offsets[(items[0].key >> shift) & 0xFF] == items.size())
+        {
+            continue;
+        }
+        int offset = 0;
+        for (int &count : offsets)
+        {
+            const int nrOfItems = count;
+            count = offset;
+            offset += nrOfItems;
+        }
+        for (const SortItem &item : items)
+        {
+            sortBuffer[offsets[(item.key >> shift) & 0xFF]++] = item;
+        }
+        items.swap(sortBuffer);
+    }
+}
+
+void RenderQueue::groupInstances()
+{
+    instanceCandidates.clear();
+    for (int drawI = 0; drawI < draws.size(); drawI++)
+    {
+        const Draw &draw = draws[drawI];
+        if (!backToFrontLayers[draw.layer] && instancedShaders.count(draw.shader))
+        {
+            instanceCandidates.push_back(drawI);
+        }
+    }
+    const auto groupKey = [&] (int drawI) {
+        const Draw &draw = draws[drawI];
+        return std::make_tuple(draw.shader, draw.mesh, draw.partI, draw.material, draw.layer);
+    };
+    // stable, so the groups keep the order of submission:
+    std::stable_sort(instanceCandidates.begin(), instanceCandidates.end(), [&] (int a, int b) {
+        return groupKey(a) < groupKey(b);
+    });
+
+    int nrOfTransforms = 0;
+    for (int begin = 0, end = 0; begin < instanceCandidates.size(); begin = end)
+    {
+        while (end < instanceCandidates.size() && groupKey(instanceCandidates[end]) == groupKey(instanceCandidates[begin]))
+        {
+            end++;
+        }
+        if (end - begin < std::max(minInstances, 2))
+        {
+            continue;
+        }
+        InstanceGroup &group = instanceGroups.emplace_back();
+        group.drawI = instanceCandidates[begin];
+        group.instancedShader = instancedShaders[draws[group.drawI].shader];
+        group.nrOfInstances = end - begin;
+        group.firstTransform = nrOfTransforms;
+        group.depth = draws[group.drawI].depth;
+
+        for (int i = begin; i < end; i++)
+        {
+            draws[instanceCandidates[i]].instanceGroup = instanceGroups.size() - 1;
+            group.depth = std::min(group.depth, draws[instanceCandidates[i]].depth);
+        }
+        nrOfTransforms += group.nrOfInstances;
+    }
+
+    if (nrOfTransforms == 0)
+    {
+        return;
+    }
+    mat4 *transforms = (mat4 *) instanceTransforms.beginWrite(nrOfTransforms);
+    for (int i = 0, groupI = -1; i < instanceCandidates.size(); i++)
+    {
+        const Draw &draw = draws[instanceCandidates[i]];
+        if (draw.instanceGroup != -1)
+        {
+            if (draw.instanceGroup != groupI)
+            {
+                groupI = draw.instanceGroup;
+                nrOfTransforms = instanceGroups[groupI].firstTransform;
+            }
+            transforms[nrOfTransforms++] = draw.transform;
+        }
+    }
+    instanceTransforms.endWrite();
+}
+
+void RenderQueue::renderInstances(const InstanceGroup &group)
+{
+    const Draw &draw = draws[group.drawI];
+    VertBuffer *vertBuffer = draw.mesh->vertBuffer;
+
+    vertBuffer->usePerInstanceData(instanceTransforms, 1, group.firstTransform);
+    if (std::find(instancedVertBuffers.begin(), instancedVertBuffers.end(), vertBuffer) == instancedVertBuffers.end())
+    {
+        instancedVertBuffers.push_back(vertBuffer);
+    }
+    draw.mesh->renderInstances(group.nrOfInstances, draw.partI);
+}
+
+void RenderQueue::flush()
+{
+    stats = Stats();
+
+    if (!instancedShaders.empty())
+    {
+        groupInstances();
+    }
+    for (int drawI = 0; drawI < draws.size(); drawI++)
+    {
+        const Draw &draw = draws[drawI];
+        if (draw.instanceGroup == -1)
+        {
+            items.push_back({ makeKey(*draw.shader, *draw.mesh, draw.material, draw.layer, draw.depth), drawI });
+        }
+    }
+    for (int groupI = 0; groupI < instanceGroups.size(); groupI++)
+    {
+        const InstanceGroup &group = instanceGroups[groupI];
+        const Draw &draw = draws[group.drawI];
+        items.push_back({ makeKey(*group.instancedShader, *draw.mesh, draw.material, draw.layer, group.depth), -1 - groupI });
+    }
+    if (!items.empty())
+    {
+        radixSort();
+    }
+
+    ShaderProgram *shader = nullptr;
+    const VertBuffer *vertBuffer = nullptr;
+    const Material *material = nullptr;
+    bool materialBound = false;
+    GLint transformLocation = -1;
+
+    for (const SortItem &item : items)
+    {
+        const InstanceGroup *group = item.drawI < 0 ? &instanceGroups[-1 - item.drawI] : nullptr;
+        const Draw &draw = draws[group ? group->drawI : item.drawI];
+        ShaderProgram *drawShader = group ? group->instancedShader : draw.shader;
+
+        if (drawShader != shader)
+        {
+            shader = drawShader;
+            shader->use();
+            transformLocation = shader->location(transformUniform.c_str());
+            stats.shaderChanges++;
+
+            // uniforms are stored per shader, so the material has to be bound again:
+            materialBound = false;
+        }
+        if (draw.mesh->vertBuffer != vertBuffer)
+        {
+            // Mesh::render() binds the VertBuffer, which does nothing if it is bound already.
+            vertBuffer = draw.mesh->vertBuffer;
+            stats.vertBufferChanges++;
+        }
+        if (!materialBound || draw.material != material)
+        {
+            material = draw.material;
+            materialBound = true;
+            if (material && bindMaterial)
+            {
+                bindMaterial(*shader, *material);
+                stats.materialChanges++;
+            }
+        }
+        if (group)
+        {
+            renderInstances(*group);
+            stats.instancedDrawCalls++;
+        }
+        else
+        {
+            if (transformLocation != -1)
+            {
+                glUniformMatrix4fv(transformLocation, 1, GL_FALSE, (const float *) &draw.transform);
+            }
+            draw.mesh->render(draw.partI);
+        }
+        stats.drawCalls++;
+    }
+    for (VertBuffer *instancedVertBuffer : instancedVertBuffers)
+    {
+        instancedVertBuffer->stopUsingPerInstanceData(instanceTransforms.attributes);
+    }
+    instancedVertBuffers.clear();
+    instanceGroups.clear();
+    draws.clear();
+    items.clear();
+    materialIds.clear();
+
+    gu::profiler::addToCounter("draw calls", stats.drawCalls);
+    gu::profiler::addToCounter("shader changes", stats.shaderChanges);
+    gu::profiler::addToCounter("VertBuffer changes", stats.vertBufferChanges);
+    gu::profiler::addToCounter("material changes", stats.materialChanges);
+    gu::profiler::addToCounter("instanced draw calls", stats.instancedDrawCalls);
+}
+
+const RenderQueue::Stats &RenderQueue::getStats() const
+{
+    return stats;
+}
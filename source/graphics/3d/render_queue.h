@@ -0,0 +1,149 @@
+#ifndef GU_RENDER_QUEUE_H
+#define GU_RENDER_QUEUE_H
+
+#include "model.h"
+#include "streaming_buffer.h"
+
+#include <bitset>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+class ShaderProgram;
+class VertBuffer;
+
+/**
+ * A per frame queue of draws, that are sorted before drawing to minimize state changes.
+ *
+ * Every draw gets a 64 bit key: layer (8 bits), shader (12 bits), VertBuffer (12 bits), material (16 bits) and depth (16 bits).
+ * Keys are radix sorted, and state that is the same as for the previous draw is not set again.
+ * Within a layer draws are sorted by state first, and front to back after that.
+ * Layers marked with setBackToFront() (for transparency) are sorted back to front first, and by state after that.
+ *
+ * Mesh parts that are submitted many times with the same shader and material can be drawn as one instanced draw,
+ * see setInstancedShader(). Their transforms are written into a StreamingBuffer, and read as per instance data (TRANSFORM_COL_A..D).
+ *
+ * The number of draw calls and state changes per frame are reported to the profiler.
+ *
+ * Usage:
+ *  queue.bindMaterial = [&] (ShaderProgram &shader, const Material &material) { ... };
+ *  for (auto &part : model->parts)
+ *      queue.submit(shader, part, transform, OPAQUE_LAYER, distanceToCamera);
+ *  queue.flush();
+ */
+class RenderQueue
+{
+  public:
+
+    struct Stats
+    {
+        int drawCalls = 0, shaderChanges = 0, vertBufferChanges = 0, materialChanges = 0;
+        // Included in drawCalls:
+        int instancedDrawCalls = 0;
+    };
+
+    // The minimum number of times a mesh part has to be submitted (with the same shader and material) to be drawn instanced.
+    int minInstances = 4;
+
+    // Name of the mat4 uniform that is set to the transform of each draw.
+    std::string transformUniform = "transform";
+
+    // Called when a draw uses a different material than the previous draw (or a different shader), after the shader is in use.
+    std::function<void(ShaderProgram &, const Material &)> bindMaterial;
+
+    /**
+     * Adds a draw of part 'partI' of an uploaded mesh.
+     * The shader, mesh and material must stay alive until flush(). 'material' can be nullptr.
+     * 'depth' is the distance to the camera (negative depths are treated as 0).
+     */
+    void submit(ShaderProgram &, const SharedMesh &, int partI, const SharedMaterial &, const mat4 &transform, uint8 layer = 0, float depth = 0.0f);
+
+    void submit(ShaderProgram &, const ModelPart &, const mat4 &transform, uint8 layer = 0, float depth = 0.0f);
+
+    void setBackToFront(uint8 layer, bool backToFront = true);
+
+    /**
+     * Lets mesh parts that are submitted with 'shader' at least 'minInstances' times (with the same material and layer) be drawn with one renderInstances() call,
+     * using 'instancedShader'. 'instancedShader' must read the transform from the TRANSFORM_COL_A..D attributes,
+     * which are at the locations after the attributes of the mesh.
+     * Draws in back to front layers are never instanced, because that would break their order.
+     *
+     * The transforms of all instanced draws are written into one StreamingBuffer that is owned by this queue, so no buffers are created per frame.
+     * At the end of flush() the TRANSFORM_COL_A..D attributes are disabled again on every VertBuffer that was drawn instanced,
+     * so later draws from those VertBuffers (with or without this queue) do not depend on that buffer.
+     */
+    void setInstancedShader(ShaderProgram &shader, ShaderProgram &instancedShader);
+
+    RenderQueue();
+
+    // Sorts and executes all submitted draws, and clears the queue.
+    void flush();
+
+    // Stats of the last flush().
+    const Stats &getStats() const;
+
+  private:
+
+    struct Draw
+    {
+        ShaderProgram *shader;
+        Mesh *mesh;
+        int partI;
+        const Material *material;
+        mat4 transform;
+        uint8 layer;
+        float depth;
+
+        // Index in instanceGroups, or -1:
+        int instanceGroup;
+    };
+
+    struct InstanceGroup
+    {
+        // The first draw of the group, which has the same mesh, part, material and layer as the others:
+        int drawI;
+        ShaderProgram *instancedShader;
+        int nrOfInstances = 0, firstTransform = 0;
+        float depth;
+    };
+
+    struct SortItem
+    {
+        uint64 key;
+        // Index in draws, or -1 - the index in instanceGroups:
+        int drawI;
+    };
+
+    std::vector<Draw> draws;
+    std::vector<InstanceGroup> instanceGroups;
+    std::vector<SortItem> items, sortBuffer;
+
+    std::unordered_map<ShaderProgram *, ShaderProgram *> instancedShaders;
+
+    // Draws that could be instanced, sorted to find the groups:
+    std::vector<int> instanceCandidates;
+
+    // The transforms of all instanced draws of a flush(), sorted by group:
+    StreamingBuffer instanceTransforms;
+    // VertBuffers that read from instanceTransforms during a flush():
+    std::vector<VertBuffer *> instancedVertBuffers;
+
+    // Materials get an id in the order they are first submitted in a frame:
+    std::unordered_map<const Material *, uint16> materialIds;
+
+    std::bitset<256> backToFrontLayers;
+
+    Stats stats;
+
+    uint16 getMaterialId(const Material *);
+
+    uint64 makeKey(const ShaderProgram &, const Mesh &, const Material *, uint8 layer, float depth);
+
+    void groupInstances();
+
+    void radixSort();
+
+    void renderInstances(const InstanceGroup &);
+};
+
+#endif
@@ -0,0 +1,89 @@
+
+#include "skeleton.h"
+#include "armature.h"
+
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+
+Skeleton::Skeleton(const Armature &armature)
+{
+    const int nrOfBones = armature.bones.size();
+    parents.resize(nrOfBones, -1);
+    inverseBindMatrices.resize(nrOfBones);
+
+    for (int i = 0; i < nrOfBones; i++)
+    {
+        const Bone &bone = *armature.bones[i];
+        inverseBindMatrices[i] = bone.inverseBindMatrix;
+
+        if (bone.parent)
+        {
+            auto parentIt = std::find(armature.bones.begin(), armature.bones.end(), bone.parent);
+            if (parentIt != armature.bones.end())
+                parents[i] = parentIt - armature.bones.begin();
+        }
+    }
+
+    // topological sort: roots first, then children of the bones that were added (breadth first).
+    order.reserve(nrOfBones);
+    for (int i = 0; i < nrOfBones; i++)
+        if (parents[i] < 0)
+            order.push_back(i);
+
+    std::vector<int> childOffsets(nrOfBones + 1, 0), children(nrOfBones);
+    for (int i = 0; i < nrOfBones; i++)
+        if (parents[i] >= 0)
+            childOffsets[parents[i] + 1]++;
+    for (int i = 0; i < nrOfBones; i++)
+        childOffsets[i + 1] += childOffsets[i];
+    {
+        std::vector<int> fill(childOffsets.begin(), childOffsets.end() - 1);
+        for (int i = 0; i < nrOfBones; i++)
+            if (parents[i] >= 0)
+                children[fill[parents[i]]++] = i;
+    }
+    for (int i = 0; i < order.size(); i++)
+        for (int c = childOffsets[order[i]]; c < childOffsets[order[i] + 1]; c++)
+            order.push_back(children[c]);
+
+    if (order.size() != nrOfBones)
+        throw gu_err("The bones of armature " + armature.name + " contain a cycle");
+
+    // Keep the original order if it was already sorted, so calculateMatrices() walks through memory linearly.
+    bool bSorted = true;
+    for (int i = 0; i < nrOfBones && bSorted; i++)
+        bSorted = parents[i] < i;
+    if (bSorted)
+        for (int i = 0; i < nrOfBones; i++)
+            order[i] = i;
+}
+
+int Skeleton::nrOfBones() const
+{
+    return parents.size();
+}
+
+void Skeleton::calculateMatrices(const Pose &pose, mat4 *modelMatrices, mat4 *skinningMatrices, const mat4 &rootTransform) const
+{
+    for (const int bone : order)
+    {
+        const mat4 local = localMatrix(pose.translations[bone], pose.rotations[bone], pose.scales[bone]);
+        const int parent = parents[bone];
+        modelMatrices[bone] = (parent < 0 ? rootTransform : modelMatrices[parent]) * local;
+
+        if (skinningMatrices)
+            skinningMatrices[bone] = modelMatrices[bone] * inverseBindMatrices[bone];
+    }
+}
+
+mat4 Skeleton::localMatrix(const vec3 &translation, const quat &rotation, const vec3 &scale)
+{
+    const mat3 r = mat3_cast(rotation);
+    mat4 m;
+    m[0] = vec4(r[0] * scale.x, 0.0f);
+    m[1] = vec4(r[1] * scale.y, 0.0f);
+    m[2] = vec4(r[2] * scale.z, 0.0f);
+    m[3] = vec4(translation, 1.0f);
+    return m;
+}
@@ -0,0 +1,42 @@
+#ifndef GU_SKELETON_H
+#define GU_SKELETON_H
+
+#include "pose.h"
+
+#include <vector>
+
+struct Armature;
+
+/**
+ * A flattened version of an Armature's bone hierarchy, for calculating the matrices of all bones in one linear pass:
+ * no shared pointers to follow, and no parent matrices that are calculated again for every child.
+ *
+ * All arrays are indexed like Armature::bones (which is also the order of the joints in VertAttributes::JOINTS).
+ * 'order' contains the same indices, sorted so that parents always come before their children.
+ */
+struct Skeleton
+{
+    std::vector<int> order;
+    // Parent of every bone, or -1 for root bones.
+    std::vector<int> parents;
+    std::vector<mat4> inverseBindMatrices;
+
+    explicit Skeleton(const Armature &);
+
+    int nrOfBones() const;
+
+    /**
+     * Calculates the model space matrix of every bone in 'pose'. The matrices of root bones are multiplied with 'rootTransform'.
+     * If 'skinningMatrices' is not nullptr, it will be filled with modelMatrix * inverseBindMatrix for every bone (the palette for skinning).
+     *
+     * Both arrays must have room for nrOfBones() matrices. Nothing is allocated.
+     */
+    void calculateMatrices(const Pose &pose, mat4 *modelMatrices, mat4 *skinningMatrices = nullptr, const mat4 &rootTransform = mat4(1.0f)) const;
+
+    /**
+     * Returns translate(translation) * rotation * scale(scale), without the overhead of multiplying three matrices.
+     */
+    static mat4 localMatrix(const vec3 &translation, const quat &rotation, const vec3 &scale);
+};
+
+#endif
@@ -0,0 +1,274 @@
+
+#include "skinning.h"
+
+#include "mesh.h"
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace Skinning
+{
+
+namespace
+{
+
+// Vertices per range handed to a thread:
+constexpr int MIN_VERTICES_PER_THREAD = 2048;
+
+struct Influences
+{
+    const float *matrices[4];
+    float weights[4];
+    int count = 0;
+};
+
+inline void readInfluences(const unsigned char *vertex, int jointsOffset, int weightsOffset, const mat4 *skinningMatrices,
+                           int nrOfBones, Influences &influences)
+{
+    uint8 joints[4];
+    float weights[4];
+    memcpy(joints, vertex + jointsOffset, sizeof(joints));
+    memcpy(weights, vertex + weightsOffset, sizeof(weights));
+
+    influences.count = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (weights[i] == 0.0f || joints[i] >= nrOfBones)
+            continue;
+        influences.matrices[influences.count] = (const float *) &skinningMatrices[joints[i]];
+        influences.weights[influences.count++] = weights[i];
+    }
+}
+
+inline vec3 normalizeOrKeep(const vec3 &v)
+{
+    const float len2 = dot(v, v);
+    return len2 > 0.0f ? v * (1.0f / sqrt(len2)) : v;
+}
+
+#ifdef __SSE2__
+
+inline void store3(float *dst, __m128 v)
+{
+    float tmp[4];
+    _mm_storeu_ps(tmp, v);
+    memcpy(dst, tmp, sizeof(float) * 3);
+}
+
+#endif
+
+#if defined(__AVX__)
+
+inline __m256 multiplyAdd(__m256 a, __m256 b, __m256 c)
+{
+    #ifdef __FMA__
+    return _mm256_fmadd_ps(a, b, c);
+    #else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+    #endif
+}
+
+/**
+ * A column major matrix is loaded as two 256 bit vectors: columns [0, 1] and columns [2, 3].
+ * Transforming (x, y, z, w) is then done by multiplying them with [x x x x y y y y] and [z z z z w w w w],
+ * and adding the upper and lower halves of the sum.
+ */
+void skinRange(const unsigned char *vertices, int vertSize, int posOffset, int normalOffset, int jointsOffset, int weightsOffset,
+               const mat4 *skinningMatrices, int nrOfBones, int begin, int end, vec3 *positions, vec3 *normals)
+{
+    Influences influences;
+    for (int i = begin; i < end; i++)
+    {
+        const unsigned char *vertex = vertices + size_t(i) * vertSize;
+        readInfluences(vertex, jointsOffset, weightsOffset, skinningMatrices, nrOfBones, influences);
+
+        float p[3];
+        memcpy(p, vertex + posOffset, sizeof(p));
+
+        if (influences.count == 0)
+        {
+            memcpy(&positions[i - begin], p, sizeof(p));
+            if (normals)
+                normals[i - begin] = normalizeOrKeep(*(const vec3 *) (vertex + normalOffset));
+            continue;
+        }
+
+        __m256 weight = _mm256_set1_ps(influences.weights[0]);
+        __m256 cols01 = _mm256_mul_ps(_mm256_loadu_ps(influences.matrices[0]), weight);
+        __m256 cols23 = _mm256_mul_ps(_mm256_loadu_ps(influences.matrices[0] + 8), weight);
+
+        for (int j = 1; j < influences.count; j++)
+        {
+            weight = _mm256_set1_ps(influences.weights[j]);
+            cols01 = multiplyAdd(_mm256_loadu_ps(influences.matrices[j]), weight, cols01);
+            cols23 = multiplyAdd(_mm256_loadu_ps(influences.matrices[j] + 8), weight, cols23);
+        }
+
+        const __m256 position = multiplyAdd(
+            cols01, _mm256_setr_ps(p[0], p[0], p[0], p[0], p[1], p[1], p[1], p[1]),
+            _mm256_mul_ps(cols23, _mm256_setr_ps(p[2], p[2], p[2], p[2], 1.0f, 1.0f, 1.0f, 1.0f))
+        );
+        store3(&positions[i - begin][0], _mm_add_ps(_mm256_castps256_ps128(position), _mm256_extractf128_ps(position, 1)));
+
+        if (normals)
+        {
+            float n[3];
+            memcpy(n, vertex + normalOffset, sizeof(n));
+
+            const __m256 normal01 = _mm256_mul_ps(cols01, _mm256_setr_ps(n[0], n[0], n[0], n[0], n[1], n[1], n[1], n[1]));
+            const __m128 normal = _mm_add_ps(
+                _mm_add_ps(_mm256_castps256_ps128(normal01), _mm256_extractf128_ps(normal01, 1)),
+                _mm_mul_ps(_mm256_castps256_ps128(cols23), _mm_set1_ps(n[2]))
+            );
+            store3(&normals[i - begin][0], normal);
+            normals[i - begin] = normalizeOrKeep(normals[i - begin]);
+        }
+    }
+}
+
+#elif defined(__SSE2__)
+
+void skinRange(const unsigned char *vertices, int vertSize, int posOffset, int normalOffset, int jointsOffset, int weightsOffset,
+               const mat4 *skinningMatrices, int nrOfBones, int begin, int end, vec3 *positions, vec3 *normals)
+{
+    Influences influences;
+    for (int i = begin; i < end; i++)
+    {
+        const unsigned char *vertex = vertices + size_t(i) * vertSize;
+        readInfluences(vertex, jointsOffset, weightsOffset, skinningMatrices, nrOfBones, influences);
+
+        float p[3];
+        memcpy(p, vertex + posOffset, sizeof(p));
+
+        if (influences.count == 0)
+        {
+            memcpy(&positions[i - begin], p, sizeof(p));
+            if (normals)
+                normals[i - begin] = normalizeOrKeep(*(const vec3 *) (vertex + normalOffset));
+            continue;
+        }
+
+        __m128 cols[4];
+        __m128 weight = _mm_set1_ps(influences.weights[0]);
+        for (int c = 0; c < 4; c++)
+            cols[c] = _mm_mul_ps(_mm_loadu_ps(influences.matrices[0] + c * 4), weight);
+
+        for (int j = 1; j < influences.count; j++)
+        {
+            weight = _mm_set1_ps(influences.weights[j]);
+            for (int c = 0; c < 4; c++)
+                cols[c] = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(influences.matrices[j] + c * 4), weight), cols[c]);
+        }
+
+        const __m128 xy = _mm_add_ps(_mm_mul_ps(cols[0], _mm_set1_ps(p[0])), _mm_mul_ps(cols[1], _mm_set1_ps(p[1])));
+        store3(&positions[i - begin][0], _mm_add_ps(xy, _mm_add_ps(_mm_mul_ps(cols[2], _mm_set1_ps(p[2])), cols[3])));
+
+        if (normals)
+        {
+            float n[3];
+            memcpy(n, vertex + normalOffset, sizeof(n));
+
+            const __m128 normal = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cols[0], _mm_set1_ps(n[0])), _mm_mul_ps(cols[1], _mm_set1_ps(n[1]))),
+                _mm_mul_ps(cols[2], _mm_set1_ps(n[2]))
+            );
+            store3(&normals[i - begin][0], normal);
+            normals[i - begin] = normalizeOrKeep(normals[i - begin]);
+        }
+    }
+}
+
+#else
+
+void skinRange(const unsigned char *vertices, int vertSize, int posOffset, int normalOffset, int jointsOffset, int weightsOffset,
+               const mat4 *skinningMatrices, int nrOfBones, int begin, int end, vec3 *positions, vec3 *normals)
+{
+    Influences influences;
+    for (int i = begin; i < end; i++)
+    {
+        const unsigned char *vertex = vertices + size_t(i) * vertSize;
+        readInfluences(vertex, jointsOffset, weightsOffset, skinningMatrices, nrOfBones, influences);
+
+        vec3 p, n;
+        memcpy(&p[0], vertex + posOffset, sizeof(float) * 3);
+        if (normals)
+            memcpy(&n[0], vertex + normalOffset, sizeof(float) * 3);
+
+        if (influences.count == 0)
+        {
+            positions[i - begin] = p;
+            if (normals)
+                normals[i - begin] = normalizeOrKeep(n);
+            continue;
+        }
+
+        float m[12] = {};
+        for (int j = 0; j < influences.count; j++)
+        {
+            // only the upper 3 rows are needed:
+            for (int c = 0; c < 4; c++)
+                for (int r = 0; r < 3; r++)
+                    m[c * 3 + r] += influences.matrices[j][c * 4 + r] * influences.weights[j];
+        }
+        positions[i - begin] = vec3(
+            m[0] * p.x + m[3] * p.y + m[6] * p.z + m[9],
+            m[1] * p.x + m[4] * p.y + m[7] * p.z + m[10],
+            m[2] * p.x + m[5] * p.y + m[8] * p.z + m[11]
+        );
+        if (normals)
+            normals[i - begin] = normalizeOrKeep(vec3(
+                m[0] * n.x + m[3] * n.y + m[6] * n.z,
+                m[1] * n.x + m[4] * n.y + m[7] * n.z,
+                m[2] * n.x + m[5] * n.y + m[8] * n.z
+            ));
+    }
+}
+
+#endif
+
+}
+
+void skinVertices(const VertData &vertices, const mat4 *skinningMatrices, int nrOfBones,
+                  int firstVertex, int nrOfVertices, vec3 *positions, vec3 *normals)
+{
+    const VertAttributes &attrs = vertices.attributes;
+    if (!attrs.contains(VertAttributes::POSITION) || !attrs.contains(VertAttributes::JOINTS) || !attrs.contains(VertAttributes::WEIGHTS))
+        throw gu_err("Cannot skin vertices without positions, joints and weights");
+
+    if (normals && !attrs.contains(VertAttributes::NORMAL))
+        throw gu_err("Cannot skin normals of vertices without normals");
+
+    if (firstVertex < 0 || nrOfVertices < 0 || firstVertex + nrOfVertices > vertices.nrOfVertices())
+        throw gu_err("Cannot skin vertices [" + std::to_string(firstVertex) + ", " + std::to_string(firstVertex + nrOfVertices)
+            + "), only " + std::to_string(vertices.nrOfVertices()) + " vertices available");
+
+    const unsigned char *data = vertices.vertexData.data();
+    const int vertSize = attrs.getVertSize();
+    const int posOffset = attrs.getOffset(VertAttributes::POSITION);
+    const int normalOffset = normals ? attrs.getOffset(VertAttributes::NORMAL) : 0;
+    const int jointsOffset = attrs.getOffset(VertAttributes::JOINTS);
+    const int weightsOffset = attrs.getOffset(VertAttributes::WEIGHTS);
+
+    gu::parallel::forRanges(nrOfVertices, MIN_VERTICES_PER_THREAD, [&] (int begin, int end) {
+        skinRange(
+            data, vertSize, posOffset, normalOffset, jointsOffset, weightsOffset, skinningMatrices, nrOfBones,
+            firstVertex + begin, firstVertex + end, positions + begin, normals ? normals + begin : nullptr
+        );
+    });
+}
+
+void skinVertices(const VertData &vertices, const mat4 *skinningMatrices, int nrOfBones, vec3 *positions, vec3 *normals)
+{
+    skinVertices(vertices, skinningMatrices, nrOfBones, 0, vertices.nrOfVertices(), positions, normals);
+}
+
+} // namespace Skinning
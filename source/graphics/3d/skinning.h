@@ -0,0 +1,43 @@
+#ifndef GU_SKINNING_H
+#define GU_SKINNING_H
+
+#include "../../math/math_utils.h"
+
+class VertData;
+
+/**
+ * Linear blend skinning on the CPU, for when the skinned shape is needed outside of the vertex shader
+ * (hit detection on a server, ray picking on animated characters, etc.).
+ *
+ * Every vertex is transformed by the weighted sum of the (up to 4) skinning matrices in VertAttributes::JOINTS and VertAttributes::WEIGHTS.
+ * The palette of skinning matrices can be calculated using Skeleton::calculateMatrices().
+ *
+ * Large meshes are split across the worker threads.
+ * The kernel uses 256 bit vectors when compiled with AVX (-mavx2 or -march=native), 128 bit vectors with SSE2, and plain floats otherwise.
+ *
+ * Usage:
+ *  skeleton.calculateMatrices(pose, modelMatrices.data(), skinningMatrices.data());
+ *  Skinning::skinVertices(*mesh, skinningMatrices.data(), skeleton.nrOfBones(), positions.data(), normals.data());
+ */
+namespace Skinning
+{
+
+/**
+ * Skins vertices [firstVertex, firstVertex + nrOfVertices) of 'vertices', and writes them to positions[0, nrOfVertices)
+ * and (if not nullptr) normals[0, nrOfVertices). Normals are normalized.
+ *
+ * 'vertices' must have VertAttributes::POSITION, VertAttributes::JOINTS and VertAttributes::WEIGHTS,
+ * and VertAttributes::NORMAL if 'normals' is not nullptr.
+ * Joints that are not smaller than 'nrOfBones' are ignored. Vertices without any weight are not transformed.
+ */
+void skinVertices(const VertData &vertices, const mat4 *skinningMatrices, int nrOfBones,
+                  int firstVertex, int nrOfVertices, vec3 *positions, vec3 *normals = nullptr);
+
+/**
+ * Same as above, for all vertices.
+ */
+void skinVertices(const VertData &vertices, const mat4 *skinningMatrices, int nrOfBones, vec3 *positions, vec3 *normals = nullptr);
+
+} // namespace Skinning
+
+#endif
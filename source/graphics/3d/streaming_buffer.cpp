@@ -0,0 +1,172 @@
+
+#include "streaming_buffer.h"
+
+#include "../../utils/gu_error.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// Segments start at multiples of this, which is enough for any vertex attribute.
+constexpr GLsizeiptr SEGMENT_ALIGNMENT = 256;
+
+#if !defined(EMSCRIPTEN) && defined(GL_MAP_PERSISTENT_BIT)
+constexpr GLbitfield PERSISTENT_MAP_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+bool isBufferStorageSupported()
+{
+    return glBufferStorage != nullptr;
+}
+#endif
+
+void waitForFence(GLsync &fence)
+{
+    if (!fence)
+    {
+        return;
+    }
+    // first check without flushing, the fence of a segment that was used frames ago has most likely been signaled:
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    while (result == GL_TIMEOUT_EXPIRED)
+    {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+}
+
+StreamingBuffer::StreamingBuffer(const VertAttributes &attributes, int maxVerticesPerSegment, int nrOfSegments) :
+    attributes(attributes),
+    maxVerticesPerSegment(std::max(1, maxVerticesPerSegment)),
+    nrOfSegments(std::max(1, nrOfSegments))
+{
+    if (attributes.getVertSize() == 0)
+    {
+        throw gu_err("Cannot create a StreamingBuffer without attributes");
+    }
+    create();
+}
+
+void StreamingBuffer::create()
+{
+    segmentSize = GLsizeiptr(maxVerticesPerSegment) * attributes.getVertSize();
+    segmentSize = (segmentSize + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+
+    #if !defined(EMSCRIPTEN) && defined(GL_MAP_PERSISTENT_BIT)
+    if (isBufferStorageSupported())
+    {
+        glBufferStorage(GL_ARRAY_BUFFER, segmentSize * nrOfSegments, NULL, PERSISTENT_MAP_FLAGS);
+        mapped = (unsigned char *) glMapBufferRange(GL_ARRAY_BUFFER, 0, segmentSize * nrOfSegments, PERSISTENT_MAP_FLAGS);
+        if (!mapped)
+        {
+            throw gu_err("Could not map StreamingBuffer");
+        }
+        fences.assign(nrOfSegments, 0);
+        return;
+    }
+    #endif
+
+    // orphaning only needs one segment, the driver gives the buffer new memory when the GPU is still using the old:
+    glBufferData(GL_ARRAY_BUFFER, segmentSize, NULL, GL_STREAM_DRAW);
+    cpuCopy.resize(segmentSize);
+}
+
+void StreamingBuffer::destroy()
+{
+    for (GLsync &fence : fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    fences.clear();
+
+    if (mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        mapped = nullptr;
+    }
+    // the GL keeps the memory alive until the GPU is done with it:
+    glDeleteBuffers(1, &id);
+    id = 0;
+}
+
+unsigned char *StreamingBuffer::beginWrite(int nrOfVerticesToWrite)
+{
+    if (writing)
+    {
+        throw gu_err("StreamingBuffer::beginWrite() was called twice without endWrite()");
+    }
+    if (nrOfVerticesToWrite > maxVerticesPerSegment)
+    {
+        destroy();
+        maxVerticesPerSegment = std::max(nrOfVerticesToWrite, maxVerticesPerSegment * 2);
+        create();
+    }
+    writing = true;
+    nrOfVertices = std::max(0, nrOfVerticesToWrite);
+
+    if (!mapped)
+    {
+        return cpuCopy.data();
+    }
+    // all draw calls using the current segment have been issued by now:
+    if (!fences[segment])
+    {
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    segment = (segment + 1) % nrOfSegments;
+    waitForFence(fences[segment]);
+
+    return mapped + segment * segmentSize;
+}
+
+void StreamingBuffer::endWrite()
+{
+    if (!writing)
+    {
+        throw gu_err("StreamingBuffer::endWrite() was called without beginWrite()");
+    }
+    writing = false;
+
+    if (mapped)
+    {
+        return; // the mapping is coherent, the GPU sees the writes without flushing
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glBufferData(GL_ARRAY_BUFFER, segmentSize, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(nrOfVertices) * attributes.getVertSize(), cpuCopy.data());
+}
+
+GLuint StreamingBuffer::getId() const
+{
+    return id;
+}
+
+GLintptr StreamingBuffer::getOffset() const
+{
+    return mapped ? segment * segmentSize : 0;
+}
+
+int StreamingBuffer::getNrOfVertices() const
+{
+    return nrOfVertices;
+}
+
+bool StreamingBuffer::isPersistentlyMapped() const
+{
+    return mapped != nullptr;
+}
+
+StreamingBuffer::~StreamingBuffer()
+{
+    destroy();
+}
@@ -0,0 +1,79 @@
+#ifndef GU_STREAMING_BUFFER_H
+#define GU_STREAMING_BUFFER_H
+
+#include "vert_attributes.h"
+
+#include <vector>
+
+/**
+ * A vertex buffer for data that is rewritten every frame, like particles and instance transforms.
+ *
+ * The buffer is divided into segments that are used as a ring: every frame the CPU writes into the next segment,
+ * while the GPU can still be reading the previous ones (triple buffering by default).
+ *
+ * If buffer storage (OpenGL 4.4) is available, the buffer is mapped persistently and beginWrite() returns a pointer straight into the buffer.
+ * A fence is placed after each segment is used, and beginWrite() only waits when the GPU is still using the segment it needs.
+ * Otherwise (WebGL or older contexts) beginWrite() returns a pointer into a CPU copy, which endWrite() uploads after orphaning the buffer.
+ *
+ * Usage:
+ *  StreamingBuffer transforms(instanceAttributes, maxInstances);
+ *  // every frame:
+ *  mat4 *out = (mat4 *) transforms.beginWrite(nrOfInstances);
+ *  ...
+ *  transforms.endWrite();
+ *  vertBuffer->usePerInstanceData(transforms);
+ *  mesh->renderInstances(nrOfInstances);
+ */
+class StreamingBuffer
+{
+  public:
+
+    const VertAttributes attributes;
+
+    StreamingBuffer(const VertAttributes &, int maxVerticesPerSegment, int nrOfSegments = 3);
+
+    /**
+     * Returns a pointer to room for 'nrOfVertices' vertices (interleaved like 'attributes') in the next segment.
+     * Waits if the GPU is still reading from that segment. The buffer grows if the segments are too small.
+     *
+     * All draw calls that read the previous segment must be issued before calling this, because that is when the previous segment is fenced.
+     */
+    unsigned char *beginWrite(int nrOfVertices);
+
+    // Makes the written vertices available to the GPU.
+    void endWrite();
+
+    GLuint getId() const;
+
+    // Offset in bytes of the segment that was written last.
+    GLintptr getOffset() const;
+
+    // The number of vertices that were written last.
+    int getNrOfVertices() const;
+
+    bool isPersistentlyMapped() const;
+
+    ~StreamingBuffer();
+
+  private:
+
+    GLuint id = 0;
+    int maxVerticesPerSegment = 0, nrOfSegments = 0;
+    GLsizeiptr segmentSize = 0;
+
+    int segment = 0, nrOfVertices = 0;
+    bool writing = false;
+
+    // null when the buffer is not persistently mapped:
+    unsigned char *mapped = nullptr;
+    std::vector<GLsync> fences;
+
+    // used instead of 'mapped' for orphaning:
+    std::vector<unsigned char> cpuCopy;
+
+    void create();
+
+    void destroy();
+};
+
+#endif
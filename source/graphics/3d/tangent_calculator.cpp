@@ -2,18 +2,46 @@
 #include "tangent_calculator.h"
 
 #include "mesh.h"
+#include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <algorithm>
 
 namespace TangentCalculator
 {
 
-/**
- * Returns the tangent of triangle (p0, p1, p2).
- * For each point in the triangle an UV point (texture coords) is required.
- * https://youtu.be/4DUfwAEx4Ts?t=423
- */
+namespace
+{
+
+struct TriangleSpace
+{
+    // Direction of increasing U, or zero when the UVs of the triangle are degenerate.
+    vec3 tangent = vec3(0.0f);
+    vec3 normal = vec3(0.0f);
+    // Whether the UVs are not mirrored.
+    bool bOrientationPreserving = true;
+};
+
+inline vec3 normalizeSafe(const vec3 &v)
+{
+    const float len = length(v);
+    return len > 0.0f ? v / len : vec3(0.0f);
+}
+
+// Angle of the corner at p0, projected onto the plane with normal 'n':
+inline float cornerAngle(const vec3 &p0, const vec3 &p1, const vec3 &p2, const vec3 &n)
+{
+    vec3 e1 = p1 - p0, e2 = p2 - p0;
+    e1 = normalizeSafe(e1 - dot(n, e1) * n);
+    e2 = normalizeSafe(e2 - dot(n, e2) * n);
+    return acos(clamp(dot(e1, e2), -1.0f, 1.0f));
+}
+
+}
+
 vec3 calculateTangent(
-    vec3 &p0, vec3 &p1, vec3 &p2,
-    vec2 &uv0, vec2 &uv1, vec2 &uv2)
+    const vec3 &p0, const vec3 &p1, const vec3 &p2,
+    const vec2 &uv0, const vec2 &uv1, const vec2 &uv2)
 {
     const vec3 deltaPos1 = vec3(p1 - p0);
     const vec3 deltaPos2 = vec3(p2 - p0);
@@ -37,53 +65,118 @@ void addTangentsToMesh(Mesh *mesh, int meshPart)
     auto &part = mesh->parts.at(meshPart);
 
     const VertAttributes &attrs = mesh->attributes;
+    if (!attrs.contains(VertAttributes::POSITION) || !attrs.contains(VertAttributes::TEX_COORDS))
+        throw gu_err("Cannot calculate tangents for " + mesh->name + " without positions and texture coordinates");
+
+    const bool bSign = attrs.contains(VertAttributes::TANGENT_AND_SIGN);
+    if (!bSign && !attrs.contains(VertAttributes::TANGENT))
+        throw gu_err("Cannot calculate tangents for " + mesh->name + " because it has no tangent attribute");
+
     const int posOffset = attrs.getOffset(VertAttributes::POSITION);
     const int texOffset = attrs.getOffset(VertAttributes::TEX_COORDS);
-    int tanOffset = 0;
+    const int tanOffset = attrs.getOffset(bSign ? VertAttributes::TANGENT_AND_SIGN : VertAttributes::TANGENT);
+    const bool bNormals = attrs.contains(VertAttributes::NORMAL);
+    const int normalOffset = bNormals ? attrs.getOffset(VertAttributes::NORMAL) : 0;
+
+    const int nrOfTriangles = part.indices.size() / 3;
+    if (nrOfTriangles == 0)
+        return;
+
+    const GLuint *indices = part.indices.data();
+    const int baseVertex = part.baseVertex;
+    const int nrOfVerts = *std::max_element(part.indices.begin(), part.indices.begin() + nrOfTriangles * 3) + 1;
 
+    const auto position = [&] (GLuint index) -> const vec3 & { return mesh->get<vec3>(baseVertex + index, posOffset); };
 
-    if (attrs.contains(VertAttributes::TANGENT_AND_SIGN))
+    // triangle corners around each vertex:
+    std::vector<int> cornerOffsets(nrOfVerts + 1, 0), corners(nrOfTriangles * 3);
+    for (int i = 0; i < nrOfTriangles * 3; i++)
+        cornerOffsets[indices[i] + 1]++;
+    for (int v = 0; v < nrOfVerts; v++)
+        cornerOffsets[v + 1] += cornerOffsets[v];
     {
-        tanOffset = attrs.getOffset(VertAttributes::TANGENT_AND_SIGN);
-        // set tangents to vec4(0, 0, 0, 1) first, to prevent NaN floats when adding in the next loop.
-        for (int i = 0; i < part.indices.size(); i += 3)
+        std::vector<int> fill(cornerOffsets.begin(), cornerOffsets.end() - 1);
+        for (int i = 0; i < nrOfTriangles * 3; i++)
+            corners[fill[indices[i]]++] = i;
+    }
+
+    std::vector<TriangleSpace> triangles(nrOfTriangles);
+
+    gu::parallel::forRanges(nrOfTriangles, 1024, [&] (int begin, int end) {
+        for (int triI = begin; triI < end; triI++)
         {
-            const int vertI0 = part.indices[i], vertI1 = part.indices[i + 1], vertI2 = part.indices[i + 2];
+            const GLuint i0 = indices[triI * 3], i1 = indices[triI * 3 + 1], i2 = indices[triI * 3 + 2];
+            const vec3 &p0 = position(i0);
+            const vec3 d1 = position(i1) - p0, d2 = position(i2) - p0;
+
+            const vec2 &uv0 = mesh->get<vec2>(baseVertex + i0, texOffset);
+            const vec2 t1 = mesh->get<vec2>(baseVertex + i1, texOffset) - uv0, t2 = mesh->get<vec2>(baseVertex + i2, texOffset) - uv0;
 
-            mesh->get<vec4>(vertI0, tanOffset) = vec4(0, 0, 0, 1);
-            mesh->get<vec4>(vertI1, tanOffset) = vec4(0, 0, 0, 1);
-            mesh->get<vec4>(vertI2, tanOffset) = vec4(0, 0, 0, 1);
+            TriangleSpace &triangle = triangles[triI];
+            triangle.normal = normalizeSafe(cross(d1, d2));
+
+            const float signedUVArea = t1.x * t2.y - t1.y * t2.x;
+            triangle.bOrientationPreserving = signedUVArea > 0.0f;
+            if (signedUVArea != 0.0f)
+                triangle.tangent = normalizeSafe((d1 * t2.y - d2 * t1.y) * (signedUVArea > 0.0f ? 1.0f : -1.0f));
         }
-    }
-    else
-    {
-        tanOffset = attrs.getOffset(VertAttributes::TANGENT);
-        // set tangents to vec3(0) first, to prevent NaN floats when adding in the next loop.
-        for (int i = 0; i < part.indices.size(); i += 3)
+    });
+
+    gu::parallel::forRanges(nrOfVerts, 1024, [&] (int begin, int end) {
+        for (int v = begin; v < end; v++)
         {
-            const int vertI0 = part.indices[i], vertI1 = part.indices[i + 1], vertI2 = part.indices[i + 2];
+            if (cornerOffsets[v] == cornerOffsets[v + 1])
+                continue; // not used by this part
 
-            mesh->get<vec3>(vertI0, tanOffset) = vec3(0);
-            mesh->get<vec3>(vertI1, tanOffset) = vec3(0);
-            mesh->get<vec3>(vertI2, tanOffset) = vec3(0);
-        }
-    }
+            const vec3 &p = position(v);
+            vec3 normal;
+            if (bNormals)
+                normal = normalizeSafe(mesh->get<vec3>(baseVertex + v, normalOffset));
+            else
+            {
+                normal = vec3(0.0f);
+                for (int c = cornerOffsets[v]; c < cornerOffsets[v + 1]; c++)
+                {
+                    const int triI = corners[c] / 3, corner = corners[c] % 3;
+                    const vec3 &faceNormal = triangles[triI].normal;
+                    normal += faceNormal * cornerAngle(
+                        p, position(indices[triI * 3 + (corner + 1) % 3]), position(indices[triI * 3 + (corner + 2) % 3]), faceNormal
+                    );
+                }
+                normal = normalizeSafe(normal);
+            }
 
-    for (int i = 0; i < part.indices.size(); i += 3)
-    {
-        const int vertI0 = part.indices[i], vertI1 = part.indices[i + 1], vertI2 = part.indices[i + 2];
-        auto p0 = mesh->get<vec3>(vertI0, posOffset),
-             p1 = mesh->get<vec3>(vertI1, posOffset),
-             p2 = mesh->get<vec3>(vertI2, posOffset);
-        auto uv0 = mesh->get<vec2>(vertI0, texOffset),
-             uv1 = mesh->get<vec2>(vertI1, texOffset),
-             uv2 = mesh->get<vec2>(vertI2, texOffset);
-        auto tangent = calculateTangent(p0, p1, p2, uv0, uv1, uv2);
-        mesh->get<vec3>(vertI0, tanOffset) += tangent;
-        mesh->get<vec3>(vertI1, tanOffset) += tangent;
-        mesh->get<vec3>(vertI2, tanOffset) += tangent;
-    }
-    mesh->normalizeVecAttribute<vec3>(tanOffset);
+            vec3 tangent(0.0f);
+            float orientation = 0.0f;
+            for (int c = cornerOffsets[v]; c < cornerOffsets[v + 1]; c++)
+            {
+                const int triI = corners[c] / 3, corner = corners[c] % 3;
+                const TriangleSpace &triangle = triangles[triI];
+                if (triangle.tangent == vec3(0.0f))
+                    continue;
+
+                const float angle = cornerAngle(
+                    p, position(indices[triI * 3 + (corner + 1) % 3]), position(indices[triI * 3 + (corner + 2) % 3]), normal
+                );
+                tangent += angle * normalizeSafe(triangle.tangent - dot(normal, triangle.tangent) * normal);
+                orientation += triangle.bOrientationPreserving ? angle : -angle;
+            }
+            tangent = normalizeSafe(tangent);
+
+            if (tangent == vec3(0.0f))
+            {
+                // no usable UVs around this vertex, any tangent perpendicular to the normal will do:
+                tangent = normalizeSafe(cross(abs(normal.x) < 0.9f ? mu::X : mu::Y, normal));
+                if (tangent == vec3(0.0f))
+                    tangent = mu::X;
+            }
+
+            if (bSign)
+                mesh->get<vec4>(baseVertex + v, tanOffset) = vec4(tangent, orientation < 0.0f ? -1.0f : 1.0f);
+            else
+                mesh->get<vec3>(baseVertex + v, tanOffset) = tangent;
+        }
+    });
 }
 
 } // namespace TangentCalculator
@@ -19,8 +19,18 @@ vec3 calculateTangent(
 );
 
 /**
- * Adds Tangents to mesh.
- * Mesh must have attributes including: VertAttributes::POSITION, VertAttributes::TEX_COORDS, VertAttributes::TANGENT.
+ * Adds Tangents to mesh, the same way as MikkTSpace (used by Blender and other bakers) does:
+ * per triangle corner the tangent is projected onto the plane of the vertex normal, and weighted by the angle of the corner.
+ *
+ * If the mesh has VertAttributes::TANGENT_AND_SIGN, the 4th component will be the bitangent sign (1 or -1):
+ *  bitangent = cross(normal, tangent.xyz) * tangent.w
+ *
+ * Unlike MikkTSpace, vertices are never split: a vertex that is shared by triangles with mirrored UVs gets the sign of the majority.
+ * Triangles and vertices are processed in parallel.
+ *
+ * Mesh must have attributes including: VertAttributes::POSITION, VertAttributes::TEX_COORDS,
+ * and VertAttributes::TANGENT or VertAttributes::TANGENT_AND_SIGN.
+ * VertAttributes::NORMAL is used if present, otherwise normals are calculated from the triangles.
  */
 void addTangentsToMesh(SharedMesh mesh, int meshPart);
 void addTangentsToMesh(Mesh *mesh, int meshPart=0);
@@ -29,6 +29,31 @@ class VertAttributes
         TANGENT_AND_SIGN = {"TANGENT_AND_SIGN", 4},
         BI_NORMAL = {"BI_NORMAL", 3},
 
+    /* Quantized versions of the attributes above, for smaller vertex buffers.
+     * They have the same names, so a VertAttributes can contain either the float or the quantized version.
+     * Loaders load floats and encode them afterwards, see VertAttributesConversion::quantize().
+     */
+        // Half floats. The 4th component is always 1.0 (padding, attributes should be 4-byte aligned):
+        POSITION_HALF = {"POSITION", 4, 8, GL_HALF_FLOAT},
+        // Normalized, only for coordinates between 0 and 1:
+        TEX_COORDS_UNORM = {"TEX_COORDS", 2, 4, GL_UNSIGNED_SHORT, GL_TRUE},
+        TEX_COORDS_HALF = {"TEX_COORDS", 2, 4, GL_HALF_FLOAT},
+        /*
+         * Octahedral encoded unit vectors. Decode in the vertex shader:
+         *
+         * vec3 octDecode(vec2 e)
+         * {
+         *     vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+         *     if (v.z < 0.0)
+         *         v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+         *     return normalize(v);
+         * }
+         */
+        NORMAL_OCT = {"NORMAL", 2, 4, GL_SHORT, GL_TRUE},
+        TANGENT_OCT = {"TANGENT", 2, 4, GL_SHORT, GL_TRUE},
+        // xy = octahedral encoded tangent, z = sign (-1 or 1), w = 0 (padding):
+        TANGENT_AND_SIGN_OCT = {"TANGENT_AND_SIGN", 4, 8, GL_SHORT, GL_TRUE},
+
         // Four bone ids (used by gltf model loader):
         JOINTS = {"JOINTS_0", 4, 4, GL_UNSIGNED_BYTE},
         // Four bone weights (used by gltf model loader):
@@ -0,0 +1,485 @@
+
+#include "vert_attributes_conversion.h"
+#include "mesh.h"
+
+#include "../../math/math_utils.h"
+#include "../../utils/gu_error.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace VertAttributesConversion
+{
+
+namespace
+{
+
+template<int elementSize>
+void copyElements(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, int count)
+{
+    for (int i = 0; i < count; i++)
+        memcpy(dst + i * dstStride, src + i * srcStride, elementSize);
+}
+
+void copyBytes(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, int elementSize, int count)
+{
+    if (srcStride == elementSize && dstStride == elementSize)
+    {
+        memcpy(dst, src, elementSize * count);
+        return;
+    }
+    // fixed sizes, so that memcpy() can be inlined:
+    switch (elementSize)
+    {
+        case 1: copyElements<1>(src, srcStride, dst, dstStride, count); break;
+        case 2: copyElements<2>(src, srcStride, dst, dstStride, count); break;
+        case 3: copyElements<3>(src, srcStride, dst, dstStride, count); break;
+        case 4: copyElements<4>(src, srcStride, dst, dstStride, count); break;
+        case 6: copyElements<6>(src, srcStride, dst, dstStride, count); break;
+        case 8: copyElements<8>(src, srcStride, dst, dstStride, count); break;
+        case 12: copyElements<12>(src, srcStride, dst, dstStride, count); break;
+        case 16: copyElements<16>(src, srcStride, dst, dstStride, count); break;
+        default:
+            for (int i = 0; i < count; i++)
+                memcpy(dst + i * dstStride, src + i * srcStride, elementSize);
+    }
+}
+
+// Normalized integers (like in glTF): unsigned: c / MAX, signed: max(c / MAX, -1)
+template<typename Int>
+constexpr float normalizeScale()
+{
+    return 1.0f / float(std::numeric_limits<Int>::max());
+}
+
+#ifdef __SSE2__
+
+// Loads 'nrOfComponents' integers and sign/zero-extends them to 32 bits. Never reads beyond the element.
+template<typename Int, int nrOfComponents>
+inline __m128i loadAsInt32s(const unsigned char *src)
+{
+    static_assert(sizeof(Int) <= 2);
+
+    GLuint packed[2] = { 0u, 0u };
+    memcpy(packed, src, sizeof(Int) * nrOfComponents);
+    __m128i ints = _mm_loadl_epi64((const __m128i *) packed);
+    const __m128i zero = _mm_setzero_si128();
+
+    if constexpr (std::is_same_v<Int, GLubyte>)
+    {
+        ints = _mm_unpacklo_epi8(ints, zero);
+        ints = _mm_unpacklo_epi16(ints, zero);
+    }
+    else if constexpr (std::is_same_v<Int, GLbyte>)
+    {
+        ints = _mm_unpacklo_epi8(ints, ints);
+        ints = _mm_unpacklo_epi16(ints, ints);
+        ints = _mm_srai_epi32(ints, 24);
+    }
+    else if constexpr (std::is_same_v<Int, GLushort>)
+    {
+        ints = _mm_unpacklo_epi16(ints, zero);
+    }
+    else
+    {
+        ints = _mm_unpacklo_epi16(ints, ints);
+        ints = _mm_srai_epi32(ints, 16);
+    }
+    return ints;
+}
+
+template<int nrOfComponents>
+inline void storeFloats(unsigned char *dst, __m128 floats)
+{
+    if constexpr (nrOfComponents == 4)
+    {
+        _mm_storeu_ps((float *) dst, floats);
+    }
+    else
+    {
+        float tmp[4];
+        _mm_storeu_ps(tmp, floats);
+        memcpy(dst, tmp, sizeof(float) * nrOfComponents);
+    }
+}
+
+#endif
+
+template<typename Int, int nrOfComponents, bool bNormalized>
+void intsToFloats(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, int count)
+{
+    int i = 0;
+
+    #ifdef __SSE2__
+    if constexpr (sizeof(Int) <= 2)
+    {
+        const __m128
+            scale = _mm_set1_ps(normalizeScale<Int>()),
+            minusOne = _mm_set1_ps(-1.0f);
+
+        for (; i < count; i++)
+        {
+            __m128 floats = _mm_cvtepi32_ps(loadAsInt32s<Int, nrOfComponents>(src + i * srcStride));
+            if constexpr (bNormalized)
+            {
+                floats = _mm_mul_ps(floats, scale);
+                if constexpr (std::is_signed_v<Int>)
+                    floats = _mm_max_ps(floats, minusOne);
+            }
+            storeFloats<nrOfComponents>(dst + i * dstStride, floats);
+        }
+    }
+    #endif
+
+    for (; i < count; i++)
+    {
+        Int ints[nrOfComponents];
+        memcpy(ints, src + i * srcStride, sizeof(ints));
+
+        float floats[nrOfComponents];
+        for (int c = 0; c < nrOfComponents; c++)
+        {
+            floats[c] = float(ints[c]);
+            if constexpr (bNormalized)
+            {
+                floats[c] *= normalizeScale<Int>();
+                if constexpr (std::is_signed_v<Int>)
+                    floats[c] = floats[c] < -1.0f ? -1.0f : floats[c];
+            }
+        }
+        memcpy(dst + i * dstStride, floats, sizeof(floats));
+    }
+}
+
+template<typename Int, bool bNormalized>
+void intsToFloats(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, int nrOfComponents, int count)
+{
+    switch (nrOfComponents)
+    {
+        case 1: intsToFloats<Int, 1, bNormalized>(src, srcStride, dst, dstStride, count); break;
+        case 2: intsToFloats<Int, 2, bNormalized>(src, srcStride, dst, dstStride, count); break;
+        case 3: intsToFloats<Int, 3, bNormalized>(src, srcStride, dst, dstStride, count); break;
+        case 4: intsToFloats<Int, 4, bNormalized>(src, srcStride, dst, dstStride, count); break;
+        default:
+            throw gu_err("Cannot convert " + std::to_string(nrOfComponents) + " components");
+    }
+}
+
+template<typename Int>
+void intsToFloats(const unsigned char *src, bool bNormalized, int srcStride, unsigned char *dst, int dstStride, int nrOfComponents, int count)
+{
+    if (bNormalized)
+        intsToFloats<Int, true>(src, srcStride, dst, dstStride, nrOfComponents, count);
+    else
+        intsToFloats<Int, false>(src, srcStride, dst, dstStride, nrOfComponents, count);
+}
+
+bool sameAttr(const VertAttr &a, const VertAttr &b)
+{
+    return a.name == b.name && a.size == b.size && a.byteSize == b.byteSize && a.type == b.type && a.normalized == b.normalized;
+}
+
+// Rounds to the nearest half float (ties to even). Based on float_to_half_fast3_rtne() by Fabian Giesen.
+GLushort floatToHalf(float value)
+{
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(float));
+
+    const uint32 sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    GLushort half;
+    if (bits >= (127u + 16u) << 23)
+    {
+        // Inf or NaN:
+        half = bits > 255u << 23 ? 0x7e00 : 0x7c00;
+    }
+    else if (bits < 113u << 23)
+    {
+        // subnormal or zero, let the FPU do the rounding:
+        const uint32 magicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        float magic, f;
+        memcpy(&magic, &magicBits, sizeof(float));
+        memcpy(&f, &bits, sizeof(float));
+        f += magic;
+        memcpy(&bits, &f, sizeof(float));
+        half = bits - magicBits;
+    }
+    else
+    {
+        const uint32 mantissaOdd = (bits >> 13) & 1u;
+        bits += ((15u - 127u) << 23) + 0xfffu + mantissaOdd;
+        half = bits >> 13;
+    }
+    return half | (sign >> 16);
+}
+
+// Components that are not in 'src' are set to 1.0
+void encodeHalfFloats(
+    const unsigned char *src, int srcStride, int nrOfSrcComponents,
+    unsigned char *dst, int dstStride, int nrOfDstComponents, int count
+)
+{
+    nrOfSrcComponents = min(nrOfSrcComponents, 4);
+    for (int i = 0; i < count; i++)
+    {
+        float floats[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        memcpy(floats, src + i * srcStride, sizeof(float) * nrOfSrcComponents);
+
+        GLushort halfs[8];
+        #ifdef __F16C__
+        _mm_storel_epi64((__m128i *) halfs, _mm_cvtps_ph(_mm_loadu_ps(floats), _MM_FROUND_TO_NEAREST_INT));
+        #else
+        for (int c = 0; c < 4; c++)
+            halfs[c] = floatToHalf(floats[c]);
+        #endif
+        memcpy(dst + i * dstStride, halfs, sizeof(GLushort) * nrOfDstComponents);
+    }
+}
+
+void encodeUnorm16(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, int nrOfComponents, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float floats[4];
+        memcpy(floats, src + i * srcStride, sizeof(float) * nrOfComponents);
+
+        GLushort unorms[4];
+        for (int c = 0; c < nrOfComponents; c++)
+            unorms[c] = GLushort(clamp(floats[c], 0.0f, 1.0f) * 65535.0f + 0.5f);
+
+        memcpy(dst + i * dstStride, unorms, sizeof(GLushort) * nrOfComponents);
+    }
+}
+
+vec2 signNotZero(const vec2 &v)
+{
+    return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 octEncode(const vec3 &v)
+{
+    const float l1 = abs(v.x) + abs(v.y) + abs(v.z);
+    if (l1 == 0.0f)
+        return vec2(0.0f);
+
+    const vec2 e = vec2(v) / l1;
+    return v.z >= 0.0f ? e : (1.0f - abs(vec2(e.y, e.x))) * signNotZero(e);
+}
+
+// Same as octDecode() in the shader (see VertAttributes::NORMAL_OCT)
+vec3 octDecode(const vec2 &e)
+{
+    vec3 v(e, 1.0f - abs(e.x) - abs(e.y));
+    if (v.z < 0.0f)
+    {
+        const vec2 xy = (1.0f - abs(vec2(v.y, v.x))) * signNotZero(vec2(v));
+        v.x = xy.x;
+        v.y = xy.y;
+    }
+    return normalize(v);
+}
+
+/**
+ * Octahedral encoding into 2 normalized shorts. Of the 4 nearest encodings, the one that decodes closest to the input is picked.
+ * If 'bWithSign', the 4th float of the input (tangent sign) is stored as a 3rd short, followed by a 0 short for padding.
+ */
+void encodeOctahedral(const unsigned char *src, int srcStride, unsigned char *dst, int dstStride, bool bWithSign, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        vec4 v(0.0f, 0.0f, 1.0f, 1.0f);
+        memcpy(&v, src + i * srcStride, sizeof(float) * (bWithSign ? 4 : 3));
+
+        const vec3 direction = dot(vec3(v), vec3(v)) > 0.0f ? normalize(vec3(v)) : mu::Z;
+        const vec2 scaled = octEncode(direction) * 32767.0f;
+
+        GLshort shorts[4] = { 0, 0, 0, 0 };
+        float bestDot = -2.0f;
+
+        for (int x = 0; x < 2; x++)
+        {
+            for (int y = 0; y < 2; y++)
+            {
+                const vec2 candidate = clamp(floor(scaled) + vec2(x, y), -32767.0f, 32767.0f);
+                const float d = dot(octDecode(candidate / 32767.0f), direction);
+                if (d > bestDot)
+                {
+                    bestDot = d;
+                    shorts[0] = GLshort(candidate.x);
+                    shorts[1] = GLshort(candidate.y);
+                }
+            }
+        }
+        if (bWithSign)
+            shorts[2] = v.w < 0.0f ? -32767 : 32767;
+
+        memcpy(dst + i * dstStride, shorts, sizeof(GLshort) * (bWithSign ? 4 : 2));
+    }
+}
+
+}
+
+int componentSize(GLenum componentType)
+{
+    switch (componentType)
+    {
+        case GL_FLOAT:
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+            return 4;
+        case GL_HALF_FLOAT:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            return 2;
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+bool canConvert(GLenum srcType, bool bSrcNormalized, GLenum dstType)
+{
+    if (srcType == dstType)
+        return componentSize(srcType) != 0;
+
+    if (dstType != GL_FLOAT)
+        return false;
+
+    switch (srcType)
+    {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            return true;
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+            return !bSrcNormalized;
+        default:
+            return false;
+    }
+}
+
+void copy(
+    const unsigned char *src, GLenum srcType, bool bSrcNormalized, int srcStride,
+    unsigned char *dst, GLenum dstType, int dstStride,
+    int nrOfComponents, int count
+)
+{
+    if (!canConvert(srcType, bSrcNormalized, dstType))
+        throw gu_err("Cannot convert components of type " + std::to_string(srcType) + " to " + std::to_string(dstType));
+
+    if (count <= 0)
+        return;
+
+    if (srcType == dstType)
+    {
+        copyBytes(src, srcStride, dst, dstStride, componentSize(srcType) * nrOfComponents, count);
+        return;
+    }
+    switch (srcType)
+    {
+        case GL_BYTE:
+            intsToFloats<GLbyte>(src, bSrcNormalized, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+        case GL_UNSIGNED_BYTE:
+            intsToFloats<GLubyte>(src, bSrcNormalized, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+        case GL_SHORT:
+            intsToFloats<GLshort>(src, bSrcNormalized, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+        case GL_UNSIGNED_SHORT:
+            intsToFloats<GLushort>(src, bSrcNormalized, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+        case GL_INT:
+            intsToFloats<GLint, false>(src, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+        case GL_UNSIGNED_INT:
+            intsToFloats<GLuint, false>(src, srcStride, dst, dstStride, nrOfComponents, count);
+            break;
+    }
+}
+
+bool isQuantized(const VertAttr &attr)
+{
+    for (auto *quantized : {
+        &VertAttributes::POSITION_HALF, &VertAttributes::TEX_COORDS_UNORM, &VertAttributes::TEX_COORDS_HALF,
+        &VertAttributes::NORMAL_OCT, &VertAttributes::TANGENT_OCT, &VertAttributes::TANGENT_AND_SIGN_OCT
+    })
+    {
+        if (sameAttr(attr, *quantized))
+            return true;
+    }
+    return false;
+}
+
+VertAttr unquantized(const VertAttr &attr)
+{
+    if (sameAttr(attr, VertAttributes::POSITION_HALF))
+        return VertAttributes::POSITION;
+    if (sameAttr(attr, VertAttributes::TEX_COORDS_UNORM) || sameAttr(attr, VertAttributes::TEX_COORDS_HALF))
+        return VertAttributes::TEX_COORDS;
+    if (sameAttr(attr, VertAttributes::NORMAL_OCT))
+        return VertAttributes::NORMAL;
+    if (sameAttr(attr, VertAttributes::TANGENT_OCT))
+        return VertAttributes::TANGENT;
+    if (sameAttr(attr, VertAttributes::TANGENT_AND_SIGN_OCT))
+        return VertAttributes::TANGENT_AND_SIGN;
+    return attr;
+}
+
+VertAttributes unquantized(const VertAttributes &attributes)
+{
+    VertAttributes result;
+    for (int i = 0; i < attributes.nrOfAttributes(); i++)
+        result.add(unquantized(attributes.get(i)));
+    return result;
+}
+
+void quantize(const VertData &src, VertData &dst)
+{
+    const int count = src.nrOfVertices();
+    if (dst.nrOfVertices() != count)
+        throw gu_err("Cannot quantize " + std::to_string(count) + " vertices into " + std::to_string(dst.nrOfVertices()) + " vertices");
+
+    if (count == 0)
+        return;
+
+    const int srcStride = src.attributes.getVertSize(), dstStride = dst.attributes.getVertSize();
+
+    for (int i = 0; i < dst.attributes.nrOfAttributes(); i++)
+    {
+        const VertAttr &dstAttr = dst.attributes.get(i);
+        const VertAttr srcAttr = src.attributes.contains(dstAttr) ? dstAttr : unquantized(dstAttr);
+
+        if (!src.attributes.contains(srcAttr))
+            throw gu_err("Cannot quantize vertices: source vertices have no " + srcAttr.name);
+
+        const unsigned char *srcBegin = &src.vertexData[src.attributes.getOffset(srcAttr)];
+        unsigned char *dstBegin = &dst.vertexData[dst.attributes.getOffset(dstAttr)];
+
+        if (sameAttr(srcAttr, dstAttr))
+            copy(srcBegin, srcAttr.type, srcAttr.normalized, srcStride, dstBegin, dstAttr.type, dstStride, dstAttr.size, count);
+        else if (dstAttr.type == GL_HALF_FLOAT)
+            encodeHalfFloats(srcBegin, srcStride, srcAttr.size, dstBegin, dstStride, dstAttr.size, count);
+        else if (sameAttr(dstAttr, VertAttributes::TEX_COORDS_UNORM))
+            encodeUnorm16(srcBegin, srcStride, dstBegin, dstStride, dstAttr.size, count);
+        else
+            encodeOctahedral(srcBegin, srcStride, dstBegin, dstStride, sameAttr(dstAttr, VertAttributes::TANGENT_AND_SIGN_OCT), count);
+    }
+}
+
+}
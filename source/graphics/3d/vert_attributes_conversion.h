@@ -0,0 +1,65 @@
+#ifndef VERT_ATTRIBUTES_CONVERSION_H
+#define VERT_ATTRIBUTES_CONVERSION_H
+
+#include "vert_attributes.h"
+
+class VertData;
+
+namespace VertAttributesConversion
+{
+
+/**
+ * Returns the size in bytes of one component of 'componentType' (GL_FLOAT, GL_UNSIGNED_SHORT, etc.), or 0 if unknown.
+ */
+int componentSize(GLenum componentType);
+
+/**
+ * Returns whether copy() can convert components of 'srcType' to components of 'dstType'.
+ */
+bool canConvert(GLenum srcType, bool bSrcNormalized, GLenum dstType);
+
+/**
+ * Copies 'count' elements of 'nrOfComponents' (1 to 4) components from 'src' to 'dst'.
+ *
+ * 'srcStride' and 'dstStride' are in bytes, so 'src' can be an interleaved glTF bufferView and 'dst' can be VertData.
+ *
+ * - If 'srcType' equals 'dstType' the bytes are copied as-is (one memcpy when both sides are tightly packed).
+ * - If 'dstType' is GL_FLOAT, integer components are converted to floats, and normalized to [0, 1] or [-1, 1] if 'bSrcNormalized'.
+ *   Byte and short conversions use SSE2 when available.
+ *
+ * Throws if the conversion is not supported, check canConvert() first.
+ */
+void copy(
+    const unsigned char *src, GLenum srcType, bool bSrcNormalized, int srcStride,
+    unsigned char *dst, GLenum dstType, int dstStride,
+    int nrOfComponents, int count
+);
+
+/**
+ * Returns whether 'attr' is one of the quantized attributes of VertAttributes (POSITION_HALF, NORMAL_OCT, etc.).
+ */
+bool isQuantized(const VertAttr &attr);
+
+/**
+ * Returns the float attribute that 'attr' is a quantized version of (e.g. NORMAL for NORMAL_OCT), or 'attr' itself.
+ */
+VertAttr unquantized(const VertAttr &attr);
+
+// Returns 'attributes' with every quantized attribute replaced by its float version.
+VertAttributes unquantized(const VertAttributes &attributes);
+
+/**
+ * Copies all vertices of 'src' to 'dst' (which must have the same number of vertices),
+ * and encodes the float attributes of 'src' into the quantized attributes of 'dst':
+ *
+ * - POSITION_HALF and TEX_COORDS_HALF: rounded to the nearest half float (using F16C when available).
+ * - TEX_COORDS_UNORM: clamped to [0, 1].
+ * - NORMAL_OCT, TANGENT_OCT and TANGENT_AND_SIGN_OCT: octahedral encoding, rounded to the closest decoded direction.
+ *
+ * Other attributes of 'dst' are copied with copy(). Throws if 'src' does not contain an attribute of 'dst'.
+ */
+void quantize(const VertData &src, VertData &dst);
+
+}
+
+#endif
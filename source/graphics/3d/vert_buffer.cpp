@@ -1,8 +1,15 @@
 
 #include "vert_buffer.h"
 #include "mesh.h"
+#include "streaming_buffer.h"
+#include "vert_attributes_conversion.h"
 
 #include "../../utils/gu_error.h"
+#include "../../utils/parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 #ifndef GU_PUT_A_SOCK_IN_IT
 #include <iostream>
@@ -36,6 +43,11 @@ void VertBuffer::bind()
     }
 }
 
+GLuint VertBuffer::getVaoId() const
+{
+    return vaoId;
+}
+
 VertBuffer *VertBuffer::add(SharedMesh mesh)
 {
     if (mesh->vertBuffer != nullptr)
@@ -43,99 +55,274 @@ VertBuffer *VertBuffer::add(SharedMesh mesh)
         throw gu_err(mesh->name + " was already added to a VertBuffer");
     }
 
-#ifdef EMSCRIPTEN
-    if (mesh->nrOfVertices() > std::numeric_limits<GLushort>::max())
-    {
-        std::cerr << "WARNING: Mesh '" << mesh->name << "' has " << mesh->nrOfVertices() << " vertices. (More than max of unsigned short)." << std::endl;
-    }
-    else if (next || nrOfVerts + mesh->nrOfVertices() > std::numeric_limits<GLushort>::max())
+    if (!fitIndexTypesToPosition(*mesh))
     {
         if (!next) next = VertBuffer::with(attrs);
         next->add(mesh);
+        if (uploaded && !next->isUploaded())
+        {
+            next->upload(false);
+        }
         return this;
     }
-#endif
-
-    meshes.push_back(mesh);
-
-    mesh->inBuffer.baseVertex = nrOfVerts;
-    mesh->inBuffer.numVertsReserved = mesh->nrOfVertices();
-    nrOfVerts += mesh->inBuffer.numVertsReserved;
 
     for (auto &part : mesh->parts)
     {
-        part.inBuffer.indicesOffset = nrOfIndices * sizeof(GLushort);
-        part.inBuffer.numIndices = part.indices.size();
-        nrOfIndices += part.inBuffer.numIndices;
+        const GLuint indexSize = VertAttributesConversion::componentSize(part.indexType);
+        if (indexSize == 0 || part.indexType == GL_BYTE || part.indexType == GL_SHORT || part.indexType == GL_INT)
+        {
+            throw gu_err("Mesh part has an invalid index type. Mesh: " + mesh->name + " part: " + part.name);
+        }
     }
+    allocateRangesFor(*mesh);
 
+    meshes.push_back(mesh.get());
     mesh->vertBuffer = this;
+
+    if (uploaded)
+    {
+        uploadMesh(*mesh, false);
+    }
     return this;
 }
 
-void VertBuffer::upload(bool disposeOfflineData)
+bool VertBuffer::fitIndexTypesToPosition(Mesh &mesh)
 {
-    if (vboId)
+#ifdef EMSCRIPTEN
+    // The base vertex is added to the indices (see baseVertexInIndices()), so the index type has to fit the position of the vertices in this VertBuffer.
+    if (mesh.nrOfVertices() > std::numeric_limits<GLushort>::max())
     {
-        throw gu_err("VertBuffer already uploaded");
+        // Parts split by Mesh::splitPartsForIndexType() have base vertices that do not fit in a smaller type, but WebGL2 supports unsigned int indices:
+        for (auto &part : mesh.parts)
+        {
+            part.indexType = GL_UNSIGNED_INT;
+        }
+        return true;
+    }
+    // the vertices must stay below the max of unsigned short:
+    GLuint baseVertex = 0;
+    if (!vertexRanges.find(mesh.nrOfVertices(), 1, baseVertex))
+    {
+        baseVertex = vertexRanges.getCapacity() - vertexRanges.getFreeAtEnd();
+    }
+    if (baseVertex + mesh.nrOfVertices() > std::numeric_limits<GLushort>::max())
+    {
+        return false;
+    }
+    if (baseVertex + mesh.nrOfVertices() > std::numeric_limits<GLubyte>::max())
+    {
+        for (auto &part : mesh.parts)
+        {
+            if (part.indexType == GL_UNSIGNED_BYTE)
+            {
+                part.indexType = GL_UNSIGNED_SHORT;
+            }
+        }
     }
+#endif
+    return true;
+}
 
-    #ifndef GU_PUT_A_SOCK_IN_IT
-    std::cout << "Uploading vbo\n";
-    #endif
-    bind();
+void VertBuffer::remove(const SharedMesh &mesh)
+{
+    if (mesh->vertBuffer != this)
+    {
+        throw gu_err("Cannot remove " + mesh->name + " because it is not in this VertBuffer");
+    }
+    freeRangesOf(*mesh);
+    meshes.erase(std::find(meshes.begin(), meshes.end(), mesh.get()));
+    mesh->vertBuffer = nullptr;
+}
 
-    glGenBuffers(1, &vboId);    // create VertexBuffer
-    glBindBuffer(GL_ARRAY_BUFFER, vboId);
-    glBufferData(GL_ARRAY_BUFFER, nrOfVerts * attrs.getVertSize(), NULL, vboUsage);
+void VertBuffer::allocateRangesFor(Mesh &mesh)
+{
+    mesh.inBuffer.numVertsReserved = mesh.nrOfVertices();
+    mesh.inBuffer.baseVertex = allocate(vertexRanges, mesh.inBuffer.numVertsReserved, 1);
+    mesh.inBuffer.vertOffset = mesh.inBuffer.baseVertex * attrs.getVertSize();
 
-    glGenBuffers(1, &iboId);    // create IndexBuffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * nrOfIndices, NULL, iboUsage);
+    for (auto &part : mesh.parts)
+    {
+        // indices must be aligned to their size:
+        const GLuint indexSize = VertAttributesConversion::componentSize(part.indexType);
+        part.inBuffer.numIndices = part.indices.size();
+        part.inBuffer.indicesOffset = allocate(indexRanges, part.inBuffer.numIndices * indexSize, indexSize);
+    }
+}
+
+void VertBuffer::freeRangesOf(Mesh &mesh)
+{
+    vertexRanges.free(mesh.inBuffer.baseVertex, mesh.inBuffer.numVertsReserved);
+    mesh.inBuffer.numVertsReserved = 0;
+
+    for (auto &part : mesh.parts)
+    {
+        const GLuint indexSize = VertAttributesConversion::componentSize(part.indexType);
+        indexRanges.free(part.inBuffer.indicesOffset, part.inBuffer.numIndices * indexSize);
+        part.inBuffer.numIndices = 0;
+    }
+}
 
-    GLuint vertsOffset = 0, indicesOffset = 0;
-    for (const std::weak_ptr<Mesh> m : meshes)
+GLuint VertBuffer::allocate(RangeAllocator &allocator, GLuint size, GLuint alignment)
+{
+    GLuint offset = 0;
+    if (size == 0)
     {
-        if (m.expired())
+        return offset;
+    }
+    if (!allocator.find(size, alignment, offset))
+    {
+        // extend the free range at the end:
+        offset = allocator.getCapacity() - allocator.getFreeAtEnd();
+        offset = (offset + alignment - 1) / alignment * alignment;
+
+        GLuint newCapacity = offset + size;
+        if (uploaded)
         {
-            throw gu_err("Trying to upload a VertBuffer whose Meshes are already destroyed");
+            // grow by at least 50%, so that the buffer is not copied again for every mesh that is added:
+            newCapacity = std::max(newCapacity, allocator.getCapacity() + allocator.getCapacity() / 2);
+            growBuffer(&allocator == &indexRanges, newCapacity);
         }
+        allocator.grow(newCapacity);
+    }
+    allocator.take(offset, size);
+    return offset;
+}
 
-        const SharedMesh mesh = m.lock();
+void VertBuffer::growBuffer(bool indices, GLuint newCapacity)
+{
+    const RangeAllocator &allocator = indices ? indexRanges : vertexRanges;
+    const GLsizeiptr unitSize = indices ? 1 : attrs.getVertSize();
+    GLuint &bufferId = indices ? iboId : vboId;
+
+    GLuint newBufferId = 0;
+    glGenBuffers(1, &newBufferId);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferId);
+    glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * unitSize, NULL, indices ? iboUsage : vboUsage);
+
+    // the free range at the end does not have to be copied:
+    const GLsizeiptr bytesToCopy = (allocator.getCapacity() - allocator.getFreeAtEnd()) * unitSize;
+    if (bytesToCopy > 0)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, bufferId);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytesToCopy);
+    }
+    glDeleteBuffers(1, &bufferId);
+    bufferId = newBufferId;
 
-        if (mesh->nrOfVertices() != mesh->inBuffer.numVertsReserved)
+    // let the vertex array use the new buffer:
+    bind();
+    if (indices)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vboId);
+        setAttrPointersAndEnable(attrs);
+    }
+}
+
+namespace
+{
+
+template<typename Index>
+void convertIndices(const Mesh::Part &part, GLuint baseVertex, unsigned char *out)
+{
+    Index *outIndices = (Index *) out;
+
+    for (int i = 0; i < part.indices.size(); i++)
+    {
+        const GLuint index = part.indices[i] + baseVertex;
+        if (index > std::numeric_limits<Index>::max())
         {
-            throw gu_err("Mesh vertices have resized between .add() and .upload() for " + mesh->name);
+            throw gu_err("Index " + std::to_string(index) + " does not fit in the index type of part: " + part.name + ". Use Mesh::splitPartsForIndexType()");
         }
+        outIndices[i] = index;
+    }
+}
 
-        const GLuint vertsSize = mesh->inBuffer.numVertsReserved * attrs.getVertSize();
-        mesh->inBuffer.vertOffset = vertsOffset;
-        glBufferSubData(GL_ARRAY_BUFFER, mesh->inBuffer.vertOffset, vertsSize, mesh->vertexData.data());
-        vertsOffset += vertsSize;
+// Writes the indices of the part to 'out', converted to the index type of the part.
+void convertIndices(const Mesh::Part &part, GLuint baseVertex, unsigned char *out)
+{
+    switch (part.indexType)
+    {
+        case GL_UNSIGNED_BYTE:
+            convertIndices<GLubyte>(part, baseVertex, out);
+            break;
+        case GL_UNSIGNED_SHORT:
+            convertIndices<GLushort>(part, baseVertex, out);
+            break;
+        default:
+            convertIndices<GLuint>(part, baseVertex, out);
+            break;
+    }
+}
 
-        for (auto &part : mesh->parts)
-        {
-            if (part.indices.size() != part.inBuffer.numIndices)
-            {
-                throw gu_err("Mesh part indices have resized between .add() and .upload() for mesh: " + mesh->name + " part: " + part.name);
-            }
+GLuint baseVertexInIndices(int meshBaseVertex, const Mesh::Part &part)
+{
+    #ifdef EMSCRIPTEN
+    // WebGL has no glDrawElementsBaseVertex(), so the base vertex is added to the indices:
+    return meshBaseVertex + part.baseVertex;
+    #else
+    return 0;
+    #endif
+}
 
-            #if EMSCRIPTEN
-            for (auto &i : part.indices) i += mesh->inBuffer.baseVertex;
-            if (!disposeOfflineData) for (auto &i : part.indices) i -= mesh->inBuffer.baseVertex;
-            #endif
+void ensureSameNrOfIndices(const Mesh &mesh, const Mesh::Part &part, int nrOfIndicesInBuffer)
+{
+    if (part.indices.size() != nrOfIndicesInBuffer)
+    {
+        throw gu_err("Mesh part indices have resized between .add() and .upload() for mesh: " + mesh.name + " part: " + part.name);
+    }
+}
 
-            const GLuint indicesSize = part.inBuffer.numIndices * sizeof(GLushort);
+}
 
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, part.indices.data());
-            indicesOffset += indicesSize;
+void VertBuffer::upload(bool disposeOfflineData)
+{
+    if (vboId)
+    {
+        throw gu_err("VertBuffer already uploaded");
+    }
+
+    const GLsizeiptr vertexBytes = GLsizeiptr(vertexRanges.getCapacity()) * attrs.getVertSize();
+    const GLsizeiptr indexBytes = indexRanges.getCapacity();
+
+    // the contents of both buffers are assembled in one staging allocation, so that each buffer is uploaded with one call:
+    std::vector<unsigned char> staging(vertexBytes + indexBytes);
+    unsigned char *vertexImage = staging.data();
+    unsigned char *indexImage = staging.data() + vertexBytes;
+
+    gu::parallel::forEach(meshes.size(), 4, [&] (int i) {
+        Mesh &mesh = *meshes[i];
+        if (mesh.nrOfVertices() != mesh.inBuffer.numVertsReserved)
+        {
+            throw gu_err("Mesh vertices have resized between .add() and .upload() for " + mesh.name);
+        }
+        memcpy(vertexImage + mesh.inBuffer.vertOffset, mesh.vertexData.data(), mesh.vertexData.size());
+
+        for (auto &part : mesh.parts)
+        {
+            ensureSameNrOfIndices(mesh, part, part.inBuffer.numIndices);
+            convertIndices(part, baseVertexInIndices(mesh.inBuffer.baseVertex, part), indexImage + part.inBuffer.indicesOffset);
         }
 
         if (disposeOfflineData)
         {
-            mesh->disposeOfflineData();
+            mesh.disposeOfflineData();
         }
-    }
+    });
+
+    bind();
+
+    glGenBuffers(1, &vboId);    // create VertexBuffer
+    glBindBuffer(GL_ARRAY_BUFFER, vboId);
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexImage, vboUsage);
+
+    glGenBuffers(1, &iboId);    // create IndexBuffer
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexImage, iboUsage);
+
     setAttrPointersAndEnable(attrs);
     uploaded = true;
     if (next)
@@ -144,9 +331,44 @@ void VertBuffer::upload(bool disposeOfflineData)
     }
 }
 
-void VertBuffer::setAttrPointersAndEnable(VertAttributes &attrs, unsigned int divisor, unsigned int locationOffset)
+void VertBuffer::uploadMesh(Mesh &mesh, bool disposeOfflineData)
+{
+    if (mesh.nrOfVertices() != mesh.inBuffer.numVertsReserved)
+    {
+        throw gu_err("Mesh vertices have resized between .add() and .upload() for " + mesh.name);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vboId);
+    glBufferSubData(GL_ARRAY_BUFFER, mesh.inBuffer.vertOffset, GLsizeiptr(mesh.inBuffer.numVertsReserved) * attrs.getVertSize(), mesh.vertexData.data());
+
+    uploadIndices(mesh);
+
+    if (disposeOfflineData)
+    {
+        mesh.disposeOfflineData();
+    }
+}
+
+void VertBuffer::uploadIndices(Mesh &mesh)
 {
-    GLint offset = 0;
+    bind();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+
+    std::vector<unsigned char> indexBytes;
+
+    for (auto &part : mesh.parts)
+    {
+        ensureSameNrOfIndices(mesh, part, part.inBuffer.numIndices);
+
+        indexBytes.resize(part.indices.size() * VertAttributesConversion::componentSize(part.indexType));
+        convertIndices(part, baseVertexInIndices(mesh.inBuffer.baseVertex, part), indexBytes.data());
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, part.inBuffer.indicesOffset, indexBytes.size(), indexBytes.data());
+    }
+}
+
+void VertBuffer::setAttrPointersAndEnable(const VertAttributes &attrs, unsigned int divisor, unsigned int locationOffset, GLintptr bufferOffset)
+{
+    GLintptr offset = bufferOffset;
     for (int i = locationOffset; i < locationOffset + attrs.nrOfAttributes(); i++)
     {
         auto &attr = attrs.get(i - locationOffset);
@@ -221,12 +443,17 @@ GLuint VertBuffer::uploadPerInstanceData(const VertData &data, GLuint advanceRat
     return id;
 }
 
-void VertBuffer::onMeshDestroyed()
+void VertBuffer::onMeshDestroyed(Mesh *mesh)
 {
-    #ifndef GU_PUT_A_SOCK_IN_IT
-    std::cout << "A mesh in this VB was destroyed\n";
-    #endif
-    if (!inUse())
+    auto it = std::find(meshes.begin(), meshes.end(), mesh);
+    if (it == meshes.end())
+    {
+        return; // a copy of a mesh in this VertBuffer
+    }
+    freeRangesOf(*mesh);
+    meshes.erase(it);
+
+    if (!inUse() && deleteWhenUnused)
     {
         delete this;
     }
@@ -239,14 +466,7 @@ bool VertBuffer::isUploaded() const
 
 bool VertBuffer::inUse() const
 {
-    for (std::weak_ptr<Mesh> m : meshes)
-    {
-        if (!m.expired())
-        {
-            return true;
-        }
-    }
-    return false;
+    return !meshes.empty();
 }
 
 VertBuffer::~VertBuffer()
@@ -256,23 +476,21 @@ VertBuffer::~VertBuffer()
         std::cerr << "WARNING: Deleting a VertBuffer that is still in use by [";
         bool first = true;
 
-        for (std::weak_ptr<Mesh> m : meshes)
+        for (Mesh *mesh : meshes)
         {
-            if (!m.expired())
+            if (!first)
             {
-                if (!first)
-                {
-                    std::cerr << ", ";
-                }
-                std::cerr << m.lock()->name;
-                first = false;
+                std::cerr << ", ";
             }
+            std::cerr << mesh->name;
+            first = false;
         }
         std::cerr << "]" << std::endl;
     }
-    #ifndef GU_PUT_A_SOCK_IN_IT
-    std::cout << "Deleting VertBuffer: vao & vbo & ibo\n";
-    #endif
+    for (Mesh *mesh : meshes)
+    {
+        mesh->vertBuffer = nullptr;
+    }
     glDeleteVertexArrays(1, &vaoId);
     glDeleteBuffers(1, &vboId);
     glDeleteBuffers(1, &iboId);
@@ -298,6 +516,23 @@ void VertBuffer::usePerInstanceData(GLuint instanceDataId, GLuint advanceRate)
     setAttrPointersAndEnable(instanceVboAttrs[instanceDataId], advanceRate, attrs.nrOfAttributes());
 }
 
+void VertBuffer::usePerInstanceData(const StreamingBuffer &streamingBuffer, GLuint advanceRate, int firstVertex)
+{
+    bind();
+    glBindBuffer(GL_ARRAY_BUFFER, streamingBuffer.getId());
+    const GLintptr offset = streamingBuffer.getOffset() + GLintptr(firstVertex) * streamingBuffer.attributes.getVertSize();
+    setAttrPointersAndEnable(streamingBuffer.attributes, advanceRate, attrs.nrOfAttributes(), offset);
+}
+
+void VertBuffer::stopUsingPerInstanceData(const VertAttributes &instanceAttributes)
+{
+    bind();
+    for (int i = 0; i < instanceAttributes.nrOfAttributes(); i++)
+    {
+        glDisableVertexAttribArray(attrs.nrOfAttributes() + i);
+    }
+}
+
 void VertBuffer::deletePerInstanceData(GLuint instanceDataId)
 {
     bind();
@@ -307,26 +542,231 @@ void VertBuffer::deletePerInstanceData(GLuint instanceDataId)
 
 void VertBuffer::reuploadVertices(const SharedMesh &mesh, int numVerticesToReuploadOrAll)
 {
+    if (mesh->vertBuffer != this)
+    {
+        throw gu_err("Cannot reupload vertices of " + mesh->name + " because it is not in this VertBuffer");
+    }
+    const uint numVerticesToReupload = numVerticesToReuploadOrAll == -1 ? mesh->nrOfVertices() : numVerticesToReuploadOrAll;
+    const uint numBytesToUpload = numVerticesToReupload * attrs.getVertSize();
+
+    if (numVerticesToReupload > mesh->inBuffer.numVertsReserved)
+    {
+        #ifdef EMSCRIPTEN
+        // The base vertex is part of the indices, so the mesh is added again: at its new position its index types might have to be promoted,
+        // or it might have to move to 'next'. add() uploads all vertices and indices.
+        remove(mesh);
+        add(mesh);
+        return;
+        #else
+        // move the mesh to a bigger range, the old vertices do not have to be copied because they are all reuploaded:
+        vertexRanges.free(mesh->inBuffer.baseVertex, mesh->inBuffer.numVertsReserved);
+        mesh->inBuffer.numVertsReserved = numVerticesToReupload;
+        mesh->inBuffer.baseVertex = allocate(vertexRanges, numVerticesToReupload, 1);
+        mesh->inBuffer.vertOffset = mesh->inBuffer.baseVertex * attrs.getVertSize();
+        #endif
+    }
     bind();
     glBindBuffer(GL_ARRAY_BUFFER, vboId);
+    glBufferSubData(GL_ARRAY_BUFFER, mesh->inBuffer.vertOffset, numBytesToUpload, mesh->vertexData.data());
+}
 
-    const uint numVerticesToReupload = numVerticesToReuploadOrAll == -1 ? mesh->nrOfVertices() : numVerticesToReuploadOrAll;
-    const uint numBytesToUpload = numVerticesToReupload * attrs.getVertSize();
+void VertBuffer::reuploadVertices(const SharedMesh &mesh, int firstVertex, int nrOfVertices)
+{
+    if (mesh->vertBuffer != this)
+    {
+        throw gu_err("Cannot reupload vertices of " + mesh->name + " because it is not in this VertBuffer");
+    }
+    if (firstVertex < 0 || nrOfVertices < 0 || firstVertex + nrOfVertices > mesh->inBuffer.numVertsReserved
+        || firstVertex + nrOfVertices > mesh->nrOfVertices())
+    {
+        throw gu_err("Cannot reupload vertices [" + std::to_string(firstVertex) + ", " + std::to_string(firstVertex + nrOfVertices)
+            + ") of " + mesh->name + ", it has " + std::to_string(mesh->inBuffer.numVertsReserved) + " vertices in the buffer");
+    }
+    if (nrOfVertices == 0)
+    {
+        return;
+    }
+    bind();
+    glBindBuffer(GL_ARRAY_BUFFER, vboId);
+
+    const GLuint vertSize = attrs.getVertSize();
+    glBufferSubData(
+        GL_ARRAY_BUFFER, mesh->inBuffer.vertOffset + GLintptr(firstVertex) * vertSize, GLsizeiptr(nrOfVertices) * vertSize,
+        &mesh->vertexData[size_t(firstVertex) * vertSize]
+    );
+}
+
+namespace
+{
+
+void copyWithinBuffer(GLuint bufferId, GLintptr from, GLintptr to, GLsizeiptr size)
+{
+    // copying within the same buffer is allowed, as long as the ranges do not overlap:
+    glBindBuffer(GL_COPY_READ_BUFFER, bufferId);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferId);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from, to, size);
+}
+
+}
+
+bool VertBuffer::defragment(GLuint maxBytesToMove)
+{
+    GLuint bytesMoved = 0;
 
-    if (!meshes.empty() && !meshes.back().expired() && meshes.back().lock() == mesh)
+    #ifndef EMSCRIPTEN
+    const GLuint vertSize = attrs.getVertSize();
+
+    // move the meshes at the end of the buffer first:
+    std::vector<Mesh *> meshesToMove(meshes);
+    std::sort(meshesToMove.begin(), meshesToMove.end(), [] (const Mesh *a, const Mesh *b) {
+        return a->inBuffer.baseVertex > b->inBuffer.baseVertex;
+    });
+    for (Mesh *mesh : meshesToMove)
     {
-        // We can resize the buffer because this mesh is the last.
-        if (numVerticesToReupload > mesh->inBuffer.numVertsReserved)
+        if (bytesMoved >= maxBytesToMove)
+        {
+            break;
+        }
+        const GLuint size = mesh->inBuffer.numVertsReserved;
+        GLuint offset = 0;
+        if (size == 0 || !vertexRanges.find(size, 1, offset) || offset >= GLuint(mesh->inBuffer.baseVertex))
+        {
+            continue;
+        }
+        vertexRanges.take(offset, size);
+        if (uploaded)
         {
-            nrOfVerts = nrOfVerts - mesh->inBuffer.numVertsReserved + numVerticesToReupload;
-            glBufferData(GL_ARRAY_BUFFER, long(nrOfVerts) * attrs.getVertSize(), NULL, vboUsage);
+            copyWithinBuffer(vboId, GLintptr(mesh->inBuffer.baseVertex) * vertSize, GLintptr(offset) * vertSize, GLsizeiptr(size) * vertSize);
+        }
+        vertexRanges.free(mesh->inBuffer.baseVertex, size);
+
+        mesh->inBuffer.baseVertex = offset;
+        mesh->inBuffer.vertOffset = offset * vertSize;
+        bytesMoved += size * vertSize;
+    }
+    #endif
 
-            mesh->inBuffer.numVertsReserved = numVerticesToReupload;
+    std::vector<Mesh::Part *> partsToMove;
+    for (Mesh *mesh : meshes)
+    {
+        for (auto &part : mesh->parts)
+        {
+            partsToMove.push_back(&part);
         }
     }
-    else if (numVerticesToReupload > mesh->inBuffer.numVertsReserved)
+    std::sort(partsToMove.begin(), partsToMove.end(), [] (const Mesh::Part *a, const Mesh::Part *b) {
+        return a->inBuffer.indicesOffset > b->inBuffer.indicesOffset;
+    });
+    for (Mesh::Part *part : partsToMove)
     {
-        throw gu_err("Cannot resize buffer for a mesh that is not last in the buffer. Mesh: " + mesh->name);
+        if (bytesMoved >= maxBytesToMove)
+        {
+            break;
+        }
+        const GLuint indexSize = VertAttributesConversion::componentSize(part->indexType);
+        const GLuint size = part->inBuffer.numIndices * indexSize;
+        GLuint offset = 0;
+        if (size == 0 || !indexRanges.find(size, indexSize, offset) || offset >= GLuint(part->inBuffer.indicesOffset))
+        {
+            continue;
+        }
+        indexRanges.take(offset, size);
+        if (uploaded)
+        {
+            copyWithinBuffer(iboId, part->inBuffer.indicesOffset, offset, size);
+        }
+        indexRanges.free(part->inBuffer.indicesOffset, size);
+
+        part->inBuffer.indicesOffset = offset;
+        bytesMoved += size;
     }
-    glBufferSubData(GL_ARRAY_BUFFER, mesh->inBuffer.vertOffset, numBytesToUpload, mesh->vertexData.data());
+    return bytesMoved > 0;
+}
+
+bool VertBuffer::RangeAllocator::find(GLuint size, GLuint alignment, GLuint &offset) const
+{
+    for (auto &[rangeOffset, rangeSize] : freeRanges)
+    {
+        const GLuint aligned = (rangeOffset + alignment - 1) / alignment * alignment;
+        if (aligned + size <= rangeOffset + rangeSize)
+        {
+            offset = aligned;
+            return true;
+        }
+    }
+    return false;
+}
+
+void VertBuffer::RangeAllocator::take(GLuint offset, GLuint size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    auto it = freeRanges.upper_bound(offset);
+    if (it == freeRanges.begin() || std::prev(it)->first + std::prev(it)->second < offset + size)
+    {
+        throw gu_err("Range [" + std::to_string(offset) + ", " + std::to_string(offset + size) + ") of VertBuffer is not free");
+    }
+    --it;
+    const GLuint rangeOffset = it->first, rangeEnd = it->first + it->second;
+    freeRanges.erase(it);
+
+    if (offset > rangeOffset)
+    {
+        freeRanges[rangeOffset] = offset - rangeOffset;
+    }
+    if (offset + size < rangeEnd)
+    {
+        freeRanges[offset + size] = rangeEnd - offset - size;
+    }
+}
+
+void VertBuffer::RangeAllocator::free(GLuint offset, GLuint size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    // merge with the neighbouring free ranges:
+    auto next = freeRanges.lower_bound(offset);
+    if (next != freeRanges.end() && next->first == offset + size)
+    {
+        size += next->second;
+        next = freeRanges.erase(next);
+    }
+    if (next != freeRanges.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += size;
+            return;
+        }
+    }
+    freeRanges[offset] = size;
+}
+
+void VertBuffer::RangeAllocator::grow(GLuint newCapacity)
+{
+    if (newCapacity > capacity)
+    {
+        free(capacity, newCapacity - capacity);
+        capacity = newCapacity;
+    }
+}
+
+GLuint VertBuffer::RangeAllocator::getCapacity() const
+{
+    return capacity;
+}
+
+GLuint VertBuffer::RangeAllocator::getFreeAtEnd() const
+{
+    if (freeRanges.empty())
+    {
+        return 0;
+    }
+    auto &last = *freeRanges.rbegin();
+    return last.first + last.second == capacity ? last.second : 0;
 }
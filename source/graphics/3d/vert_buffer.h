@@ -5,8 +5,15 @@
 #include "vert_attributes.h"
 #include "shared_3d.h"
 
+#include <map>
+
 /**
  * A class that encapsulates OpenGL VertexArrayObjects, VertexBufferObjects, IndexBufferObjects and Instanced Arrays
+ *
+ * The vertex and index buffers are sub-allocated: every Mesh (and every Part of it) gets a range in the buffers,
+ * and ranges of meshes that are removed or destroyed are reused by meshes added later.
+ * Meshes can be added and removed after the VertBuffer is uploaded, so one VertBuffer can hold all the meshes (with the same VertAttributes) of a whole level.
+ * The buffers grow (on the GPU) when needed, and holes can be closed again with defragment().
  */
 class VertBuffer
 {
@@ -24,9 +31,22 @@ class VertBuffer
     // try not to use this. It is more efficient to put more meshes (with the same VertAttributes) in 1 VertBuffer
     static void uploadSingleMesh(SharedMesh);
 
-    // adds mesh to Meshes that are going to be uploaded when upload() is called.
+    // If false, the VertBuffer will stay alive when all its meshes are destroyed, so new meshes can be added later.
+    bool deleteWhenUnused = true;
+
+    /**
+     * adds mesh to Meshes that are going to be uploaded when upload() is called.
+     * If this VertBuffer is already uploaded, then the mesh is uploaded immediately (the buffers will grow if there is no free range big enough).
+     */
     VertBuffer* add(SharedMesh);
 
+    /**
+     * Removes the mesh from this VertBuffer, its ranges in the buffers will be reused by meshes added later.
+     * The mesh keeps its offline data, so it can be added to a VertBuffer again.
+     * Unlike destroying all meshes, removing all meshes does not delete this VertBuffer.
+     */
+    void remove(const SharedMesh &);
+
     /**
      * upload all added Meshes to OpenGL, after uploading the Meshes can be drawn.
      * 
@@ -38,10 +58,23 @@ class VertBuffer
 
     void bind();
 
-    void onMeshDestroyed(); // Called by ~Mesh()
+    GLuint getVaoId() const;
+
+    void onMeshDestroyed(Mesh *); // Called by ~Mesh()
 
+    /**
+     * Reuploads the first vertices of the mesh.
+     * If the mesh has more vertices than it has room for in the buffer, it is moved to a bigger range.
+     * On WebGL the mesh is added again instead, which needs its indices and can move it to another VertBuffer (see add()).
+     */
     void reuploadVertices(const SharedMesh &, int numVerticesToReuploadOrAll = -1 /* -1 => all */);
 
+    /**
+     * Reuploads only vertices [firstVertex, firstVertex + nrOfVertices) of the mesh, for example the vertices changed by a MorphTargetBlender.
+     * The mesh keeps the number of vertices it has in the buffer.
+     */
+    void reuploadVertices(const SharedMesh &, int firstVertex, int nrOfVertices);
+
     /**
      * upload vertex-attributes that do not advance per vertex, but per instance (glDrawElementsInstanced() & glVertexAttribDivisor())
      * also known as Instanced Arrays (https://www.khronos.org/opengl/wiki/Vertex_Specification#Instanced_arrays)
@@ -54,8 +87,26 @@ class VertBuffer
 
     void usePerInstanceData(GLuint instanceDataId, GLuint advanceRate = 1);
 
+    /**
+     * Uses the segment of 'streamingBuffer' that was written last as per instance data, starting at its vertex 'firstVertex'.
+     * Call this again after every StreamingBuffer::endWrite().
+     */
+    void usePerInstanceData(const class StreamingBuffer &streamingBuffer, GLuint advanceRate = 1, int firstVertex = 0);
+
+    // Disables the per instance attributes enabled by usePerInstanceData(), so draws without per instance data do not read from a buffer that might be deleted.
+    void stopUsingPerInstanceData(const VertAttributes &instanceAttributes);
+
     void deletePerInstanceData(GLuint instanceDataId);
 
+    /**
+     * Moves meshes (and parts) from the end of the buffers into free ranges closer to the start, by copying on the GPU.
+     * Stops after moving about 'maxBytesToMove' bytes, so it can be called every frame without stalls.
+     * Returns false when nothing could be moved anymore.
+     *
+     * On WebGL only indices are moved, because vertices cannot be moved without rewriting the indices.
+     */
+    bool defragment(GLuint maxBytesToMove = 1024 * 1024);
+
     ~VertBuffer();
 
   private:
@@ -65,20 +116,72 @@ class VertBuffer
 
     VertBuffer(const VertAttributes &);
 
+    /**
+     * Keeps track of the free ranges of a buffer (in vertices or bytes).
+     * Free ranges are sorted by offset and merged with their neighbours, allocation is first fit.
+     */
+    class RangeAllocator
+    {
+      public:
+        // Finds the first free range that can fit 'size' at an offset aligned to 'alignment'.
+        bool find(GLuint size, GLuint alignment, GLuint &offset) const;
+
+        // Marks [offset, offset + size) as used. The range must be free.
+        void take(GLuint offset, GLuint size);
+
+        void free(GLuint offset, GLuint size);
+
+        // Adds a free range at the end.
+        void grow(GLuint newCapacity);
+
+        GLuint getCapacity() const;
+
+        // The size of the free range at the end, which does not need to be copied when growing.
+        GLuint getFreeAtEnd() const;
+
+      private:
+        // offset -> size
+        std::map<GLuint, GLuint> freeRanges;
+        GLuint capacity = 0;
+    };
+
+    /**
+     * On WebGL the base vertex is added to the indices, so the index types of the parts have to fit the position the mesh gets in this VertBuffer.
+     * Promotes the index types where needed. Returns false if the mesh should go to 'next' instead, to keep its unsigned short indices.
+     * Does nothing on other platforms.
+     */
+    bool fitIndexTypesToPosition(Mesh &);
+
     // returns wether the stored vertex data is actually used by Meshes
     bool inUse() const;
 
-    void setAttrPointersAndEnable(VertAttributes &, unsigned int divisor=0, unsigned int locationOffset=0);
+    // Allocates a range in 'allocator', the buffer will grow when there is no free range big enough.
+    GLuint allocate(RangeAllocator &, GLuint size, GLuint alignment);
+
+    // Recreates the vertex or index buffer with a bigger size, and copies the old contents on the GPU.
+    void growBuffer(bool indices, GLuint newCapacity);
+
+    void allocateRangesFor(Mesh &);
+
+    void freeRangesOf(Mesh &);
+
+    void uploadMesh(Mesh &, bool disposeOfflineData);
+
+    void uploadIndices(Mesh &);
+
+    void setAttrPointersAndEnable(const VertAttributes &, unsigned int divisor=0, unsigned int locationOffset=0, GLintptr bufferOffset=0);
 
     // ids of the VertexArrayObject, VertexBufferObject and IndexBufferObject
-    GLuint vaoId = 0, vboId = 0, iboId;
+    GLuint vaoId = 0, vboId = 0, iboId = 0;
 
     std::vector<GLuint> instanceVbos;
     std::vector<VertAttributes> instanceVboAttrs;
     
-    GLuint nrOfVerts = 0, nrOfIndices = 0;
+    // Vertex buffer in number of vertices, index buffer in bytes:
+    RangeAllocator vertexRanges, indexRanges;
 
-    std::vector<std::weak_ptr<Mesh>> meshes;
+    // Meshes notify this VertBuffer when they are destroyed, so these pointers are always valid.
+    std::vector<Mesh *> meshes;
 
     VertAttributes attrs;
 
@@ -24,6 +24,11 @@ void beginNewFrame()
     while (frames.size() > takeAverageOfNFrames) frames.pop_front();
 }
 
+void addToCounter(const std::string &name, double count)
+{
+    frames.back().counters[name] += count;
+}
+
 void dumpToJson()
 {
     json j = json::object();
@@ -42,9 +47,13 @@ void dumpToJson()
                 funcs::dumpZone(j[prefix]["sub"], sub.first.c_str(), sub.second);
         }
     };
-    for (auto &sub : getAverageFrame().subZones)
+    ZoneTime avg = getAverageFrame();
+    for (auto &sub : avg.subZones)
         funcs::dumpZone(j, sub.first.c_str(), sub.second);
 
+    for (auto &[name, count] : avg.counters)
+        j["counters"][name] = count;
+
     CodeEditor::tabs.emplace_back().title = "profiler_dump_" + std::to_string(glfwGetTime()) + ".json";
     CodeEditor::tabs.back().code = j.dump(2);
     CodeEditor::tabs.back().save = [] (CodeEditor::Tab &t)
@@ -111,6 +120,15 @@ void drawProfilerImGUI()
         for (auto &sub : avg.subZones)
             funcs::showZone(sub.first.c_str(), sub.second);
 
+        for (auto &[name, count] : avg.counters)
+        {
+            ImGui::Separator();
+            ImGui::Text("%s", name.c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%.0f", count);
+            ImGui::NextColumn();
+        }
+
         ImGui::Columns(1);
         ImGui::PopStyleVar();
 
@@ -147,7 +165,11 @@ ZoneTime getAverageFrame()
 
     int nrOfFrames = frames.size();
     for (ZoneTime &frame : frames)
+    {
         addToAvg(avg, frame, nrOfFrames);
+        for (auto &[name, count] : frame.counters)
+            avg.counters[name] += count / nrOfFrames;
+    }
 
     return avg;
 }
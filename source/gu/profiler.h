@@ -16,6 +16,9 @@ namespace gu::profiler
         std::map<std::string, ZoneTime> subZones;
         std::string activeSubZone;
 
+        // Only used for frames, see addToCounter():
+        std::map<std::string, double> counters;
+
         ZoneTime *getActiveSubZone()
         {
             return activeSubZone.empty() ? this : subZones[activeSubZone].getActiveSubZone();
@@ -47,6 +50,9 @@ namespace gu::profiler
 
     void beginNewFrame();
 
+    // Adds 'count' to a counter of the current frame (for example the number of draw calls). The average per frame is shown next to the zones.
+    void addToCounter(const std::string &name, double count);
+
     void drawProfilerImGUI();
 
     ZoneTime getAverageFrame();
@@ -0,0 +1,146 @@
+
+#include "distance_field.h"
+
+#include "../utils/parallel.h"
+
+namespace mu
+{
+
+namespace
+{
+
+const float DISTANCE_FIELD_INF = 1e20f;
+
+/**
+ * 1D squared distance transform of 'f' (with 'n' samples) into 'd'.
+ * 'd' is written with 'stride', 'v' and 'z' are temporary arrays of size n and n + 1.
+ */
+void distanceTransform1D(const float *f, float *d, int n, int stride, int *v, float *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -DISTANCE_FIELD_INF;
+    z[1] = DISTANCE_FIELD_INF;
+
+    for (int q = 1; q < n; q++)
+    {
+        const float fq = f[q] + float(q * q);
+        float s = (fq - (f[v[k]] + float(v[k] * v[k]))) / float(2 * q - 2 * v[k]);
+        while (s <= z[k])
+        {
+            k--;
+            s = (fq - (f[v[k]] + float(v[k] * v[k]))) / float(2 * q - 2 * v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = DISTANCE_FIELD_INF;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < float(q))
+            k++;
+        const float diff = float(q - v[k]);
+        d[q * stride] = diff * diff + f[v[k]];
+    }
+}
+
+/**
+ * Squared Euclidean distance transform of 'grid' (0 for feature pixels, DISTANCE_FIELD_INF otherwise), in place.
+ */
+void distanceTransform2D(std::vector<float> &grid, int width, int height)
+{
+    // columns:
+    gu::parallel::forRanges(width, 16, [&] (int xBegin, int xEnd) {
+
+        std::vector<float> column(height);
+        std::vector<int> v(height);
+        std::vector<float> z(height + 1);
+
+        for (int x = xBegin; x < xEnd; x++)
+        {
+            for (int y = 0; y < height; y++)
+                column[y] = grid[x + y * width];
+
+            distanceTransform1D(&column[0], &grid[x], height, width, &v[0], &z[0]);
+        }
+    });
+    // rows:
+    gu::parallel::forRanges(height, 16, [&] (int yBegin, int yEnd) {
+
+        std::vector<float> row(width);
+        std::vector<int> v(width);
+        std::vector<float> z(width + 1);
+
+        for (int y = yBegin; y < yEnd; y++)
+        {
+            float *gridRow = &grid[y * width];
+            std::copy(gridRow, gridRow + width, row.begin());
+
+            distanceTransform1D(&row[0], gridRow, width, 1, &v[0], &z[0]);
+        }
+    });
+}
+
+}
+
+float DistanceField::get(int x, int y) const
+{
+    return distances.at(x + y * width);
+}
+
+std::vector<uint8> DistanceField::toBytes(float spread) const
+{
+    std::vector<uint8> bytes(distances.size());
+    for (int i = 0; i < distances.size(); i++)
+        bytes[i] = uint8(clamp(128.0f - distances[i] / spread * 128.0f, 0.0f, 255.0f));
+    return bytes;
+}
+
+DistanceField generateDistanceField(const uint8 *inside, int width, int height)
+{
+    DistanceField field;
+    field.width = width;
+    field.height = height;
+
+    const int size = width * height;
+    if (size <= 0)
+        return field;
+
+    // distance to the nearest pixel inside the shape, and distance to the nearest pixel outside the shape:
+    std::vector<float> toInside(size), toOutside(size);
+    for (int i = 0; i < size; i++)
+    {
+        toInside[i] = inside[i] ? 0.0f : DISTANCE_FIELD_INF;
+        toOutside[i] = inside[i] ? DISTANCE_FIELD_INF : 0.0f;
+    }
+    distanceTransform2D(toInside, width, height);
+    distanceTransform2D(toOutside, width, height);
+
+    field.distances.resize(size);
+    gu::parallel::forRanges(size, 4096, [&] (int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            // move the edge to halfway between the last inside pixel and the first outside pixel:
+            field.distances[i] = inside[i]
+                ? 0.5f - sqrt(toOutside[i])
+                : sqrt(toInside[i]) - 0.5f;
+        }
+    });
+    return field;
+}
+
+DistanceField generateDistanceField(
+    const uint8 *pixels, int width, int height, int nrOfChannels, int alphaChannel, uint8 alphaThreshold
+)
+{
+    std::vector<uint8> inside(width * height);
+    for (int i = 0; i < inside.size(); i++)
+        inside[i] = pixels[i * nrOfChannels + alphaChannel] > alphaThreshold;
+
+    return generateDistanceField(inside.data(), width, height);
+}
+
+}
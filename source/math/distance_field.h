@@ -0,0 +1,49 @@
+#ifndef MATH_DISTANCE_FIELD_H
+#define MATH_DISTANCE_FIELD_H
+
+#include "math_utils.h"
+
+#include <vector>
+
+namespace mu
+{
+
+/**
+ * A 2D signed distance field, calculated on the CPU.
+ *
+ * Distances are in pixels: negative inside the shape, positive outside the shape, the edge of the shape is at 0.
+ */
+struct DistanceField
+{
+    int width = 0, height = 0;
+    std::vector<float> distances;
+
+    float get(int x, int y) const;
+
+    /**
+     * Converts the distances to bytes that can be uploaded as a single channel texture (GL_R8).
+     * -spread maps to 255, the edge maps to 128, and +spread maps to 0.
+     */
+    std::vector<uint8> toBytes(float spread) const;
+};
+
+/**
+ * Generates a signed distance field of a binary image, where 'inside' has a non-zero byte for every pixel inside the shape.
+ *
+ * Uses the separable linear-time Euclidean distance transform by Felzenszwalb & Huttenlocher:
+ * https://cs.brown.edu/people/pfelzens/papers/dt-final.pdf
+ * Columns and rows are processed in parallel.
+ */
+DistanceField generateDistanceField(const uint8 *inside, int width, int height);
+
+/**
+ * Generates a signed distance field from decoded image data (for example from stb_image).
+ * A pixel is inside the shape when the byte at 'alphaChannel' is bigger than 'alphaThreshold'.
+ */
+DistanceField generateDistanceField(
+    const uint8 *pixels, int width, int height, int nrOfChannels, int alphaChannel, uint8 alphaThreshold = 0u
+);
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+
+#include "parallel.h"
+
+#ifndef EMSCRIPTEN
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+namespace gu::parallel
+{
+
+#ifndef EMSCRIPTEN
+
+namespace
+{
+
+class WorkerPool
+{
+  public:
+
+    WorkerPool()
+    {
+        const int nrOfWorkers = std::max<int>(1, int(std::thread::hardware_concurrency()) - 1);
+        for (int i = 0; i < nrOfWorkers; i++)
+            workers.emplace_back(&WorkerPool::work, this);
+    }
+
+    int nrOfWorkers() const
+    {
+        return workers.size();
+    }
+
+    void push(std::function<void()> &&job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAdded.notify_one();
+    }
+
+    // Executes one waiting job on the calling thread, returns false if there were no jobs waiting.
+    bool tryExecuteJob()
+    {
+        std::function<void()> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty())
+                return false;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+        return true;
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bStopping = true;
+        }
+        jobAdded.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+  private:
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAdded;
+    bool bStopping = false;
+
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAdded.wait(lock, [&] { return bStopping || !jobs.empty(); });
+
+                if (bStopping && jobs.empty())
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+WorkerPool &pool()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+}
+
+int nrOfThreads()
+{
+    return pool().nrOfWorkers() + 1;
+}
+
+void forRanges(int count, int minRangeSize, const std::function<void(int begin, int end)> &rangeCallback)
+{
+    if (count <= 0)
+        return;
+
+    const int nrOfRanges = std::min(nrOfThreads(), (count + std::max(1, minRangeSize) - 1) / std::max(1, minRangeSize));
+    if (nrOfRanges <= 1)
+    {
+        rangeCallback(0, count);
+        return;
+    }
+
+    std::atomic<int> rangesLeft = nrOfRanges;
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+
+    auto executeRange = [&] (int rangeI)
+    {
+        const int
+            begin = int(int64_t(count) * rangeI / nrOfRanges),
+            end = int(int64_t(count) * (rangeI + 1) / nrOfRanges);
+        try
+        {
+            rangeCallback(begin, end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(exceptionMutex);
+            if (!exception)
+                exception = std::current_exception();
+        }
+        rangesLeft--;
+    };
+
+    for (int rangeI = 1; rangeI < nrOfRanges; rangeI++)
+        pool().push([&, rangeI] { executeRange(rangeI); });
+
+    executeRange(0);
+
+    // Help with other jobs while waiting, this prevents deadlocks when forRanges() is called by a worker.
+    while (rangesLeft > 0)
+        if (!pool().tryExecuteJob())
+            std::this_thread::yield();
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+#else
+
+int nrOfThreads()
+{
+    return 1;
+}
+
+void forRanges(int count, int minRangeSize, const std::function<void(int begin, int end)> &rangeCallback)
+{
+    if (count > 0)
+        rangeCallback(0, count);
+}
+
+#endif
+
+}
@@ -0,0 +1,41 @@
+
+#ifndef GU_PARALLEL_H
+#define GU_PARALLEL_H
+
+#include <functional>
+
+/**
+ * A small pool of worker threads that is shared by the whole library (constructed on first use).
+ *
+ * On web-builds (EMSCRIPTEN) there are no worker threads and everything is executed on the calling thread.
+ */
+namespace gu::parallel
+{
+
+// Number of threads that work on a parallel loop, including the calling thread.
+int nrOfThreads();
+
+/**
+ * Splits [0, count) into ranges of at least 'minRangeSize' and calls 'rangeCallback' for every range.
+ * Ranges are executed on the worker threads and the calling thread. Returns when all ranges are done.
+ *
+ * If 'rangeCallback' throws, the first exception is rethrown on the calling thread.
+ * It is safe to call this from inside another 'rangeCallback'.
+ */
+void forRanges(int count, int minRangeSize, const std::function<void(int begin, int end)> &rangeCallback);
+
+/**
+ * Same as above, but calls 'callback' for every index.
+ */
+template<typename Callback>
+inline void forEach(int count, int minRangeSize, Callback &&callback)
+{
+    forRanges(count, minRangeSize, [&] (int begin, int end) {
+        for (int i = begin; i < end; i++)
+            callback(i);
+    });
+}
+
+}
+
+#endif